@@ -136,6 +136,16 @@ void CLISetInterface::showUsage() {
   cli << _("   :pwd                Print the current working directory.\n");
   cli << _("   :cd                 Change the working directory.\n");
   cli << _("   :! <command>        Perform a shell command.\n");
+  #if USE_SCRIPT_PROFILING
+    cli << _("   :profile [<level>]  Show the time spent in script functions, up to the given depth.\n");
+    cli << _("   :profile full       Show the complete profile.\n");
+    cli << _("   :profile on|sample|off\n");
+    cli << _("                       Time all function calls, sample the running function, or stop profiling.\n");
+    cli << _("   :profile trace <file>\n");
+    cli << _("                       Save the profile as Chrome trace events (JSON).\n");
+    cli << _("   :profile folded <file>\n");
+    cli << _("                       Save the profile as folded stacks, for making flame graphs.\n");
+  #endif
   cli << _("\n Commands can be abreviated to their first letter if there is no ambiguity.\n\n");
 }
 
@@ -204,8 +214,19 @@ void CLISetInterface::handleCommand(const String& command) {
         }
       #if USE_SCRIPT_PROFILING
         } else if (before == _(":profile")) {
+          String file;
           if (arg == _("full")) {
-            showProfilingStats(profile_root);
+            showProfilingStats(profile_full());
+          } else if (arg == _("on")) {
+            set_profiler_mode(PROFILER_TIMING);
+          } else if (arg == _("sample")) {
+            set_profiler_mode(PROFILER_SAMPLING);
+          } else if (arg == _("off")) {
+            set_profiler_mode(PROFILER_OFF);
+          } else if (arg.StartsWith(_("trace "), &file)) {
+            export_profile(profile_full(), file, PROFILE_CHROME_TRACE);
+          } else if (arg.StartsWith(_("folded "), &file)) {
+            export_profile(profile_full(), file, PROFILE_FOLDED);
           } else {
             long level = 1;
             arg.ToLong(&level);
@@ -255,5 +276,13 @@ void CLISetInterface::handleCommand(const String& command) {
     FOR_EACH_REVERSE(c, children) {
       showProfilingStats(*c, level + 1);
     }
+    // show counters
+    if (level == 0 && !profile_counters().empty()) {
+      cli << ENDL << GRAY << _("Count     Counter") << ENDL;
+      cli <<             _("========  ===============================") << NORMAL << ENDL;
+      FOR_EACH_CONST(c, profile_counters()) {
+        cli << String::Format(_("%8d  %s"), (int)c->get(), c->name) << ENDL;
+      }
+    }
   }
 #endif
@@ -57,6 +57,8 @@ public:
   
   /// Keyword usage statistics
   vector<pair<const Value*,const Keyword*>> keyword_usage;
+  /// Keyword expansions remembered for values of this card before this age are invalid, see KeywordExpansionMemo
+  Age keyword_expansions_valid_since;
   
   /// Get the identification of this card, an identification is something like a name, title, etc.
   /** May return "" */
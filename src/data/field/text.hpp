@@ -27,6 +27,7 @@ DECLARE_POINTER_TYPE(TextValue);
 DECLARE_POINTER_TYPE(TextBackground);
 DECLARE_POINTER_TYPE(TextLayout);
 DECLARE_POINTER_TYPE(LineLayout);
+class KeywordExpansionMemo;
 
 /// A field for values containing tagged text
 class TextField : public Field {
@@ -111,6 +112,8 @@ public:
   
   ValueType value;                ///< The text of this value
   Age       last_update;          ///< When was the text last changed?
+  /// The last keyword expansion done while updating this value, see expand_keywords
+  shared_ptr<KeywordExpansionMemo> keyword_memo;
   
   bool update(Context&) override;
 };
@@ -66,3 +66,15 @@ SetP import_set(String name) {
   assert(!file_formats.empty() && file_formats[0]->canImport());
   return file_formats[0]->importSet(name);
 }
+
+// ----------------------------------------------------------------------------- : Progress
+
+ExportProgressDialog::ExportProgressDialog(Window* parent, const String& title, const String& message)
+  : wxProgressDialog(title, message, 1000, parent, wxPD_APP_MODAL | wxPD_SMOOTH | wxPD_CAN_ABORT)
+{}
+
+void ExportProgressDialog::onProgress(float progress, const String& message) {
+  if (!Update(int(progress * 1000), message)) {
+    throw AbortException();
+  }
+}
@@ -11,6 +11,7 @@
 #include <util/prec.hpp>
 #include <util/error.hpp>
 #include <data/settings.hpp>
+#include <wx/progdlg.h>
 
 class Game;
 DECLARE_POINTER_TYPE(Set);
@@ -86,14 +87,41 @@ FileFormatP mse1_file_format();
 FileFormatP mse2_file_format();
 FileFormatP mtg_editor_file_format();
 
+// ----------------------------------------------------------------------------- : Progress
+
+/// Callback for updating a progress bar
+class WithProgress {
+public:
+  virtual void onProgress(float progress, const String& message) = 0;
+  virtual ~WithProgress () {}
+};
+
+/// Exception thrown to indicate exporting should be aborted
+class AbortException {};
+
+/// A dialog to show the progress of exporting
+class ExportProgressDialog : public wxProgressDialog, public WithProgress {
+public:
+  ExportProgressDialog(Window* parent, const String& title, const String& message);
+  
+  /// Update the progress bar
+  /** if the operation should be aborted, throws an AbortException
+   */
+  void onProgress(float progress, const String& message) override;
+};
+
 // ----------------------------------------------------------------------------- : Other ways to export
 
 /// Export images for each card in a set to a list of files
 void export_images(Window* parent, const SetP& set);
 
 /// Export the image for each card in a list of cards
+/** Cards are rendered on the calling thread, the images are encoded and written by worker threads.
+ *  If progress is given, it is informed after each card. It can abort by throwing an AbortException.
+ */
 void export_images(const SetP& set, const vector<CardP>& cards,
-                   const String& path, const String& filename_template, FilenameConflicts conflicts);
+                   const String& path, const String& filename_template, FilenameConflicts conflicts,
+                   WithProgress* progress = nullptr);
 
 /// Export the image of a single card
 void export_image(const SetP& set, const CardP& card, const String& filename);
@@ -14,7 +14,10 @@
 #include <data/stylesheet.hpp>
 #include <data/settings.hpp>
 #include <render/card/viewer.hpp>
+#include <util/parallel.hpp>
 #include <wx/filename.h>
+#include <condition_variable>
+#include <deque>
 
 // ----------------------------------------------------------------------------- : Single card export
 
@@ -44,11 +47,8 @@ Rotation UnzoomedDataViewer::getRotation() const {
   }
 }
 
-Bitmap export_bitmap(const SetP& set, const CardP& card) {
-  if (!set) throw Error(_("no set"));
-  // create viewer
-  UnzoomedDataViewer viewer(!settings.stylesheetSettingsFor(set->stylesheetFor(card)).card_normal_export());
-  viewer.setSet(set);
+/// Draw a card using an existing viewer
+Bitmap export_bitmap(UnzoomedDataViewer& viewer, const CardP& card) {
   viewer.setCard(card);
   // size of cards
   RealSize size = viewer.getRotation().getExternalSize();
@@ -63,31 +63,163 @@ Bitmap export_bitmap(const SetP& set, const CardP& card) {
   return bitmap;
 }
 
+Bitmap export_bitmap(const SetP& set, const CardP& card) {
+  if (!set) throw Error(_("no set"));
+  // create viewer
+  UnzoomedDataViewer viewer(!settings.stylesheetSettingsFor(set->stylesheetFor(card)).card_normal_export());
+  viewer.setSet(set);
+  return export_bitmap(viewer, card);
+}
+
 // ----------------------------------------------------------------------------- : Multiple card export
 
+/// Writes images to files on worker threads
+/** Encoding an image (in particular as png) takes about as long as drawing the card,
+ *  so by doing that in the background the main thread can continue with the next card.
+ *  Drawing itself has to happen on the main thread, since wx drawing is not thread safe.
+ */
+class ImageWriteQueue {
+public:
+  ImageWriteQueue(size_t thread_count)
+    : max_waiting(2 * thread_count)
+  {
+    for (size_t i = 0 ; i < thread_count ; ++i) {
+      threads.emplace_back([this] { work(); });
+    }
+  }
+  ~ImageWriteQueue() {
+    // discard remaining work, we get here without finish() if there was an exception
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobs.clear();
+      closed = true;
+    }
+    has_jobs.notify_all();
+    has_room.notify_all();
+    FOR_EACH(t, threads) t.join();
+  }
+
+  /// Add an image to be written, blocks while too many images are already waiting
+  /** The image should not be shared with other threads, since wxImage reference counts are not atomic */
+  void push(unique_ptr<Image> image, const String& filename) {
+    std::unique_lock<std::mutex> lock(mutex);
+    has_room.wait(lock, [this] { return jobs.size() < max_waiting || error; });
+    rethrowError();
+    jobs.push_back(Job{move(image), filename});
+    has_jobs.notify_one();
+  }
+
+  /// Wait at most timeout for all images to be written, returns true if they are
+  /** Rethrows the exception if writing an image failed. */
+  bool waitUntilDone(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mutex);
+    bool done = all_done.wait_for(lock, timeout, [this] { return (jobs.empty() && busy == 0) || error; });
+    rethrowError();
+    return done;
+  }
+
+  /// Number of images that have been written so far
+  inline size_t written() const { return written_count; }
+
+private:
+  struct Job {
+    unique_ptr<Image> image;
+    String filename;
+  };
+  std::mutex              mutex;
+  std::condition_variable has_jobs, has_room, all_done;
+  std::deque<Job>         jobs;
+  vector<std::thread>     threads;
+  size_t                  max_waiting;
+  size_t                  busy = 0;      ///< Number of jobs being written right now
+  bool                    closed = false;
+  std::exception_ptr      error;
+  std::atomic<size_t>     written_count{0};
+
+  void work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      has_jobs.wait(lock, [this] { return !jobs.empty() || closed; });
+      if (jobs.empty()) return;
+      Job job = move(jobs.front());
+      jobs.pop_front();
+      busy++;
+      has_room.notify_one();
+      lock.unlock();
+      try {
+        job.image->SaveFile(job.filename); // image.SaveFile determines the file type from the extension
+        job.image.reset();
+        written_count++;
+      } catch (...) {
+        std::lock_guard<std::mutex> error_lock(mutex);
+        if (!error) error = std::current_exception();
+      }
+      lock.lock();
+      busy--;
+      if (error) jobs.clear();
+      if ((jobs.empty() && busy == 0) || error) {
+        all_done.notify_all();
+        has_room.notify_all();
+      }
+    }
+  }
+  void rethrowError() {
+    if (error) std::rethrow_exception(error);
+  }
+};
 
 void export_images(const SetP& set, const vector<CardP>& cards,
-                   const String& path, const String& filename_template, FilenameConflicts conflicts)
+                   const String& path, const String& filename_template, FilenameConflicts conflicts,
+                   WithProgress* progress)
 {
   wxBusyCursor busy;
   // Script
   ScriptP filename_script = parse(filename_template, nullptr, true);
   // Path
   wxFileName fn(path);
+  // One viewer per stylesheet, so the value viewers are reused between cards
+  map<pair<const StyleSheet*,bool>, unique_ptr<UnzoomedDataViewer>> viewers;
+  // The main thread renders, the other threads write
+  ImageWriteQueue queue(max((size_t)1, worker_thread_count() - 1));
+  // Progress: first half for drawing, second half for writing
+  size_t drawn = 0, skipped = 0;
+  auto report = [&](const String& message) {
+    if (progress) progress->onProgress(float(drawn + skipped + queue.written()) / float(2 * cards.size()), message);
+  };
   // Export
   std::set<String> used; // for CONFLICT_NUMBER_OVERWRITE
   FOR_EACH_CONST(card, cards) {
     // filename for this card
     Context& ctx = set->getContext(card);
     String filename = clean_filename(untag(ctx.eval(*filename_script)->toString()));
-    if (!filename) continue; // no filename -> no saving
     // full path
-    fn.SetFullName(filename);
+    if (!filename.empty()) fn.SetFullName(filename);
     // does the file exist?
-    if (!resolve_filename_conflicts(fn, conflicts, used)) continue;
-    // write image
+    if (filename.empty() || !resolve_filename_conflicts(fn, conflicts, used)) {
+      // no filename -> no saving
+      skipped += 2;
+      report(filename);
+      continue;
+    }
     filename = fn.GetFullPath();
     used.insert(filename);
-    export_image(set, card, filename);
+    // draw the card
+    const StyleSheet& stylesheet = set->stylesheetFor(card);
+    bool use_zoom_settings = !settings.stylesheetSettingsFor(stylesheet).card_normal_export();
+    auto& viewer = viewers[make_pair(&stylesheet, use_zoom_settings)];
+    if (!viewer) {
+      viewer = make_unique<UnzoomedDataViewer>(use_zoom_settings);
+      viewer->setSet(set);
+    }
+    auto image = make_unique<Image>(export_bitmap(*viewer, card).ConvertToImage());
+    drawn++;
+    // write image in the background
+    queue.push(move(image), filename);
+    report(fn.GetFullName());
+  }
+  // wait for the writers
+  while (!queue.waitUntilDone(std::chrono::milliseconds(100))) {
+    report(wxEmptyString);
   }
+  report(wxEmptyString);
 }
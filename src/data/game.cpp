@@ -25,6 +25,7 @@ IMPLEMENT_DYNAMIC_ARG(Game*, game_for_reading, nullptr);
 Game::Game()
   : has_keywords(false)
   , dependencies_initialized(false)
+  , keyword_scripts_use_cards(false)
 {}
 
 GameP Game::byName(const String& name) {
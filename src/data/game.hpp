@@ -59,6 +59,7 @@ public:
   Dependencies dependent_scripts_keywords;        ///< scripts that depend on the keywords
   Dependencies dependent_scripts_stylesheet;    ///< scripts that depend on the card's stylesheet
   bool dependencies_initialized;                  ///< are the script dependencies comming from this game all initialized?
+  bool keyword_scripts_use_cards;                 ///< do the scripts passed to expand_keywords look at the card list?
   
   /// Loads the game with a particular name, for example "magic"
   static GameP byName(const String& name);
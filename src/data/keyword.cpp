@@ -8,11 +8,12 @@
 
 #include <util/prec.hpp>
 #include <data/keyword.hpp>
+#include <data/stylesheet.hpp>
 #include <util/tagged_string.hpp>
-#include <unordered_map>
-#include <unordered_set>
+#include <script/profiler.hpp>
+#include <atomic>
+#include <mutex>
 
-class KeywordTrie;
 DECLARE_POINTER_TYPE(KeywordParamValue);
 class Value;
 DECLARE_DYNAMIC_ARG(Value*, value_being_updated);
@@ -208,83 +209,202 @@ void Keyword::prepare(const vector<KeywordParamP>& param_types, bool force) {
   valid = !match_re.matches(_(""));
 }
 
-// ----------------------------------------------------------------------------- : KeywordTrie
+// ----------------------------------------------------------------------------- : KeywordMatcher
 
-namespace std {
-  template <> struct hash<wxUniChar> {
-    inline size_t operator () (wxUniChar x) const {
-      return std::hash<wxUniChar::value_type>()(x.GetValue());
-    }
-  };
-}
-
-/// A node in a trie to match keywords
-/* The trie is used to speed up matching, by quickly finding candidate keywords.
-*/
-class KeywordTrie {
+/// Finds the keywords that can possibly match a string
+/** For each keyword we take a fixed piece of text that must occur in every match,
+ *  this is the text before the first parameter (or after the leading parameters).
+ *  These pieces are found with an Aho-Corasick automaton in a single pass over the string.
+ *
+ *  The automaton is stored in flat arrays: characters are first mapped to a small alphabet
+ *  of the characters that occur in any keyword, the transitions are a table indexed by (state,character).
+ */
+class KeywordMatcher {
 public:
-  KeywordTrie();
-  ~KeywordTrie();
+  KeywordMatcher() : compiled(false) {}
+  
+  /// A keyword with the fixed text used to find it
+  struct Entry {
+    const Keyword* keyword;
+    String         text;     ///< Text that must occur in a match (lower case), can be empty
+    bool           anchored; ///< Does every match start with text?
+  };
   
-  unordered_map<wxUniChar, unique_ptr<KeywordTrie>> children; ///< children after a given character
-  KeywordTrie* on_any_star; ///< children on /.*/ (owned or this)
-  vector<const Keyword*> finished; ///< keywords that end in this node
+  /// Add a keyword, invalidates the automaton
+  void add(const Keyword& kw);
   
-  /// Insert nodes representing the given character
-  /** return the node where the evaluation will be after matching the character */
-  KeywordTrie* insert(wxUniChar match);
-  /// Insert nodes representing the given string
-  /** return the node where the evaluation will be after matching the string */
-  KeywordTrie* insert(const String& match);
-
-  /// Insert nodes representing the regex /.*/
-  /** return the node where the evaluation will be after matching that regex */
-  KeywordTrie* insertAnyStar();
+  /// Find the positions in str where the text of each entry occurs
+  /** occurrences[i] are the start positions for entries[i], in increasing order.
+   *  Entries with empty text occur everywhere, they get a single occurrence at position 0.
+   */
+  void find(const String& str, vector<vector<size_t>>& occurrences) const;
+  
+  vector<Entry> entries;
+  
+private:
+  // The automaton
+  vector<Char>   alphabet;       ///< Characters that occur in the texts, sorted
+  unsigned char  ascii_class[128]; ///< Alphabet index of ascii characters
+  vector<int>    transitions;    ///< Next state for each state and alphabet index (0 = any other character)
+  vector<size_t> output_start;   ///< Outputs of state i are outputs[output_start[i]..output_start[i+1]]
+  vector<int>    outputs;        ///< Entries that end in a state, also via suffixes
+  
+  mutable std::atomic<bool> compiled;
+  mutable std::mutex        compile_mutex;
+  /// Build the automaton, if it is not up to date
+  void compile() const;
+  void build();
+  
+  inline size_t charClass(Char c) const {
+    if ((unsigned)c < 128) return ascii_class[c];
+    auto it = lower_bound(alphabet.begin(), alphabet.end(), c);
+    return it != alphabet.end() && *it == c ? it - alphabet.begin() + 1 : 0;
+  }
 };
 
-
-KeywordTrie::KeywordTrie()
-  : on_any_star(nullptr)
-{}
-KeywordTrie::~KeywordTrie() {
-  if (on_any_star != this) delete on_any_star;
-}
-
-KeywordTrie* KeywordTrie::insert(wxUniChar c) {
+inline Char keyword_char(Char c) {
   #if USE_CASE_INSENSITIVE_KEYWORDS
-    c = toLower(c); // case insensitive matching
+    return toLower(c); // case insensitive matching
+  #else
+    return c;
   #endif
-  unique_ptr<KeywordTrie>& child = children[c];
-  if (!child) child.reset(new KeywordTrie);
-  return child.get();
 }
-KeywordTrie* KeywordTrie::insert(const String& match) {
-  KeywordTrie* cur = this;
-  for (wxUniChar c : match) {
-    cur = cur->insert(c);
+
+void KeywordMatcher::add(const Keyword& kw) {
+  // Find the text to match
+  // It doesn't really matter how much of the keyword we match, since this is only used
+  // as an optimization to not have to match lots of regexes.
+  Entry entry = {&kw, String(), true};
+  size_t param = 0;
+  for (size_t i = 0 ; i < kw.match.size() ;) {
+    Char c = kw.match.GetChar(i);
+    if (is_substr(kw.match, i, _("<atom-param"))) {
+      i = match_close_tag_end(kw.match, i);
+      bool only_params = entry.text.empty();
+      // parameter, is there a separator we should eat?
+      if (param < kw.parameters.size()) {
+        kw.parameters[param]->eat_separator_before(entry.text);
+        kw.parameters[param]->eat_separator_after(kw.match, i);
+      }
+      ++param;
+      // If we have matched anything specific, this is a good time to stop
+      if (!only_params) break;
+      entry.anchored = false;
+    } else {
+      entry.text += keyword_char(c);
+      i++;
+    }
   }
-  return cur;
+  entries.push_back(entry);
+  compiled = false;
 }
 
-KeywordTrie* KeywordTrie::insertAnyStar() {
-  if (!on_any_star) on_any_star = new KeywordTrie();
-  on_any_star->on_any_star = on_any_star; // circular reference to itself
-  return on_any_star;
+void KeywordMatcher::compile() const {
+  if (compiled.load(std::memory_order_acquire)) return;
+  std::lock_guard<std::mutex> lock(compile_mutex);
+  if (compiled.load(std::memory_order_relaxed)) return;
+  const_cast<KeywordMatcher*>(this)->build();
+  compiled.store(true, std::memory_order_release);
 }
 
+void KeywordMatcher::build() {
+  // alphabet
+  alphabet.clear();
+  FOR_EACH_CONST(e, entries) {
+    for (size_t i = 0 ; i < e.text.size() ; ++i) alphabet.push_back(e.text.GetChar(i));
+  }
+  sort(alphabet.begin(), alphabet.end());
+  alphabet.erase(unique(alphabet.begin(), alphabet.end()), alphabet.end());
+  for (Char c = 0 ; c < 128 ; ++c) {
+    auto it = lower_bound(alphabet.begin(), alphabet.end(), c);
+    ascii_class[c] = it != alphabet.end() && *it == c ? (unsigned char)(it - alphabet.begin() + 1) : 0;
+  }
+  // note: if there are more than 255 ascii characters in the alphabet something is very wrong
+  size_t n = alphabet.size() + 1;
+  // trie, state 0 is the root, transitions[state*n + c] == 0 means no child
+  transitions.assign(n, 0);
+  vector<vector<int>> state_outputs(1);
+  for (size_t e = 0 ; e < entries.size() ; ++e) {
+    const String& text = entries[e].text;
+    if (text.empty()) continue;
+    size_t state = 0;
+    for (size_t i = 0 ; i < text.size() ; ++i) {
+      size_t c = charClass(text.GetChar(i));
+      int& next = transitions[state * n + c];
+      if (next == 0) {
+        next = (int)state_outputs.size();
+        state_outputs.emplace_back();
+        transitions.resize(transitions.size() + n, 0);
+      }
+      state = transitions[state * n + c]; // note: don't use next, resize invalidates it
+    }
+    state_outputs[state].push_back((int)e);
+  }
+  // failure links, breadth first, turning the trie into a DFA
+  size_t states = state_outputs.size();
+  vector<int> fail(states, 0);
+  vector<int> queue;
+  for (size_t c = 0 ; c < n ; ++c) {
+    if (int s = transitions[c]) queue.push_back(s);
+  }
+  for (size_t q = 0 ; q < queue.size() ; ++q) {
+    int state = queue[q];
+    // outputs of the longest proper suffix that is also in the trie
+    const vector<int>& suffix_outputs = state_outputs[fail[state]];
+    state_outputs[state].insert(state_outputs[state].end(), suffix_outputs.begin(), suffix_outputs.end());
+    for (size_t c = 0 ; c < n ; ++c) {
+      int& next = transitions[state * n + c];
+      int  fail_next = transitions[fail[state] * n + c];
+      if (next) {
+        fail[next] = fail_next;
+        queue.push_back(next);
+      } else {
+        next = fail_next;
+      }
+    }
+  }
+  // flatten outputs
+  output_start.clear();
+  outputs.clear();
+  FOR_EACH_CONST(o, state_outputs) {
+    output_start.push_back(outputs.size());
+    outputs.insert(outputs.end(), o.begin(), o.end());
+  }
+  output_start.push_back(outputs.size());
+}
+
+void KeywordMatcher::find(const String& str, vector<vector<size_t>>& occurrences) const {
+  compile();
+  occurrences.clear();
+  occurrences.resize(entries.size());
+  for (size_t e = 0 ; e < entries.size() ; ++e) {
+    if (entries[e].text.empty()) occurrences[e].push_back(0);
+  }
+  size_t n = alphabet.size() + 1;
+  size_t state = 0;
+  size_t i = 0;
+  for (String::const_iterator it = str.begin() ; it != str.end() ; ++it, ++i) {
+    state = transitions[state * n + charClass(keyword_char(*it))];
+    for (size_t o = output_start[state] ; o < output_start[state + 1] ; ++o) {
+      int e = outputs[o];
+      occurrences[e].push_back(i + 1 - entries[e].text.size());
+    }
+  }
+}
 
 // ----------------------------------------------------------------------------- : KeywordDatabase
 
 IMPLEMENT_DYNAMIC_ARG(KeywordUsageStatistics*, keyword_usage_statistics, nullptr);
 
 KeywordDatabase::KeywordDatabase()
-  : root(nullptr)
+  : expansions_valid_since(1)
 {}
-// Note: has to be here because in the header KeywordTrie is not defined
+// Note: has to be here because in the header KeywordMatcher is not defined
 KeywordDatabase::~KeywordDatabase() {}
 
 void KeywordDatabase::clear() {
-  root.reset();
+  matcher.reset();
+  invalidateExpansions();
 }
 
 void KeywordDatabase::add(const vector<KeywordP>& kws) {
@@ -295,47 +415,8 @@ void KeywordDatabase::add(const vector<KeywordP>& kws) {
 
 void KeywordDatabase::add(const Keyword& kw) {
   if (kw.match.empty() || !kw.valid) return; // can't handle empty keywords
-  // Create root
-  if (!root) {
-    root = make_unique<KeywordTrie>();
-    root->on_any_star = root.get();
-  }
-  KeywordTrie* cur = root->insertAnyStar();
-  // Add to trie
-  String text; // normal text
-  size_t param = 0;
-  bool only_star = true;
-  for (size_t i = 0 ; i < kw.match.size() ;) {
-    Char c = kw.match.GetChar(i);
-    if (is_substr(kw.match, i, _("<atom-param"))) {
-      i = match_close_tag_end(kw.match, i);
-      // parameter, is there a separator we should eat?
-      if (param < kw.parameters.size()) {
-        kw.parameters[param]->eat_separator_before(text);
-        kw.parameters[param]->eat_separator_after(kw.match, i);
-      }
-      ++param;
-      // match anything
-      cur = cur->insert(text);
-      text.clear();
-      cur = cur->insertAnyStar();
-      // enough?
-      if (!only_star) {
-        // If we have matched anything specific, this is a good time to stop
-        // it doesn't really matter how long we go on, since the trie is only used
-        // as an optimization to not have to match lots of regexes.
-        // As an added bonus, we get a better behaviour of matching earlier keywords first.
-        break;
-      }
-    } else {
-      text += c;
-      i++;
-      only_star = false;
-    }
-  }
-  cur = cur->insert(text);
-  // now cur is the trie after matching the keyword anywhere in the input text
-  cur->finished.push_back(&kw);
+  if (!matcher) matcher = make_unique<KeywordMatcher>();
+  matcher->add(kw);
 }
 
 void KeywordDatabase::prepare_parameters(const vector<KeywordParamP>& ps, const vector<KeywordP>& kws) {
@@ -344,77 +425,8 @@ void KeywordDatabase::prepare_parameters(const vector<KeywordParamP>& ps, const
   }
 }
 
-#ifdef _DEBUG
-void dump(int i, const KeywordTrie* t) {
-  FOR_EACH(c, t->children) {
-    wxLogDebug(String(i, _(' ')) + c.first + _("     ") + String::Format(_("%p"), c.second.get()));
-    dump(i + 2, c.second.get());
-  }
-  if (t->on_any_star) {
-    wxLogDebug(String(i, _(' ')) + _(".*") + _("     ") + String::Format(_("%p"), t->on_any_star));
-    if (t->on_any_star != t) dump(i + 2, t->on_any_star);
-  }
-}
-#endif
-
 // ----------------------------------------------------------------------------- : KeywordDatabase : matching
 
-// transitive closure of a state, follow all on_any_star links
-void closure(vector<const KeywordTrie*>& state) {
-  for (size_t j = 0 ; j < state.size() ; ++j) {
-    if (state[j]->on_any_star && state[j]->on_any_star != state[j]) {
-      state.push_back(state[j]->on_any_star);
-    }
-  }
-}
-
-void step_state(vector<const KeywordTrie*>& state, wxUniChar c) {
-  vector<const KeywordTrie*> next;
-  for(auto kt : state) {
-    auto it = kt->children.find(c);
-    if (it != kt->children.end()) {
-      next.push_back(it->second.get());
-    }
-    // TODO: on any star first or last?
-    if (kt->on_any_star) {
-      next.push_back(kt->on_any_star);
-    }
-  }
-  swap(state,next);
-}
-
-// Collect possible matching keywords
-/* First step in matching is to run over the string, and use the trie to find keywords that *potentially* appear in it.
- */
-unordered_set<Keyword const*> possible_matches(String const& tagged_str, KeywordTrie const* trie_root) {
-  unordered_set<const Keyword*> possible_matches;
-  if (!trie_root) return possible_matches;
-
-  vector<const KeywordTrie*> state;
-  state.push_back(trie_root);
-
-  for (String::const_iterator it = tagged_str.begin(); it != tagged_str.end();) {
-    wxUniChar c = *it;
-    // tag?
-    if (c == '<') {
-      it = skip_tag(it, tagged_str.end());
-    } else {
-      ++it;
-      c = toLower(c); // case insensitive matching
-      // find 'next' trie node set matching c
-      step_state(state, c);
-      closure(state);
-      // matches
-      for (auto kt : state) {
-        for (auto kw : kt->finished) {
-          possible_matches.insert(kw);
-        }
-      }
-    }
-  }
-  return possible_matches;
-}
-
 struct KeywordMatch {
   Keyword const* keyword;
   // match in (substring of) the untagged string
@@ -425,21 +437,29 @@ struct KeywordMatch {
 };
 
 // Collect exact matching keywords
-/* Second step in matching is to match regexes
+/* First step in matching is to find the fixed texts of keywords in the string with the KeywordMatcher,
+ * then the regexes of those keywords are matched.
+ * When a match has to start with the fixed text, the regex is only tried at the positions where the text was found.
  */
-void keyword_matches(const String& untagged_str, const Keyword& keyword, vector<KeywordMatch>& out) {
+void keyword_matches(const String& untagged_str, const KeywordMatcher::Entry& entry, const vector<size_t>& occurrences, vector<KeywordMatch>& out) {
+  const Keyword& keyword = *entry.keyword;
   Regex::Results match;
-  size_t i = 0;
-  String::const_iterator it = untagged_str.begin();
-  while (keyword.match_re.matches(match, it, untagged_str.end())) {
-    size_t pos = match[0].first - untagged_str.begin();
-    out.emplace_back(keyword, match, pos);
-    it = max(it+1, match[0].end());
-  }
-}
-void keyword_matches(const String& untagged_str, unordered_set<Keyword const*> keywords, vector<KeywordMatch>& out) {
-  for (auto keyword : keywords) {
-    keyword_matches(untagged_str, *keyword, out);
+  String::const_iterator begin = untagged_str.begin(), end = untagged_str.end();
+  String::const_iterator it = begin;
+  if (entry.anchored && !entry.text.empty()) {
+    FOR_EACH_CONST(pos, occurrences) {
+      if (begin + pos < it) continue; // overlaps with the previous match
+      if (keyword.match_re.matches_at(match, begin + pos, begin, end)) {
+        out.emplace_back(keyword, match, pos);
+        it = max(begin + pos + 1, match[0].second);
+      }
+    }
+  } else {
+    while (keyword.match_re.matches(match, it, end)) {
+      size_t pos = match[0].first - begin;
+      out.emplace_back(keyword, match, pos);
+      it = max(it+1, match[0].second);
+    }
   }
 }
 void sort_keyword_matches(vector<KeywordMatch>& matches) {
@@ -457,9 +477,15 @@ void sort_keyword_matches(vector<KeywordMatch>& matches) {
     return a.keyword->keyword < b.keyword->keyword;
   });
 }
-vector<KeywordMatch> keyword_matches(const String& untagged_str, unordered_set<Keyword const*> keywords) {
+vector<KeywordMatch> keyword_matches(const String& untagged_str, const KeywordMatcher& matcher) {
+  vector<vector<size_t>> occurrences;
+  matcher.find(untagged_str, occurrences);
   vector<KeywordMatch> out;
-  keyword_matches(untagged_str, keywords, out);
+  for (size_t e = 0 ; e < matcher.entries.size() ; ++e) {
+    if (!occurrences[e].empty()) {
+      keyword_matches(untagged_str, matcher.entries[e], occurrences[e], out);
+    }
+  }
   sort_keyword_matches(out);
   return out;
 }
@@ -771,6 +797,19 @@ void remove_from_stats(KeywordUsageStatistics* stat, const Value* stat_key) {
   }
 }
 
+ProfileCounter keyword_memo_hits  (_("keyword expansion memo hits"));
+ProfileCounter keyword_memo_misses(_("keyword expansion memo misses"));
+
+KeywordExpansionMemo::~KeywordExpansionMemo() {}
+
+/// Keep a reference to a script value in a memo
+/** The memo can be released from another thread than the one evaluating the script,
+ *  so the value must no longer use a thread local reference count. */
+void memo_keep(ScriptValueP& memo_value, const ScriptValueP& value) {
+  if (value) value->publish();
+  memo_value = value;
+}
+
 String KeywordDatabase::expand(const String& text, KeywordExpandOptions const& options) const {
   assert(options.combine_script);
   assert_tagged(text);
@@ -778,18 +817,47 @@ String KeywordDatabase::expand(const String& text, KeywordExpandOptions const& o
   // Clean up usage statistics
   remove_from_stats(options.stat, options.stat_key);
   
+  // Expanded the same text before?
+  KeywordExpansionMemo* memo = options.memo;
+  if (memo) {
+    if (memo->age.get() != 0 && expansions_valid_since < memo->age && options.memo_valid_since < memo->age && memo->input == text
+        && memo->match_condition == options.match_condition && memo->expand_default == options.expand_default
+        && memo->combine_script == options.combine_script && memo->stylesheet == options.memo_stylesheet) {
+      ++keyword_memo_hits;
+      if (options.stat) options.stat->insert(options.stat->end(), memo->stat.begin(), memo->stat.end());
+      return memo->output;
+    }
+    ++keyword_memo_misses;
+  }
+  String result = expandNoMemo(text, options);
+  if (memo) {
+    memo->input  = text;
+    memo->output = result;
+    memo->age    = Age();
+    memo_keep(memo->match_condition, options.match_condition);
+    memo_keep(memo->expand_default,  options.expand_default);
+    memo_keep(memo->combine_script,  options.combine_script);
+    memo->stylesheet = options.memo_stylesheet;
+    memo->stat.clear();
+    if (options.stat) {
+      FOR_EACH_CONST(s, *options.stat) {
+        if (s.first == options.stat_key) memo->stat.push_back(s);
+      }
+    }
+  }
+  return result;
+}
+
+String KeywordDatabase::expandNoMemo(const String& text, KeywordExpandOptions const& options) const {
   // Remove all old reminder texts
   String tagged = remove_keyword_tags(text);
 
   // any keywords in database?
-  if (!root) return tagged;
-
-  // Find potential matches
-  auto possible_matches = ::possible_matches(tagged, root.get());
+  if (!matcher) return tagged;
 
-  // Refine
+  // Find matches
   String untagged = untag_no_escape(tagged);
-  auto matches = keyword_matches(untagged, possible_matches);
+  auto matches = keyword_matches(untagged, *matcher);
   
   // Expand
   String result = expand_keywords(tagged, matches, options);
@@ -12,13 +12,15 @@
 #include <script/scriptable.hpp>
 #include <util/dynamic_arg.hpp>
 #include <util/regex.hpp>
+#include <util/age.hpp>
 #include <data/filter.hpp>
 
 DECLARE_POINTER_TYPE(KeywordParam);
 DECLARE_POINTER_TYPE(KeywordMode);
 DECLARE_POINTER_TYPE(Keyword);
 DECLARE_POINTER_TYPE(ParamReferenceType);
-class KeywordTrie;
+DECLARE_POINTER_TYPE(StyleSheet);
+class KeywordMatcher;
 class Value;
 
 // ----------------------------------------------------------------------------- : Keyword parameters
@@ -134,6 +136,33 @@ inline String type_name(const vector<KeywordP>&) {
 /// Store keyword usage statistics here, using value_being_updated as the key
 typedef vector<pair<const Value*, const Keyword*>> KeywordUsageStatistics;
 
+/// The last keyword expansion for a value, to skip expanding the same text again
+/** The memo is valid if the input and the settings are the same,
+ *  and the KeywordDatabase has not been invalidated since (see KeywordDatabase::invalidateExpansions),
+ *  and neither has the card (see Card::keyword_expansions_valid_since).
+ *  The settings are compared by identity; the memo holds a reference to them,
+ *  so their addresses can not be reused by other objects.
+ *
+ *  Memos are not stored in the set file, so the first expansion after loading a set is never skipped.
+ *  They help when a value is updated again while nothing the expansion depends on has changed,
+ *  such as values that depend on the card list, which are updated again for every card when cards are added,
+ *  and values on cards other than the one that is edited.
+ */
+class KeywordExpansionMemo {
+public:
+  KeywordExpansionMemo(const Value* owner) : owner(owner), age(0) {}
+  ~KeywordExpansionMemo();
+  
+  /// The value this memo belongs to
+  /** Copies of a value share the memo of the original, they should make their own, see expand_keywords. */
+  const Value* const owner;
+  String input, output;
+  Age    age;           ///< When was the expansion done? 0 for never
+  ScriptValueP match_condition, expand_default, combine_script; ///< Scripts used for the expansion
+  StyleSheetP  stylesheet;     ///< Stylesheet used for the expansion
+  KeywordUsageStatistics stat; ///< Usage statistics added by the expansion
+};
+
 struct KeywordExpandOptions {
   ScriptValueP match_condition;
   ScriptValueP expand_default;
@@ -141,6 +170,9 @@ struct KeywordExpandOptions {
   Context& ctx;
   KeywordUsageStatistics* stat;
   const Value* stat_key;
+  KeywordExpansionMemo* memo;  ///< Where to remember the result, can be nullptr
+  StyleSheetP memo_stylesheet; ///< Stylesheet used for the expansion, scripts can depend on it
+  Age memo_valid_since;        ///< Memos from before this age are invalid as well
 };
 
 /// A database of keywords to allow for fast matching
@@ -163,7 +195,7 @@ public:
   /// Clear the database
   void clear();
   /// Is the database empty?
-  inline bool empty() const { return !root; }
+  inline bool empty() const { return !matcher; }
   
   /// Expand/update all keywords in the given string.
   /** @param options.expand_default script function indicating whether reminder text should be shown by default
@@ -174,8 +206,14 @@ public:
    */
   String expand(const String& text, const KeywordExpandOptions&) const;
   
+  /// Forget all memoized expansions, because keywords or other data they depend on changed
+  inline void invalidateExpansions() { expansions_valid_since = Age(); }
+  
 private:
-  unique_ptr<KeywordTrie> root; ///< Data structure for finding keywords
+  Age expansions_valid_since; ///< Memoized expansions from before this age are invalid
+  
+  String expandNoMemo(const String& text, const KeywordExpandOptions&) const;
+  unique_ptr<KeywordMatcher> matcher; ///< Data structure for finding keywords
   
   /// (try to) expand a single keyword
   /** If the keyword matches:
@@ -58,6 +58,13 @@ Context& Set::getContext(const CardP& card) {
   assert(wxThread::IsMain());
   return script_manager->getContext(card);
 }
+void Set::initContextsForThreads(size_t thread_count) {
+  assert(wxThread::IsMain());
+  script_manager->initWorkerContexts(thread_count);
+}
+Context& Set::getContextForThread(size_t thread, const CardP& card) {
+  return script_manager->getContextForThread(thread, card);
+}
 void Set::updateStyles(const CardP& card, bool only_content_dependent) {
   script_manager->updateStyles(card, only_content_dependent);
 }
@@ -255,6 +262,10 @@ ScriptValueP make_iterator(const Set& set) {
 void mark_dependency_member(const Set& set, const String& name, const Dependency& dep) {
   // is it the card list?
   if (name == _("cards")) {
+    if (dep.type == DEP_DUMMY && dep.data == &set) {
+      // testing whether a script depends on the card list
+      const_cast<Dependency&>(dep).index = true;
+    }
     set.game->dependent_scripts_cards.add(dep);
     return;
   }
@@ -274,11 +285,21 @@ void reflect_set_info_get_member(GetMember& handler, const IndexMap<FieldP, Valu
   REFLECT_NAMELESS(data);
 }
 
+KeywordDatabase& Set::keywordDatabase() {
+  if (keyword_db.empty()) {
+    keyword_db.prepare_parameters(game->keyword_parameter_types, keywords);
+    keyword_db.prepare_parameters(game->keyword_parameter_types, game->keywords);
+    keyword_db.add(keywords);
+    keyword_db.add(game->keywords);
+  }
+  return keyword_db;
+}
+
 int Set::positionOfCard(const CardP& card, const ScriptValueP& order_by, const ScriptValueP& filter) {
   // TODO : Lock the map?
   assert(order_by);
-  OrderCacheP& order = order_cache[make_pair(order_by,filter)];
-  if (!order) {
+  CachedOrder& cache = order_cache[make_pair(order_by,filter)];
+  if (!cache.order) {
     // 1. make a list of the order value for each card
     vector<String> values; values.reserve(cards.size());
     vector<int>    keep;   if(filter) keep.reserve(cards.size());
@@ -289,33 +310,76 @@ int Set::positionOfCard(const CardP& card, const ScriptValueP& order_by, const S
         keep.push_back(filter->eval(ctx)->toBool());
       }
     }
-    #if USE_SCRIPT_PROFILING
-      Timer t;
-      Profiler prof(t, order_by.get(), _("init order cache"));
-    #endif
+    PROFILER2(order_by.get(), _("init order cache"));
     // 3. initialize order cache
-    order = make_intrusive<OrderCache<CardP>>(cards, values, filter ? &keep : nullptr);
+    cache.order = make_intrusive<OrderCache<CardP>>(cards, values, filter ? &keep : nullptr);
+    cache.outdated.clear();
+  } else if (!cache.outdated.empty()) {
+    // move only the changed cards
+    vector<CardP> outdated;
+    swap(outdated, cache.outdated);
+    FOR_EACH_CONST(c, outdated) {
+      Context& ctx = getContext(c);
+      String value = order_by->eval(ctx)->toString();
+      bool   keep  = !filter || filter->eval(ctx)->toBool();
+      cache.order->update(c, value, keep);
+    }
   }
-  return order->find(card);
+  return cache.order->find(card);
 }
 int Set::numberOfCards(const ScriptValueP& filter) {
   if (!filter) return (int)cards.size();
-  map<ScriptValueP,int>::const_iterator it = filter_cache.find(filter);
-  if (it !=filter_cache.end()) {
-    return it->second;
-  } else {
-    int n = 0;
+  map<ScriptValueP,CachedFilter>::iterator it = filter_cache.find(filter);
+  if (it == filter_cache.end()) {
+    CachedFilter& cache = filter_cache[filter];
     FOR_EACH_CONST(c, cards) {
-      if (filter->eval(getContext(c))->toBool()) ++n;
+      bool match = filter->eval(getContext(c))->toBool();
+      cache.matches[c.get()] = match;
+      if (match) ++cache.count;
+    }
+    return cache.count;
+  }
+  // update the count for the changed cards
+  CachedFilter& cache = it->second;
+  vector<CardP> outdated;
+  swap(outdated, cache.outdated);
+  FOR_EACH_CONST(c, outdated) {
+    map<const Card*,bool>::iterator m = cache.matches.find(c.get());
+    if (m == cache.matches.end()) continue; // not in the set (anymore)
+    bool match = filter->eval(getContext(c))->toBool();
+    if (match != m->second) {
+      cache.count += match ? 1 : -1;
+      m->second = match;
     }
-    filter_cache.insert(make_pair(filter,n));
-    return n;
   }
+  return cache.count;
 }
 void Set::clearOrderCache() {
   order_cache.clear();
   filter_cache.clear();
 }
+void Set::invalidateOrderCache(const vector<CardP>& changed_cards) {
+  if (changed_cards.empty()) return;
+  // a card can change many times in a round of updates, only re-evaluate it once
+  vector<CardP> unique_cards;
+  std::set<const Card*> seen;
+  FOR_EACH_CONST(c, changed_cards) {
+    if (seen.insert(c.get()).second) unique_cards.push_back(c);
+  }
+  // caches that are not used for a while collect many outdated cards, at some point it is cheaper to rebuild them
+  for (auto it = order_cache.begin() ; it != order_cache.end() ; ) {
+    vector<CardP>& outdated = it->second.outdated;
+    outdated.insert(outdated.end(), unique_cards.begin(), unique_cards.end());
+    if (outdated.size() > cards.size()) it = order_cache.erase(it);
+    else ++it;
+  }
+  for (auto it = filter_cache.begin() ; it != filter_cache.end() ; ) {
+    vector<CardP>& outdated = it->second.outdated;
+    outdated.insert(outdated.end(), unique_cards.begin(), unique_cards.end());
+    if (outdated.size() > cards.size()) it = filter_cache.erase(it);
+    else ++it;
+  }
+}
 
 // ----------------------------------------------------------------------------- : SetView
 
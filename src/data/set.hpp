@@ -67,6 +67,15 @@ public:
   /// A context for performing scripts on a particular card
   /** Should only be used from the main thread! */
   Context& getContext(const CardP& card);
+  /// Prepare contexts for evaluating card scripts on thread_count threads at once
+  /** Should only be called from the main thread, before using getContextForThread.
+   *  Also initializes the lazily created state of the stylesheets in use (including their settings). */
+  void initContextsForThreads(size_t thread_count);
+  /// A context for performing scripts on a particular card, from a worker thread
+  /** thread 0 is the main thread. The scripts must not depend on the card list (see mark_dependency_member).
+   *  Each thread should only use its own context.
+   *  Builtin functions that touch shared state (such as check_spelling) must lock it. */
+  Context& getContextForThread(size_t thread, const CardP& card);
   /// Update styles and extra_card_fields for a card
   void updateStyles(const CardP& card, bool only_content_dependent);
   /// Update scripts that were delayed
@@ -107,12 +116,19 @@ public:
     throw InternalError(_("Expected a set field with name '")+name+_("'"));
   }
   
+  /// The keyword database, it is (re)built from the set and game keywords if it was cleared
+  /** Not thread safe when the database has to be rebuilt */
+  KeywordDatabase& keywordDatabase();
+  
   /// Find the position of a card in this set, when the card list is sorted using the given cirterium
   int positionOfCard(const CardP& card, const ScriptValueP& order_by, const ScriptValueP& filter);
   /// Find the number of cards that match the given filter
   int numberOfCards(const ScriptValueP& filter);
   /// Clear the order_cache used by positionOfCard
   void clearOrderCache();
+  /// The values of some cards have changed, update their positions in the order_cache
+  /** The cards are re-evaluated the next time a cache is used, the other cards keep their positions */
+  void invalidateOrderCache(const vector<CardP>& changed_cards);
   
   String typeName() const override;
   Version fileVersion() const override;
@@ -134,8 +150,18 @@ private:
   /// Object for executing scripts from the thumbnail thread
   unique_ptr<SetScriptContext> thumbnail_script_context;
   /// Cache of cards ordered by some criterion
-  map<pair<ScriptValueP,ScriptValueP>,OrderCacheP> order_cache;
-  map<ScriptValueP,int>                            filter_cache;
+  struct CachedOrder {
+    OrderCacheP   order;
+    vector<CardP> outdated; ///< Cards whose position needs to be recomputed
+  };
+  /// Cache of the number of cards matching a filter
+  struct CachedFilter {
+    int                    count = 0;
+    map<const Card*,bool>  matches;  ///< Does each card match the filter?
+    vector<CardP>          outdated; ///< Cards that need to be matched again
+  };
+  map<pair<ScriptValueP,ScriptValueP>,CachedOrder> order_cache;
+  map<ScriptValueP,CachedFilter>                   filter_cache;
 };
 
 inline String type_name(const Set&) {
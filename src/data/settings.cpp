@@ -22,6 +22,7 @@
 #include <wx/filename.h>
 #include <wx/wfstream.h>
 #include <wx/stdpaths.h>
+#include <mutex>
 
 // ----------------------------------------------------------------------------- : Extra types
 
@@ -171,6 +172,7 @@ Settings::Settings()
   , symbol_grid_size     (30)
   , symbol_grid          (true)
   , symbol_grid_snap     (false)
+  , worker_threads       (0)
   , print_layout         (LAYOUT_NO_SPACE)
   #if USE_OLD_STYLE_UPDATE_CHECKER
   , updates_url          (_("http://magicseteditor.sourceforge.net/updates"))
@@ -224,6 +226,12 @@ StyleSheetSettings& Settings::stylesheetSettingsFor(const StyleSheet& stylesheet
   ss->useDefault(default_stylesheet_settings); // update default settings
   return *ss;
 }
+bool Settings::cardSpellcheckEnabledFor(const StyleSheet& stylesheet) {
+  // stylesheetSettingsFor inserts into the map and updates the defaults, so worker threads take turns
+  static std::mutex mutex;
+  std::lock_guard<std::mutex> lock(mutex);
+  return stylesheetSettingsFor(stylesheet).card_spellcheck_enabled();
+}
 
 IndexMap<FieldP,ValueP>& Settings::exportOptionsFor(const ExportTemplate& export_template) {
   return export_options.get(export_template.name(), export_template.option_fields);
@@ -255,6 +263,7 @@ IMPLEMENT_REFLECTION_NO_SCRIPT(Settings) {
   REFLECT(symbol_grid_size);
   REFLECT(symbol_grid);
   REFLECT(symbol_grid_snap);
+  REFLECT(worker_threads);
   REFLECT(default_game);
   REFLECT(print_layout);
   REFLECT(apprentice_location);
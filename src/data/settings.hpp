@@ -159,6 +159,9 @@ public:
   bool symbol_grid;
   bool symbol_grid_snap;
   
+  // --------------------------------------------------- : Performance
+  UInt worker_threads; ///< Number of threads to use for updating and exporting cards, 0 to use all cores
+  
   // --------------------------------------------------- : Default pacakge selections
   String default_game;
   
@@ -169,7 +172,11 @@ public:
   /// Get the settings for a column for a specific field in a game
   ColumnSettings&     columnSettingsFor    (const Game& game, const Field& field);
   /// Get the settings object for a specific stylesheet
+  /** Should only be called from the main thread */
   StyleSheetSettings& stylesheetSettingsFor(const StyleSheet& stylesheet);
+  /// Is spelling checking enabled for cards with the given stylesheet?
+  /** Unlike stylesheetSettingsFor this can be called from worker threads, when the main thread is waiting for them */
+  bool cardSpellcheckEnabledFor(const StyleSheet& stylesheet);
   
 private:
   map<String,GameSettingsP>       game_settings;
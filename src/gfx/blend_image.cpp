@@ -15,6 +15,7 @@
 // sqr(x) = x^2
 template <typename T> inline T sqr(T x) { return x * x; }
 
+PIXEL_LOOP_TARGETS
 void linear_blend(Image& img1, const Image& img2, double x1,double y1, double x2,double y2) {
   int width = img1.GetWidth(), height = img1.GetHeight();
   if (img2.GetWidth() != width || img2.GetHeight() != height) {
@@ -42,24 +43,30 @@ void linear_blend(Image& img1, const Image& img2, double x1,double y1, double x2
   int ym = to_int( (y2 - y1) * height * a );
   int d  = to_int( - (x1 * width * xm + y1 * height * ym) );
   
-  Byte *data1 = img1.GetData(), *data2 = img2.GetData();
-  // blend pixels
+  Byte* data1 = img1.GetData();
+  const Byte* data2 = img2.GetData();
+  // blend pixels, a line at a time
+  // the multipliers are computed first for each subpixel, so the blending loop is simple enough to be vectorized
+  vector<int> mults(3 * width);
   for (int y = 0 ; y < height ; ++y) {
     for (int x = 0 ; x < width ; ++x) {
       int mult = x * xm + y * ym + d;
       if (mult < 0)      mult = 0;
       if (mult > fixed)  mult = fixed;
-      data1[0] = data1[0] + mult * (data2[0] - data1[0]) / fixed;
-      data1[1] = data1[1] + mult * (data2[1] - data1[1]) / fixed;
-      data1[2] = data1[2] + mult * (data2[2] - data1[2]) / fixed;
-      data1 += 3;
-      data2 += 3;
+      mults[3*x] = mults[3*x+1] = mults[3*x+2] = mult;
     }
+    const int* m = mults.data();
+    for (int i = 0 ; i < 3 * width ; ++i) {
+      data1[i] = data1[i] + m[i] * (data2[i] - data1[i]) / fixed;
+    }
+    data1 += 3 * width;
+    data2 += 3 * width;
   }
 }
 
 // ----------------------------------------------------------------------------- : Mask Blend
 
+PIXEL_LOOP_TARGETS
 void mask_blend(Image& img1, const Image& img2, const Image& mask) {
   if (img2.GetWidth() != img1.GetWidth() || img2.GetHeight() != img1.GetHeight()
    || mask.GetWidth() != img1.GetWidth() || mask.GetHeight() != img1.GetHeight()) {
@@ -67,7 +74,8 @@ void mask_blend(Image& img1, const Image& img2, const Image& mask) {
   }
   
   UInt size = img1.GetWidth() * img1.GetHeight() * 3;
-  Byte *data1 = img1.GetData(), *data2 = img2.GetData(), *dataM = mask.GetData();
+  Byte* data1 = img1.GetData();
+  const Byte *data2 = img2.GetData(), *dataM = mask.GetData();
   // for each subpixel...
   for (UInt i = 0 ; i < size ; ++i) {
     data1[i] = (data1[i] * dataM[i] + data2[i] * (255 - dataM[i])) / 255;
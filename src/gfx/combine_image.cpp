@@ -89,16 +89,46 @@ COMBINE_FUN(COMBINE_SYMMETRIC_OVERLAY, (Combine<COMBINE_OVERLAY>::f(a,b) + Combi
 
 /// Combine image b onto image a using some combining mode.
 /// The results are stored in the image A.
+/** Inlined into combine_image, so the loop is vectorized for each of its PIXEL_LOOP_TARGETS */
 template <ImageCombine combine>
-void combine_image_do(Image& a, Image b) {
+inline void combine_image_do(Image& a, const Image& b) {
   UInt size = a.GetWidth() * a.GetHeight() * 3;
-  Byte *dataA = a.GetData(), *dataB = b.GetData();
+  Byte* dataA = a.GetData();
+  const Byte* dataB = b.GetData();
   // for each pixel: apply function
   for (UInt i = 0 ; i < size ; ++i) {
     dataA[i] = Combine<combine>::f(dataA[i], dataB[i]);
   }
 }
 
+/// Table with the result of a combining function for all inputs
+/** Used for the modes that divide by one of the inputs,
+ *  a table lookup is much faster than an integer division, and it gives the same result.
+ */
+template <ImageCombine combine>
+struct CombineTable {
+  Byte table[256][256];
+  CombineTable() {
+    for (int a = 0 ; a < 256 ; ++a) {
+      for (int b = 0 ; b < 256 ; ++b) {
+        table[a][b] = (Byte)Combine<combine>::f(a, b);
+      }
+    }
+  }
+};
+
+template <ImageCombine combine>
+void combine_image_table(Image& a, const Image& b) {
+  static const CombineTable<combine> t; // initialized on first use, thread safe
+  UInt size = a.GetWidth() * a.GetHeight() * 3;
+  Byte* dataA = a.GetData();
+  const Byte* dataB = b.GetData();
+  for (UInt i = 0 ; i < size ; ++i) {
+    dataA[i] = t.table[dataA[i]][dataB[i]];
+  }
+}
+
+PIXEL_LOOP_TARGETS
 void combine_image(Image& a, const Image& b, ImageCombine combine) {
   // Images must have same size
   assert(a.GetWidth()  == b.GetWidth());
@@ -111,6 +141,7 @@ void combine_image(Image& a, const Image& b, ImageCombine combine) {
   // Combine image data, by dispatching to combineImageDo
   switch(combine) {
     #define DISPATCH(comb) case comb: combine_image_do<comb>(a,b); return
+    #define DISPATCH_TABLE(comb) case comb: combine_image_table<comb>(a,b); return
     case COMBINE_DEFAULT:
     case COMBINE_NORMAL: a = b; return; // no need to do a per pixel operation
     DISPATCH(COMBINE_ADD);
@@ -121,16 +152,16 @@ void combine_image(Image& a, const Image& b, ImageCombine combine) {
     DISPATCH(COMBINE_MULTIPLY);
     DISPATCH(COMBINE_DARKEN);
     DISPATCH(COMBINE_LIGHTEN);
-    DISPATCH(COMBINE_COLOR_DODGE);
-    DISPATCH(COMBINE_COLOR_BURN);
+    DISPATCH_TABLE(COMBINE_COLOR_DODGE);
+    DISPATCH_TABLE(COMBINE_COLOR_BURN);
     DISPATCH(COMBINE_SCREEN);
     DISPATCH(COMBINE_OVERLAY);
     DISPATCH(COMBINE_HARD_LIGHT);
     DISPATCH(COMBINE_SOFT_LIGHT);
-    DISPATCH(COMBINE_REFLECT);
-    DISPATCH(COMBINE_GLOW);
-    DISPATCH(COMBINE_FREEZE);
-    DISPATCH(COMBINE_HEAT);
+    DISPATCH_TABLE(COMBINE_REFLECT);
+    DISPATCH_TABLE(COMBINE_GLOW);
+    DISPATCH_TABLE(COMBINE_FREEZE);
+    DISPATCH_TABLE(COMBINE_HEAT);
     DISPATCH(COMBINE_AND);
     DISPATCH(COMBINE_OR);
     DISPATCH(COMBINE_XOR);
@@ -10,10 +10,40 @@
 #include <gfx/generated_image.hpp>
 #include <util/io/package.hpp>
 #include <util/error.hpp>
+#include <util/file_utils.hpp>
 #include <data/symbol.hpp>
 #include <data/field/symbol.hpp>
 #include <render/symbol/filter.hpp>
 #include <gui/util.hpp> // load_resource_image
+#include <script/profiler.hpp>
+#include <typeinfo>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+// ----------------------------------------------------------------------------- : Hashing
+
+void hash_combine_raw(size_t& h, size_t v) {
+  h ^= v + 0x9e3779b9 + (h << 6) + (h >> 2);
+}
+template <typename T> void hash_combine(size_t& h, const T& x) {
+  hash_combine_raw(h, std::hash<T>()(x));
+}
+void hash_combine(size_t& h, const GeneratedImage& img) {
+  hash_combine_raw(h, img.hash());
+}
+void hash_combine(size_t& h, const String& s) {
+  for (wxUniChar c : s) hash_combine_raw(h, c.GetValue());
+}
+void hash_combine(size_t& h, const LocalFileName& fn) {
+  hash_combine(h, fn.toStringForKey());
+}
+void hash_combine(size_t& h, Age age) {
+  hash_combine_raw(h, (size_t)age.get());
+}
+void hash_combine(size_t& h, Color c) {
+  hash_combine_raw(h, c.packed);
+}
 
 // ----------------------------------------------------------------------------- : GeneratedImage
 
@@ -27,6 +57,319 @@ Image GeneratedImage::generateConform(const Options& options) const {
   return conform_image(generate(options),options);
 }
 
+size_t GeneratedImage::hash() const {
+  return typeid(*this).hash_code();
+}
+
+// ----------------------------------------------------------------------------- : GeneratedImage : cache
+
+/// Cache of generated images, shared by all threads
+/** Entries are found by the hash of the image and the options, and then compared with operator ==.
+ *  The cache uses at most GENERATED_IMAGE_CACHE_SIZE bytes of image data,
+ *  the least recently used images are thrown out first.
+ *
+ *  Packages are identified by their address. The packages of games and stylesheets stay alive
+ *  until the package manager is reset, which clears the cache.
+ *  Images from the local package (the set) include the Age of the value they come from,
+ *  so they can not be confused with images of another set that happens to get the same address.
+ */
+class GeneratedImageCache {
+public:
+  /// Find an image in the cache, and set options.width/height like generateConform does
+  bool get(const GeneratedImage& image, const GeneratedImage::Options& options, size_t hash, Image& out);
+  /// Add a generated image
+  void add(const GeneratedImage& image, const GeneratedImage::Options& options, size_t hash, int width, int height, const Image& result);
+  void clear();
+private:
+  struct Entry {
+    GeneratedImageP image;
+    GeneratedImage::Options options; ///< Options as passed to generateConform
+    int    width, height;            ///< options.width and .height after generateConform
+    Image  result;
+    size_t hash;
+    size_t bytes;
+  };
+  typedef list<Entry> Entries;
+  Entries entries; ///< Cached images, most recently used first
+  unordered_multimap<size_t, Entries::iterator> by_hash;
+  size_t total_bytes = 0;
+  std::mutex mutex;
+  
+  Entries::iterator find(const GeneratedImage& image, const GeneratedImage::Options& options, size_t hash);
+};
+
+const size_t GENERATED_IMAGE_CACHE_SIZE = 64 * 1024 * 1024;
+
+ProfileCounter generated_image_cache_hits  (_("generated image cache hits"));
+ProfileCounter generated_image_cache_misses(_("generated image cache misses"));
+
+bool same_options(const GeneratedImage::Options& a, const GeneratedImage::Options& b) {
+  return a.width == b.width && a.height == b.height && a.zoom == b.zoom && a.angle == b.angle
+      && a.preserve_aspect == b.preserve_aspect && a.saturate == b.saturate
+      && a.full_resolution == b.full_resolution
+      && a.package == b.package && a.local_package == b.local_package;
+}
+
+size_t options_hash(const GeneratedImage::Options& options) {
+  size_t h = 0;
+  hash_combine(h, options.width);
+  hash_combine(h, options.height);
+  hash_combine(h, options.zoom);
+  hash_combine(h, options.angle);
+  hash_combine(h, (int)options.preserve_aspect);
+  hash_combine(h, options.saturate);
+  hash_combine(h, options.full_resolution);
+  hash_combine(h, options.package);
+  hash_combine(h, options.local_package);
+  return h;
+}
+
+GeneratedImageCache::Entries::iterator GeneratedImageCache::find(const GeneratedImage& image, const GeneratedImage::Options& options, size_t hash) {
+  auto range = by_hash.equal_range(hash);
+  for (auto it = range.first ; it != range.second ; ++it) {
+    Entry& e = *it->second;
+    if (same_options(e.options, options) && *e.image == image) return it->second;
+  }
+  return entries.end();
+}
+
+bool GeneratedImageCache::get(const GeneratedImage& image, const GeneratedImage::Options& options, size_t hash, Image& out) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = find(image, options, hash);
+  if (it == entries.end()) return false;
+  entries.splice(entries.begin(), entries, it); // now the most recently used
+  options.width  = it->width;
+  options.height = it->height;
+  out = it->result.Copy(); // wxImage data is shared, and callers write to it
+  return true;
+}
+
+void GeneratedImageCache::add(const GeneratedImage& image, const GeneratedImage::Options& options, size_t hash, int width, int height, const Image& result) {
+  size_t bytes = (size_t)result.GetWidth() * result.GetHeight() * (result.HasAlpha() ? 4 : 3);
+  if (bytes > GENERATED_IMAGE_CACHE_SIZE / 8) return; // too large, would throw out too much
+  std::lock_guard<std::mutex> lock(mutex);
+  if (find(image, options, hash) != entries.end()) return; // another thread generated the same image in the meantime
+  entries.push_front(Entry{image.toImage(), options, width, height, result, hash, bytes});
+  by_hash.insert(make_pair(hash, entries.begin()));
+  total_bytes += bytes;
+  while (total_bytes > GENERATED_IMAGE_CACHE_SIZE) {
+    Entries::iterator last = prev(entries.end());
+    auto range = by_hash.equal_range(last->hash);
+    for (auto it = range.first ; it != range.second ; ++it) {
+      if (it->second == last) {
+        by_hash.erase(it);
+        break;
+      }
+    }
+    total_bytes -= last->bytes;
+    entries.erase(last);
+  }
+}
+
+void GeneratedImageCache::clear() {
+  std::lock_guard<std::mutex> lock(mutex);
+  by_hash.clear();
+  entries.clear();
+  total_bytes = 0;
+}
+
+GeneratedImageCache& generated_image_cache() {
+  static GeneratedImageCache cache;
+  return cache;
+}
+
+// ----------------------------------------------------------------------------- : Decoded image cache
+
+/// Cache of images loaded from files, shared by all threads
+/** For each file the decoded image is kept, together with the smaller versions made so far.
+ *  Version i+1 is version i at half the size.
+ *  The cache uses at most DECODED_IMAGE_CACHE_SIZE bytes of image data,
+ *  the least recently used files are thrown out first.
+ */
+class DecodedImageCache {
+public:
+  /// Find the smallest cached version of an image that is large enough, returns its level
+  bool get(const String& key, wxLongLong mtime, int width, int height, Image& out, size_t& level);
+  /// Add a version of an image
+  void add(const String& key, wxLongLong mtime, size_t level, const Image& image);
+  void clear();
+private:
+  struct Entry {
+    String        key;
+    wxLongLong    mtime;
+    vector<Image> levels;
+    size_t        bytes;
+  };
+  typedef list<Entry> Entries;
+  Entries entries; ///< Cached images, most recently used first
+  map<String, Entries::iterator> by_key;
+  size_t total_bytes = 0;
+  std::mutex mutex;
+};
+
+const size_t DECODED_IMAGE_CACHE_SIZE = 64 * 1024 * 1024;
+
+ProfileCounter decoded_image_cache_hits  (_("decoded image cache hits"));
+ProfileCounter decoded_image_cache_misses(_("decoded image cache misses"));
+
+size_t image_bytes(const Image& img) {
+  return (size_t)img.GetWidth() * img.GetHeight() * (img.HasAlpha() ? 4 : 3);
+}
+
+/// Is the image large enough for the given size? 0 means any size
+bool large_enough(const Image& img, int width, int height) {
+  return img.GetWidth() >= width && img.GetHeight() >= height;
+}
+
+/// Can the image be halved, and still be large enough for the given size?
+/** Only images with an even size are halved, so the aspect ratio stays exactly the same. */
+bool can_halve(const Image& img, int width, int height) {
+  if (width <= 0 && height <= 0) return false;
+  int w = img.GetWidth(), h = img.GetHeight();
+  return w % 2 == 0 && h % 2 == 0 && large_enough(img, 2 * max(1,width), 2 * max(1,height));
+}
+
+/// Make an image of half the size, by averaging blocks of 2x2 pixels
+Image halve_image(const Image& img) {
+  int w = img.GetWidth() / 2, h = img.GetHeight() / 2, w_in = img.GetWidth();
+  Image out(w, h, false);
+  const Byte* in = img.GetData();
+  Byte* data = out.GetData();
+  if (img.HasAlpha()) {
+    out.InitAlpha();
+    const Byte* in_a = img.GetAlpha();
+    Byte* alpha = out.GetAlpha();
+    for (int y = 0 ; y < h ; ++y) {
+      for (int x = 0 ; x < w ; ++x) {
+        int p[4] = { 2*x + 2*y*w_in, 2*x + 1 + 2*y*w_in, 2*x + (2*y+1)*w_in, 2*x + 1 + (2*y+1)*w_in };
+        int a = in_a[p[0]] + in_a[p[1]] + in_a[p[2]] + in_a[p[3]];
+        for (int c = 0 ; c < 3 ; ++c) {
+          if (a > 0) { // weigh colors by alpha, so transparent pixels don't bleed
+            int sum = in[3*p[0]+c] * in_a[p[0]] + in[3*p[1]+c] * in_a[p[1]] + in[3*p[2]+c] * in_a[p[2]] + in[3*p[3]+c] * in_a[p[3]];
+            data[3*(x + y*w) + c] = (Byte)((sum + a/2) / a);
+          } else {
+            data[3*(x + y*w) + c] = (Byte)((in[3*p[0]+c] + in[3*p[1]+c] + in[3*p[2]+c] + in[3*p[3]+c] + 2) / 4);
+          }
+        }
+        alpha[x + y*w] = (Byte)((a + 2) / 4);
+      }
+    }
+  } else {
+    for (int y = 0 ; y < h ; ++y) {
+      for (int x = 0 ; x < w ; ++x) {
+        for (int c = 0 ; c < 3 ; ++c) {
+          int sum = in[3*(2*x + 2*y*w_in)     + c] + in[3*(2*x + 1 + 2*y*w_in)     + c]
+                  + in[3*(2*x + (2*y+1)*w_in) + c] + in[3*(2*x + 1 + (2*y+1)*w_in) + c];
+          data[3*(x + y*w) + c] = (Byte)((sum + 2) / 4);
+        }
+      }
+    }
+  }
+  return out;
+}
+
+bool DecodedImageCache::get(const String& key, wxLongLong mtime, int width, int height, Image& out, size_t& level) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = by_key.find(key);
+  if (it == by_key.end() || it->second->mtime != mtime) return false;
+  entries.splice(entries.begin(), entries, it->second); // now the most recently used
+  const vector<Image>& levels = it->second->levels;
+  level = 0;
+  while (level + 1 < levels.size() && large_enough(levels[level + 1], width, height)) ++level;
+  out = levels[level].Copy(); // wxImage reference counts are not atomic, so no shared data may leave the lock
+  return true;
+}
+
+void DecodedImageCache::add(const String& key, wxLongLong mtime, size_t level, const Image& image) {
+  size_t bytes = image_bytes(image);
+  if (bytes > DECODED_IMAGE_CACHE_SIZE / 4) return; // too large, would throw out too much
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = by_key.find(key);
+  if (it != by_key.end() && it->second->mtime != mtime) {
+    // file has changed, the old versions are useless
+    total_bytes -= it->second->bytes;
+    entries.erase(it->second);
+    by_key.erase(it);
+    it = by_key.end();
+  }
+  if (it == by_key.end()) {
+    if (level != 0) return; // the full image was thrown out in the meantime
+    // store copies, the caller keeps using image, and wxImage reference counts are not atomic
+    entries.push_front(Entry{key, mtime, vector<Image>(1, image.Copy()), bytes});
+    by_key.insert(make_pair(key, entries.begin()));
+  } else {
+    Entry& e = *it->second;
+    if (e.levels.size() != level) return; // another thread was first
+    e.levels.push_back(image.Copy());
+    e.bytes += bytes;
+  }
+  total_bytes += bytes;
+  while (total_bytes > DECODED_IMAGE_CACHE_SIZE && entries.size() > 1) {
+    Entry& last = entries.back();
+    total_bytes -= last.bytes;
+    by_key.erase(last.key);
+    entries.pop_back();
+  }
+}
+
+void DecodedImageCache::clear() {
+  std::lock_guard<std::mutex> lock(mutex);
+  by_key.clear();
+  entries.clear();
+  total_bytes = 0;
+}
+
+DecodedImageCache& decoded_image_cache() {
+  static DecodedImageCache cache;
+  return cache;
+}
+
+Image load_image_cached(const String& key, wxLongLong mtime, const GeneratedImage::Options& options, const function<Image()>& load) {
+  int width = 0, height = 0;
+  if (!options.full_resolution) {
+    width = options.width; height = options.height;
+  }
+  Image img;
+  size_t level;
+  if (decoded_image_cache().get(key, mtime, width, height, img, level)) {
+    ++decoded_image_cache_hits;
+  } else {
+    // load without holding the lock, errors are not cached
+    ++decoded_image_cache_misses;
+    img = load();
+    level = 0;
+    decoded_image_cache().add(key, mtime, level, img);
+  }
+  // make smaller versions, if it is worth it
+  while (can_halve(img, width, height)) {
+    img = halve_image(img);
+    decoded_image_cache().add(key, mtime, ++level, img);
+  }
+  return img; // not shared with the cache, get and add make copies
+}
+
+Image GeneratedImage::generateConformCached(const Options& options) const {
+  if (isBlank()) return generateConform(options); // cheaper to make than to copy
+  size_t h = hash();
+  hash_combine_raw(h, options_hash(options));
+  Image image;
+  if (generated_image_cache().get(*this, options, h, image)) {
+    ++generated_image_cache_hits;
+    return image;
+  }
+  // generate without holding the lock, errors are not cached
+  ++generated_image_cache_misses;
+  Options in_options = options;
+  image = generateConform(options);
+  generated_image_cache().add(*this, in_options, h, options.width, options.height, image.Copy());
+  return image;
+}
+
+void GeneratedImage::clearCache() {
+  generated_image_cache().clear();
+  decoded_image_cache().clear();
+}
+
 Image conform_image(const Image& img, const GeneratedImage::Options& options) {
   Image image = img;
   // resize?
@@ -111,6 +454,16 @@ bool LinearBlendImage::operator == (const GeneratedImage& that) const {
                && x1 == that2->x1 && y1 == that2->y1
                && x2 == that2->x2 && y2 == that2->y2;
 }
+size_t LinearBlendImage::hash() const {
+  size_t h = GeneratedImage::hash();
+  hash_combine(h, *image1);
+  hash_combine(h, *image2);
+  hash_combine(h, x1);
+  hash_combine(h, y1);
+  hash_combine(h, x2);
+  hash_combine(h, y2);
+  return h;
+}
 
 // ----------------------------------------------------------------------------- : MaskedBlendImage
 
@@ -128,6 +481,13 @@ bool MaskedBlendImage::operator == (const GeneratedImage& that) const {
                && *dark  == *that2->dark
                && *mask  == *that2->mask;
 }
+size_t MaskedBlendImage::hash() const {
+  size_t h = GeneratedImage::hash();
+  hash_combine(h, *light);
+  hash_combine(h, *dark);
+  hash_combine(h, *mask);
+  return h;
+}
 
 // ----------------------------------------------------------------------------- : CombineBlendImage
 
@@ -145,6 +505,13 @@ bool CombineBlendImage::operator == (const GeneratedImage& that) const {
                && *image2 == *that2->image2
                && image_combine == that2->image_combine;
 }
+size_t CombineBlendImage::hash() const {
+  size_t h = GeneratedImage::hash();
+  hash_combine(h, *image1);
+  hash_combine(h, *image2);
+  hash_combine(h, image_combine);
+  return h;
+}
 
 // ----------------------------------------------------------------------------- : SetMaskImage
 
@@ -158,6 +525,12 @@ bool SetMaskImage::operator == (const GeneratedImage& that) const {
   return that2 && *image == *that2->image
                && *mask  == *that2->mask;
 }
+size_t SetMaskImage::hash() const {
+  size_t h = GeneratedImage::hash();
+  hash_combine(h, *image);
+  hash_combine(h, *mask);
+  return h;
+}
 
 Image SetAlphaImage::generate(const Options& opt) const {
   Image img = image->generate(opt);
@@ -169,6 +542,12 @@ bool SetAlphaImage::operator == (const GeneratedImage& that) const {
   return that2 && *image == *that2->image
                && alpha  == that2->alpha;
 }
+size_t SetAlphaImage::hash() const {
+  size_t h = GeneratedImage::hash();
+  hash_combine(h, *image);
+  hash_combine(h, alpha);
+  return h;
+}
 
 // ----------------------------------------------------------------------------- : SetCombineImage
 
@@ -183,6 +562,12 @@ bool SetCombineImage::operator == (const GeneratedImage& that) const {
   return that2 && *image == *that2->image
                && image_combine == that2->image_combine;
 }
+size_t SetCombineImage::hash() const {
+  size_t h = GeneratedImage::hash();
+  hash_combine(h, *image);
+  hash_combine(h, image_combine);
+  return h;
+}
 
 // ----------------------------------------------------------------------------- : SaturateImage
 
@@ -196,6 +581,12 @@ bool SaturateImage::operator == (const GeneratedImage& that) const {
   return that2 && *image == *that2->image
                && amount == that2->amount;
 }
+size_t SaturateImage::hash() const {
+  size_t h = GeneratedImage::hash();
+  hash_combine(h, *image);
+  hash_combine(h, amount);
+  return h;
+}
 
 // ----------------------------------------------------------------------------- : InvertImage
 
@@ -221,6 +612,12 @@ bool RecolorImage::operator == (const GeneratedImage& that) const {
   return that2 && *image == *that2->image
                && color == that2->color;
 }
+size_t RecolorImage::hash() const {
+  size_t h = GeneratedImage::hash();
+  hash_combine(h, *image);
+  hash_combine(h, color);
+  return h;
+}
 
 Image RecolorImage2::generate(const Options& opt) const {
   Image img = image->generate(opt);
@@ -235,6 +632,15 @@ bool RecolorImage2::operator == (const GeneratedImage& that) const {
                && blue == that2->blue
                && white == that2->white;
 }
+size_t RecolorImage2::hash() const {
+  size_t h = GeneratedImage::hash();
+  hash_combine(h, *image);
+  hash_combine(h, red);
+  hash_combine(h, green);
+  hash_combine(h, blue);
+  hash_combine(h, white);
+  return h;
+}
 
 // ----------------------------------------------------------------------------- : FlipImage
 
@@ -265,6 +671,12 @@ bool RotateImage::operator == (const GeneratedImage& that) const {
   return that2 && *image == *that2->image
                && angle == that2->angle;
 }
+size_t RotateImage::hash() const {
+  size_t h = GeneratedImage::hash();
+  hash_combine(h, *image);
+  hash_combine(h, angle);
+  return h;
+}
 
 // ----------------------------------------------------------------------------- : EnlargeImage
 
@@ -276,6 +688,7 @@ Image EnlargeImage::generate(const Options& opt) const {
     , opt.package
     , opt.local_package
     , opt.preserve_aspect);
+  sub_opt.full_resolution = opt.full_resolution;
   Image img = image->generate(sub_opt);
   // size of generated image
   int w  = img.GetWidth(),  h = img.GetHeight();  // original image size
@@ -303,11 +716,20 @@ bool EnlargeImage::operator == (const GeneratedImage& that) const {
   return that2 && *image      == *that2->image
                && border_size == that2->border_size;
 }
+size_t EnlargeImage::hash() const {
+  size_t h = GeneratedImage::hash();
+  hash_combine(h, *image);
+  hash_combine(h, border_size);
+  return h;
+}
 
 // ----------------------------------------------------------------------------- : CropImage
 
 Image CropImage::generate(const Options& opt) const {
-  return image->generate(opt).Size(wxSize((int)width, (int)height), wxPoint(-(int)offset_x, -(int)offset_y));
+  // the crop rectangle is in pixels of the original image
+  Options sub_opt(opt);
+  sub_opt.full_resolution = true;
+  return image->generate(sub_opt).Size(wxSize((int)width, (int)height), wxPoint(-(int)offset_x, -(int)offset_y));
 }
 bool CropImage::operator == (const GeneratedImage& that) const {
   const CropImage* that2 = dynamic_cast<const CropImage*>(&that);
@@ -315,58 +737,18 @@ bool CropImage::operator == (const GeneratedImage& that) const {
                && width    == that2->width    && height   == that2->height
                && offset_x == that2->offset_x && offset_y == that2->offset_y;
 }
+size_t CropImage::hash() const {
+  size_t h = GeneratedImage::hash();
+  hash_combine(h, *image);
+  hash_combine(h, width);
+  hash_combine(h, height);
+  hash_combine(h, offset_x);
+  hash_combine(h, offset_y);
+  return h;
+}
 
 // ----------------------------------------------------------------------------- : DropShadowImage
 
-/// Preform a gaussian blur, from the image in of w*h bytes to out
-/** out is scaled some scaling, this is the return value */
-UInt gaussian_blur(Byte* in, UInt* out, int w, int h, double radius) {
-  // blur horizontally
-  auto blur_x = make_unique<UInt[]>(w*h); // scaled by total_x, so in [0..255*total_x]
-  memset(blur_x.get(), 0, w*h*sizeof(UInt));
-  UInt total_x = 0;
-  {
-    double sigma = radius * w;
-    double mult = (1 << 8) / (sqrt(2 * M_PI) * sigma);
-    double sigsqr2 = 1 / (2 * sigma * sigma);
-    int range = min(w, (int)(3*sigma));
-    for (int d = -range ; d <= range ; ++d) {
-      UInt factor = (int)( mult * exp(-d * d * sigsqr2) );
-      total_x += factor;
-      if (factor > 0) {
-        int x_start = max(0, -d), x_end = min(w, w-d);
-        for (int y = 0 ; y < h ; ++y) {
-          for (int x = x_start ; x < x_end ; ++x) {
-            blur_x[x + y*w] += in[x + d + y*w] * factor;
-          }
-        }
-      }
-    }
-  }
-  // blur vertically
-  memset(out, 0, w*h*sizeof(UInt));
-  UInt total_y = 0;
-  {
-    double sigma = radius * h;
-    double mult = (1 << 8) / (sqrt(2 * M_PI) * sigma);
-    double sigsqr2 = 1 / (2 * sigma * sigma);
-    int range = min(h, (int)(3*sigma));
-    for (int d = -range ; d <= range ; ++d) {
-      UInt factor = (UInt)( mult * exp(-d * d * sigsqr2) );
-      total_y += factor;
-      if (factor > 0) {
-        int y_start = max(0, -d), y_end = min(h, h-d);
-        for (int y = y_start ; y < y_end ; ++y) {
-          for (int x = 0 ; x < w ; ++x) {
-            out[x + y*w] += blur_x[x + (d + y)*w] * factor;
-          }
-        }
-      }
-    }
-  }
-  return total_x * total_y;
-}
-
 Image DropShadowImage::generate(const Options& opt) const {
   // sub image
   Image img = image->generate(opt);
@@ -377,8 +759,8 @@ Image DropShadowImage::generate(const Options& opt) const {
   int w = img.GetWidth(), h = img.GetHeight();
   Byte* alpha = img.GetAlpha();
   // blur
-  auto shadow = make_unique<UInt[]>(w*h);
-  UInt total = 255 * gaussian_blur(alpha, shadow.get(), w, h, shadow_blur_radius);
+  vector<Byte> shadow(alpha, alpha + w*h);
+  gaussian_blur(shadow.data(), w, h, shadow_blur_radius * w, shadow_blur_radius * h);
   // combine
   Byte* data = img.GetData();
   int dw = int(w * offset_x), dh = int(h * offset_y);
@@ -390,7 +772,7 @@ Image DropShadowImage::generate(const Options& opt) const {
     for (int x = x_start ; x < x_end ; ++x) {
       int p  = x + y * w; // pixel we are working on
       int a = alpha[p];
-      int shad = ((((255 - a)*sa)>>16) * shadow[p - delta]) / total; // amount of shadow to add
+      int shad = ((((255 - a)*sa)>>16) * shadow[p - delta]) / 255; // amount of shadow to add
       int factor = max(1, a + shad); // divide by this
       data[3 * p    ] = (a * data[3 * p    ] + shad * shadow_color.Red()  ) / factor;
       data[3 * p + 1] = (a * data[3 * p + 1] + shad * shadow_color.Green()) / factor;
@@ -407,41 +789,70 @@ bool DropShadowImage::operator == (const GeneratedImage& that) const {
                && shadow_alpha == that2->shadow_alpha && shadow_blur_radius == that2->shadow_blur_radius
                && shadow_color == that2->shadow_color;
 }
+size_t DropShadowImage::hash() const {
+  size_t h = GeneratedImage::hash();
+  hash_combine(h, *image);
+  hash_combine(h, offset_x);
+  hash_combine(h, offset_y);
+  hash_combine(h, shadow_alpha);
+  hash_combine(h, shadow_blur_radius);
+  hash_combine(h, shadow_color);
+  return h;
+}
 
 // ----------------------------------------------------------------------------- : PackagedImage
 
 Image PackagedImage::generate(const Options& opt) const {
-  // TODO : use opt.width and opt.height?
   // open file from package
   if (!opt.package) throw ScriptError(_("Can only load images in a context where an image is expected"));
-  auto file_stream = opt.package->openIn(filename);
-  Image img;
-  if (image_load_file(img, *file_stream)) {
-    if (img.HasMask()) img.InitAlpha(); // we can't handle masks
-    return img;
-  } else {
-    throw ScriptError(_("Unable to load image '") + filename + _("' from '" + opt.package->name() + _("'")));
-  }
+  Package* package = opt.package;
+  // the modification time tells us if the file was changed since it was cached
+  wxLongLong mtime = 0;
+  const Package::FileInfos& files = package->getFileInfos();
+  auto it = files.find(normalize_internal_filename(filename));
+  if (it != files.end()) mtime = package->modificationTime(*it).GetValue();
+  String key = String::Format(_("%p:"), package) + filename;
+  return load_image_cached(key, mtime, opt, [&]() {
+    auto file_stream = package->openIn(filename);
+    Image img;
+    if (image_load_file(img, *file_stream)) {
+      if (img.HasMask()) img.InitAlpha(); // we can't handle masks
+      return img;
+    } else {
+      throw ScriptError(_("Unable to load image '") + filename + _("' from '" + package->name() + _("'")));
+    }
+  });
 }
 bool PackagedImage::operator == (const GeneratedImage& that) const {
   const PackagedImage* that2 = dynamic_cast<const PackagedImage*>(&that);
   return that2 && filename == that2->filename;
 }
+size_t PackagedImage::hash() const {
+  size_t h = GeneratedImage::hash();
+  hash_combine(h, filename);
+  return h;
+}
 
 // ----------------------------------------------------------------------------- : BuiltInImage
 
 Image BuiltInImage::generate(const Options& opt) const {
-  // TODO : use opt.width and opt.height?
-  try {
-    Image img = load_resource_image(name);
-    if (img.Ok()) return img;
-  } catch (...) {}
-  throw ScriptError(_("There is no built in image '") + name + _("'"));
+  return load_image_cached(_(":builtin:") + name, 0, opt, [&]() {
+    try {
+      Image img = load_resource_image(name);
+      if (img.Ok()) return img;
+    } catch (...) {}
+    throw ScriptError(_("There is no built in image '") + name + _("'"));
+  });
 }
 bool BuiltInImage::operator == (const GeneratedImage& that) const {
   const BuiltInImage* that2 = dynamic_cast<const BuiltInImage*>(&that);
   return that2 && name == that2->name;
 }
+size_t BuiltInImage::hash() const {
+  size_t h = GeneratedImage::hash();
+  hash_combine(h, name);
+  return h;
+}
 
 // ----------------------------------------------------------------------------- : SymbolToImage
 
@@ -478,6 +889,13 @@ bool SymbolToImage::operator == (const GeneratedImage& that) const {
                    *variation == *that2->variation // custom variation
                   );
 }
+size_t SymbolToImage::hash() const {
+  size_t h = GeneratedImage::hash();
+  hash_combine(h, is_local);
+  hash_combine(h, filename);
+  hash_combine(h, age);
+  return h;
+}
 
 // ----------------------------------------------------------------------------- : ImageValueToImage
 
@@ -504,3 +922,9 @@ bool ImageValueToImage::operator == (const GeneratedImage& that) const {
   return that2 && filename == that2->filename
                && age      == that2->age;
 }
+size_t ImageValueToImage::hash() const {
+  size_t h = GeneratedImage::hash();
+  hash_combine(h, filename);
+  hash_combine(h, age);
+  return h;
+}
@@ -13,6 +13,7 @@
 #include <util/io/package.hpp>
 #include <gfx/gfx.hpp>
 #include <script/value.hpp>
+#include <functional>
 
 DECLARE_POINTER_TYPE(GeneratedImage);
 DECLARE_POINTER_TYPE(SymbolVariation);
@@ -29,7 +30,7 @@ public:
   struct Options {
     Options(int width = 0, int height = 0, Package* package = nullptr, Package* local_package = nullptr, PreserveAspect preserve_aspect = ASPECT_STRETCH, bool saturate = false)
       : width(width), height(height), zoom(1.0), angle(0)
-      , preserve_aspect(preserve_aspect), saturate(saturate)
+      , preserve_aspect(preserve_aspect), saturate(saturate), full_resolution(false)
       , package(package), local_package(local_package)
     {}
     
@@ -39,12 +40,22 @@ public:
     Radians        angle;           ///< Angle to rotate image by afterwards
     PreserveAspect preserve_aspect;
     bool           saturate;
+    bool           full_resolution; ///< Load images at their original size, instead of a smaller version that is still large enough for width*height
     Package* package;       ///< Package to load images from
     Package* local_package; ///< Package to load symbols and ImageValue images from
   };
   
   /// Generate the image, and conform to the options
   Image generateConform(const Options&) const;
+  /// Generate the image, and conform to the options, using a cache shared by all threads
+  /** Images that are equal (operator ==) and use the same options share one cache entry,
+   *  so the same frame used by many cards is only generated once.
+   *  The returned image is a copy, the caller is free to modify it.
+   */
+  Image generateConformCached(const Options&) const;
+  /// Remove all images from the shared caches, both generated and decoded images
+  /** Should be called when the contents of packages change, for instance when they are reloaded. */
+  static void clearCache();
   /// Generate the image
   virtual Image generate(const Options&) const = 0;
   /// How must the image be combined with the background?
@@ -52,6 +63,8 @@ public:
   /// Equality should mean that every pixel in the generated images is the same if the same options are used
   virtual bool operator == (const GeneratedImage& that) const = 0;
   inline  bool operator != (const GeneratedImage& that) const { return !(*this == that); }
+  /// Hash of this image, images that are equal (operator ==) must have the same hash
+  virtual size_t hash() const;
   
   /// Can this image be generated safely from another thread?
   virtual bool threadSafe() const { return true; }
@@ -68,6 +81,15 @@ public:
 /// Resize an image to conform to the options
 Image conform_image(const Image&, const GeneratedImage::Options&);
 
+/// Load an image using a cache of decoded images shared by all threads
+/** The cache key is the name of the file and its modification time, load() is called on a miss.
+ *  Unless options.full_resolution is set, a smaller version of the image can be returned,
+ *  as long as it is at least options.width * options.height (and has the same aspect ratio).
+ *  Such smaller versions are made by halving the size, and they are cached as well.
+ *  The returned image is a copy, the caller is free to modify it.
+ */
+Image load_image_cached(const String& key, wxLongLong mtime, const GeneratedImage::Options& options, const function<Image()>& load);
+
 // ----------------------------------------------------------------------------- : SimpleFilterImage
 
 /// Apply some filter to a single image
@@ -78,6 +100,7 @@ public:
   {}
   ImageCombine combine() const override { return image->combine(); }
   bool local() const override { return image->local(); }
+  size_t hash() const override;
 protected:
   GeneratedImageP image;
 };
@@ -108,6 +131,7 @@ public:
   Image generate(const Options& opt) const override;
   ImageCombine combine() const override;
   bool operator == (const GeneratedImage& that) const override;
+  size_t hash() const override;
   bool local() const override { return image1->local() && image2->local(); }
 private:
   GeneratedImageP image1, image2;
@@ -125,6 +149,7 @@ public:
   Image generate(const Options& opt) const override;
   ImageCombine combine() const override;
   bool operator == (const GeneratedImage& that) const override;
+  size_t hash() const override;
   bool local() const override { return light->local() && dark->local() && mask->local(); }
 private:
   GeneratedImageP light, dark, mask;
@@ -141,6 +166,7 @@ public:
   Image generate(const Options& opt) const override;
   ImageCombine combine() const override;
   bool operator == (const GeneratedImage& that) const override;
+  size_t hash() const override;
   bool local() const override { return image1->local() && image2->local(); }
 private:
   GeneratedImageP image1, image2;
@@ -157,6 +183,7 @@ public:
   {}
   Image generate(const Options& opt) const override;
   bool operator == (const GeneratedImage& that) const override;
+  size_t hash() const override;
 private:
   GeneratedImageP mask;
 };
@@ -169,6 +196,7 @@ public:
   {}
   Image generate(const Options& opt) const override;
   bool operator == (const GeneratedImage& that) const override;
+  size_t hash() const override;
 private:
   double alpha;
 };
@@ -184,6 +212,7 @@ public:
   Image generate(const Options& opt) const override;
   ImageCombine combine() const override;
   bool operator == (const GeneratedImage& that) const override;
+  size_t hash() const override;
 private:
   ImageCombine image_combine;
 };
@@ -198,6 +227,7 @@ public:
   {}
   Image generate(const Options& opt) const override;
   bool operator == (const GeneratedImage& that) const override;
+  size_t hash() const override;
 private:
   double amount;
 };
@@ -224,6 +254,7 @@ public:
   {}
   Image generate(const Options& opt) const override;
   bool operator == (const GeneratedImage& that) const override;
+  size_t hash() const override;
 private:
   Color color;
 };
@@ -235,6 +266,7 @@ public:
   {}
   Image generate(const Options& opt) const override;
   bool operator == (const GeneratedImage& that) const override;
+  size_t hash() const override;
 private:
   Color red,green,blue,white;
 };
@@ -269,6 +301,7 @@ public:
   {}
   Image generate(const Options& opt) const override;
   bool operator == (const GeneratedImage& that) const override;
+  size_t hash() const override;
 private:
   Radians angle;
 };
@@ -283,6 +316,7 @@ public:
   {}
   Image generate(const Options& opt) const override;
   bool operator == (const GeneratedImage& that) const override;
+  size_t hash() const override;
 private:
   double border_size;
 };
@@ -297,6 +331,7 @@ public:
   {}
   Image generate(const Options& opt) const override;
   bool operator == (const GeneratedImage& that) const override;
+  size_t hash() const override;
 private:
   double width, height;
   double offset_x, offset_y;
@@ -313,6 +348,7 @@ public:
   {}
   Image generate(const Options& opt) const override;
   bool operator == (const GeneratedImage& that) const override;
+  size_t hash() const override;
 private:
   double offset_x, offset_y;
   double shadow_alpha;
@@ -323,6 +359,7 @@ private:
 // ----------------------------------------------------------------------------- : PackagedImage
 
 /// Load an image from a file in a package
+/** Decoded images are cached, see load_image_cached. */
 class PackagedImage : public GeneratedImage {
 public:
   inline PackagedImage(const String& filename)
@@ -330,6 +367,7 @@ public:
   {}
   Image generate(const Options& opt) const override;
   bool operator == (const GeneratedImage& that) const override;
+  size_t hash() const override;
 private:
   String filename;
 };
@@ -344,6 +382,7 @@ public:
   {}
   Image generate(const Options& opt) const override;
   bool operator == (const GeneratedImage& that) const override;
+  size_t hash() const override;
 private:
   String name;
 };
@@ -357,6 +396,7 @@ public:
   ~SymbolToImage();
   Image generate(const Options& opt) const override;
   bool operator == (const GeneratedImage& that) const override;
+  size_t hash() const override;
   bool local() const override { return is_local; }
   
   #ifdef __WXGTK__
@@ -379,6 +419,7 @@ public:
   ~ImageValueToImage();
   Image generate(const Options& opt) const override;
   bool operator == (const GeneratedImage& that) const override;
+  size_t hash() const override;
   bool local() const override { return true; }
 private:
   ImageValueToImage(const ImageValueToImage&); // copy ctor
@@ -18,6 +18,23 @@
 #include <util/angle.hpp>
 #include <gfx/color.hpp>
 
+// ----------------------------------------------------------------------------- : Vectorization
+
+/// Compile a function for several instruction sets, the best one is chosen when the program starts
+/** Used for functions with per pixel loops, which the compiler can vectorize.
+ *  On x86-64 the default version uses SSE2, the avx2 version handles twice as many bytes per instruction.
+ *  Functions that are inlined into such a function are compiled for each instruction set as well.
+ *  This needs ifunc support, so with MSVC and MinGW the function is only compiled for the baseline instruction set.
+ */
+#if defined(__x86_64__) && defined(__ELF__) && defined(__has_attribute)
+  #if __has_attribute(target_clones)
+    #define PIXEL_LOOP_TARGETS __attribute__((target_clones("avx2","default")))
+  #endif
+#endif
+#ifndef PIXEL_LOOP_TARGETS
+  #define PIXEL_LOOP_TARGETS
+#endif
+
 // ----------------------------------------------------------------------------- : Resampling
 
 /// Resample (resize) an image, uses bilenear filtering
@@ -91,6 +108,21 @@ void saturate(Image& image, double amount);
 /// Invert the colors in an image
 void invert(Image& img);
 
+/// Blur a w*h array of bytes (such as an alpha channel) with a gaussian
+/** sigma_x and sigma_y are the standard deviations in pixels, values outside the array count as 0.
+ *  The gaussian is approximated with three box filters in each direction,
+ *  so the time taken does not depend on the radius.
+ *  The box sizes are whole pixels, so a sigma below 0.8 gives no blur at all.
+ */
+void gaussian_blur(Byte* data, int w, int h, double sigma_x, double sigma_y);
+
+/// Blur a w*h array of bytes (such as an alpha channel) for the shadow of text
+/** Same as blur_radius passes of a small 5 point kernel, each pass adds a variance of 1/3 pixel.
+ *  For small radii these passes are done directly, edge values are repeated.
+ *  Larger radii use gaussian_blur with the same variance.
+ */
+void blur_alpha(Byte* data, int w, int h, int blur_radius);
+
 // ----------------------------------------------------------------------------- : Combining
 
 /// Ways in which images can be combined, similair to what Photoshop supports
@@ -12,6 +12,7 @@
 
 // ----------------------------------------------------------------------------- : Saturation
 
+PIXEL_LOOP_TARGETS
 void saturate(Image& image, double amount) {
   Byte* pix = image.GetData();
   Byte* end = pix + image.GetWidth() * image.GetHeight() * 3;
@@ -37,14 +38,16 @@ void saturate(Image& image, double amount) {
       pix += 3;
     }
   } else if (factor > 0) {
-    int div = 768 - 3 * factor;
+    // divide as doubles, integer division can not be vectorized.
+    // this gives the same result: the quotient can only be off near an integer when it is far outside 0..255
+    double div = 768 - 3 * factor;
     assert(div > 0);
     while (pix != end) {
       int r = pix[0], g = pix[1], b = pix[2];
       int avg = factor*(r+g+b);
-      pix[0] = col((768*r - avg) / div);
-      pix[1] = col((768*g - avg) / div);
-      pix[2] = col((768*b - avg) / div);
+      pix[0] = col(int((768*r - avg) / div));
+      pix[1] = col(int((768*g - avg) / div));
+      pix[2] = col(int((768*b - avg) / div));
       pix += 3;
     }
   } else {
@@ -63,6 +66,7 @@ void saturate(Image& image, double amount) {
 
 // ----------------------------------------------------------------------------- : Color inversion
 
+PIXEL_LOOP_TARGETS
 void invert(Image& img) {
   Byte* data = img.GetData();
   int n = 3 * img.GetWidth() * img.GetHeight();
@@ -83,7 +87,9 @@ RGB recolor(RGB x, RGB cr, RGB cg, RGB cb, RGB cw) {
   // We should have that nr+ng+bw+nw < 255,
   //  otherwise the input is not a mixture of red/green/blue/white.
   // Just to be sure, divide by the sum instead of 255
-  int total = max(255, nr+ng+nb+nw);
+  // The division is done with floats, so it can be vectorized. The numerators are less than 2^18 and the quotients
+  // less than 256, a float is precise enough for that to give the same result as integer division.
+  float total = (float)max(255, nr+ng+nb+nw);
   
   return RGB(
       static_cast<Byte>( (nr * cr.r + ng * cg.r + nb * cb.r + nw * cw.r) / total ),
@@ -92,6 +98,7 @@ RGB recolor(RGB x, RGB cr, RGB cg, RGB cb, RGB cw) {
     );
 }
 
+PIXEL_LOOP_TARGETS
 void recolor(Image& img, RGB cr, RGB cg, RGB cb, RGB cw) {
   RGB* data = (RGB*)img.GetData();
   int n = img.GetWidth() * img.GetHeight();
@@ -110,3 +117,132 @@ void recolor(Image& img, RGB cr) {
   recolor(img, cr, dark ? black : white, dark ? white : black, white);
 }
 
+// ----------------------------------------------------------------------------- : Blur
+
+const int BLUR_BOXES = 3;
+
+/// Radii of the box filters that together approximate a gaussian with the given standard deviation
+void gaussian_box_radii(double sigma, int radii[BLUR_BOXES]) {
+  // see "Fast Almost-Gaussian Filtering" by Peter Kovesi
+  const int n = BLUR_BOXES;
+  double variance = sigma * sigma;
+  int wl = (int)floor(sqrt(12 * variance / n + 1));
+  if (wl % 2 == 0) wl--;
+  int m = (int)floor((12 * variance - n*wl*wl - 4*n*wl - 3*n) / (-4*wl - 4) + 0.5);
+  for (int i = 0 ; i < n ; ++i) {
+    radii[i] = max(0, ((i < m ? wl : wl + 2) - 1) / 2);
+  }
+}
+
+/// Box filter a line of n values, using a running sum
+void box_blur_line(const float* in, float* out, int n, int r) {
+  if (r <= 0) {
+    memcpy(out, in, n * sizeof(float));
+    return;
+  }
+  float scale = 1.0f / (2*r + 1);
+  double sum = 0;
+  for (int i = 0 ; i < min(r, n) ; ++i) sum += in[i];
+  for (int i = 0 ; i < n ; ++i) {
+    if (i + r < n)  sum += in[i + r];
+    out[i] = (float)(sum * scale);
+    if (i - r >= 0) sum -= in[i - r];
+  }
+}
+
+/// Box filter all columns of a w*h array at once
+/** Works on whole rows, the inner loops are simple enough to be vectorized by the compiler. */
+PIXEL_LOOP_TARGETS
+void box_blur_columns(const float* in, float* out, int w, int h, int r) {
+  if (r <= 0) {
+    memcpy(out, in, w * h * sizeof(float));
+    return;
+  }
+  float scale = 1.0f / (2*r + 1);
+  vector<float> sum(w, 0.0f);
+  float* s = sum.data();
+  for (int y = 0 ; y < min(r, h) ; ++y) {
+    const float* add = in + y * w;
+    for (int x = 0 ; x < w ; ++x) s[x] += add[x];
+  }
+  for (int y = 0 ; y < h ; ++y) {
+    if (y + r < h) {
+      const float* add = in + (y + r) * w;
+      for (int x = 0 ; x < w ; ++x) s[x] += add[x];
+    }
+    float* o = out + y * w;
+    for (int x = 0 ; x < w ; ++x) o[x] = s[x] * scale;
+    if (y - r >= 0) {
+      const float* sub = in + (y - r) * w;
+      for (int x = 0 ; x < w ; ++x) s[x] -= sub[x];
+    }
+  }
+}
+
+void gaussian_blur(Byte* data, int w, int h, double sigma_x, double sigma_y) {
+  if (w <= 0 || h <= 0) return;
+  int rx[BLUR_BOXES], ry[BLUR_BOXES];
+  gaussian_box_radii(sigma_x, rx);
+  gaussian_box_radii(sigma_y, ry);
+  // The boxes are applied one after another, what the first box spreads outside the array is spread back in by the next.
+  // So the array is padded with zeros as far as the boxes reach, otherwise the edges would lose too much weight.
+  int pad_x = 0, pad_y = 0;
+  for (int i = 0 ; i < BLUR_BOXES ; ++i) {
+    pad_x += rx[i];
+    pad_y += ry[i];
+  }
+  int pw = w + 2 * pad_x, ph = h + 2 * pad_y;
+  // blur horizontally, line by line
+  vector<float> a(w * ph, 0.0f), b(w * ph);
+  vector<float> line(pw), line2(pw);
+  for (int y = 0 ; y < h ; ++y) {
+    fill(line.begin(), line.end(), 0.0f);
+    copy(data + y * w, data + (y + 1) * w, line.begin() + pad_x);
+    for (int i = 0 ; i < BLUR_BOXES ; ++i) {
+      box_blur_line(line.data(), line2.data(), pw, rx[i]);
+      swap(line, line2);
+    }
+    copy(line.begin() + pad_x, line.begin() + pad_x + w, a.begin() + (y + pad_y) * w);
+  }
+  // blur vertically, a already has the rows of padding
+  for (int i = 0 ; i < BLUR_BOXES ; ++i) {
+    box_blur_columns(a.data(), b.data(), w, ph, ry[i]);
+    swap(a, b);
+  }
+  const float* out = a.data() + pad_y * w;
+  for (int i = 0 ; i < w * h ; ++i) {
+    data[i] = (Byte)min(255, (int)(out[i] + 0.5f));
+  }
+}
+
+// Up to this radius the passes of the small kernel are used, they are cheap for small radii,
+// and they give every radius its own spread, while the whole pixel box sizes are too coarse for that
+const int MAX_ITERATED_BLUR_RADIUS = 8;
+
+// simple blur
+inline int blur_alpha_pixel(Byte* in, int x, int y, int width, int height) {
+  return (2 * (                      in[0])      + // center
+          (x == 0          ? in[0] : in[-1])     + // left
+          (y == 0          ? in[0] : in[-width]) + // up
+          (x == width - 1  ? in[0] : in[1])      + // right
+          (y == height - 1 ? in[0] : in[width])    // down
+         ) / 6;
+}
+
+void blur_alpha(Byte* data, int w, int h, int blur_radius) {
+  if (blur_radius <= 0) return;
+  if (blur_radius > MAX_ITERATED_BLUR_RADIUS) {
+    double sigma = sqrt(blur_radius / 3.0);
+    gaussian_blur(data, w, h, sigma, sigma);
+    return;
+  }
+  for (int i = 0 ; i < blur_radius ; ++i) {
+    Byte* d = data;
+    for (int y = 0 ; y < h ; ++y) {
+      for (int x = 0 ; x < w ; ++x) {
+        *d = blur_alpha_pixel(d, x, y, w, h);
+        ++d;
+      }
+    }
+  }
+}
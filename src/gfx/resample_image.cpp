@@ -9,105 +9,223 @@
 #include <util/prec.hpp>
 #include <gfx/gfx.hpp>
 #include <util/error.hpp>
+#include <util/parallel.hpp>
 
-// ----------------------------------------------------------------------------- : Resample passes
+// ----------------------------------------------------------------------------- : Resample weights
 
 // bitshift for fixed point numbers
 //  higher is less error
-//  we will get errors if 2^shift * imagesize becomes too large
-const int shift = 32-10-8; // => max size = 1024, max alpha = 255
+//  the sums of a pass must fit in 32 bits: 2^shift * 255 * 255 (for alpha)
+const int shift = 32-10-8;
+// for images larger than 1024 pixels a larger shift is needed, with 64 bit sums
+const int large_shift = 30;
+const int small_size  = 1 << 10;
 
-// Resample an image only in a single direction, either horizontally or vertically
-/* Terms are based on x resampling (keeping the same number of lines):
- *  offset     = number of elements to skip at the start
- *  length     = length of a line
- *  delta      = number of elements between pixels in a lines
- *  lines      = number of lines
- *  line_delta = number of elements between the the first pixel of two lines
- *  1 element = 3 bytes in data, 1 byte in alpha
+/// Weights of the input pixels that make up each output pixel of a resample pass
+/** Each input pixel becomes a fixed amount of output, and the output pixels 'eat' input
+ *  until their total is 1<<shift, see resample().
+ *  This is the same for every line of a pass, so it is only worked out once.
  */
-void resample_pass(const Image& img_in, Image& img_out, int offset_in, int offset_out,
-                   int length_in, int delta_in, int length_out, int delta_out,
-                   int lines, int line_delta_in, int line_delta_out)
+struct ResampleWeights {
+  ResampleWeights(int length_in, int length_out);
+  
+  int shift;
+  vector<int>      begin;  ///< Output pixel x is made from the entries begin[x] until begin[x+1]
+  vector<int>      index;  ///< Input pixel
+  vector<uint64_t> weight; ///< Amount of that input pixel, in fixed point
+};
+
+ResampleWeights::ResampleWeights(int length_in, int length_out)
+  : shift(length_in <= small_size && length_out <= small_size ? ::shift : large_shift)
+  , begin(length_out + 1)
 {
+  uint64_t out_fact = ((uint64_t)length_out << shift) / length_in; // how much to output for 1 input pixel
+  uint64_t out_rest = ((uint64_t)length_out << shift) % length_in;
+  uint64_t in_rem = out_fact + out_rest; // remaining to input from the current input pixel
+  int in = 0;
+  for (int x = 0 ; x < length_out ; ++x) {
+    begin[x] = (int)index.size();
+    uint64_t out_rem = (uint64_t)1 << shift;
+    while (out_rem >= in_rem && in < length_in) {
+      // eat a whole input pixel
+      if (in_rem > 0) {
+        index.push_back(in);
+        weight.push_back(in_rem);
+      }
+      out_rem -= in_rem;
+      in_rem = out_fact;
+      ++in;
+    }
+    if (out_rem > 0 && in < length_in) {
+      // eat a partial input pixel
+      index.push_back(in);
+      weight.push_back(out_rem);
+      in_rem -= out_rem;
+    }
+  }
+  begin[length_out] = (int)index.size();
+}
+
+// ----------------------------------------------------------------------------- : Resample passes
+
+/// Resample lines [line_begin, line_end), one line at a time
+template <typename Sum>
+void resample_lines(const Image& img_in, Image& img_out, const ResampleWeights& w,
+                    int offset_in, int offset_out, int delta_in, int delta_out,
+                    int line_begin, int line_end, int line_delta_in, int line_delta_out)
+{
+  int length_out = (int)w.begin.size() - 1;
   bool alpha = img_in.HasAlpha();
-  if (alpha && !img_out.HasAlpha()) img_out.InitAlpha();
-  int out_fact = (length_out << shift) / length_in; // how much to output for 256 input = 1 pixel
-  int out_rest = (length_out << shift) % length_in;
-  // for each line
-  for (int l = 0 ; l < lines ; ++l) {
-    Byte* in  = img_in .GetData() + 3 * (offset_in  + l * line_delta_in);
-    Byte* out = img_out.GetData() + 3 * (offset_out + l * line_delta_out);
-    UInt in_rem = out_fact + out_rest; // remaining to input from the current input pixel
-    
+  for (int l = line_begin ; l < line_end ; ++l) {
+    const Byte* in  = img_in .GetData() + 3 * (offset_in  + l * line_delta_in);
+    Byte*       out = img_out.GetData() + 3 * (offset_out + l * line_delta_out);
     if (alpha) {
-      Byte* in_a  = img_in .GetAlpha() + (offset_in  + l * line_delta_in);
-      Byte* out_a = img_out.GetAlpha() + (offset_out + l * line_delta_out);
-      
+      const Byte* in_a  = img_in .GetAlpha() + (offset_in  + l * line_delta_in);
+      Byte*       out_a = img_out.GetAlpha() + (offset_out + l * line_delta_out);
       for (int x = 0 ; x < length_out ; ++x) {
-        UInt out_rem = 1 << shift;
-        UInt totR = 0, totG = 0, totB = 0, totA = 0;
-        while (out_rem >= in_rem) {
-          // eat a whole input pixel
-          totR += in[0]   * in_rem * in_a[0]; // multiply by alpha
-          totG += in[1]   * in_rem * in_a[0];
-          totB += in[2]   * in_rem * in_a[0];
-          totA += in_a[0] * in_rem;
-          out_rem -= in_rem;
-          in_rem = out_fact;
-          in += 3*delta_in; in_a += delta_in;
-        }
-        if (out_rem > 0) {
-          // eat a partial input pixel
-          totR += in[0]   * out_rem * in_a[0];
-          totG += in[1]   * out_rem * in_a[0];
-          totB += in[2]   * out_rem * in_a[0];
-          totA += in_a[0] * out_rem;
-          in_rem -= out_rem;
+        Sum totR = 0, totG = 0, totB = 0, totA = 0;
+        for (int k = w.begin[x] ; k < w.begin[x+1] ; ++k) {
+          int i = w.index[k] * delta_in;
+          Sum wa = (Sum)w.weight[k] * in_a[i]; // multiply by alpha
+          totR += in[3*i]   * wa;
+          totG += in[3*i+1] * wa;
+          totB += in[3*i+2] * wa;
+          totA += in_a[i] * (Sum)w.weight[k];
         }
         // store
         if (totA) {
-          out[0] = totR / totA;
-          out[1] = totG / totA;
-          out[2] = totB / totA;
-          out_a[0] = totA >> shift;
+          out[0] = (Byte)(totR / totA);
+          out[1] = (Byte)(totG / totA);
+          out[2] = (Byte)(totB / totA);
+          out_a[0] = (Byte)(totA >> w.shift);
         } else {
           out[0] = out[1] = out[2] = out_a[0] = 0; // div by 0 is bad
         }
         out += 3*delta_out; out_a += delta_out;
       }
-      
     } else {
       // no alpha
       for (int x = 0 ; x < length_out ; ++x) {
-        UInt out_rem = 1 << shift;
-        UInt totR = 0, totG = 0, totB = 0;
-        while (out_rem >= in_rem) {
-          // eat a whole input pixel
-          totR += in[0] * in_rem;
-          totG += in[1] * in_rem;
-          totB += in[2] * in_rem;
-          out_rem -= in_rem;
-          in_rem = out_fact;
-          in += 3*delta_in;
-        }
-        if (out_rem > 0) {
-          // eat a partial input pixel
-          totR += in[0] * out_rem;
-          totG += in[1] * out_rem;
-          totB += in[2] * out_rem;
-          in_rem -= out_rem;
+        Sum totR = 0, totG = 0, totB = 0;
+        for (int k = w.begin[x] ; k < w.begin[x+1] ; ++k) {
+          int i = 3 * w.index[k] * delta_in;
+          Sum wt = (Sum)w.weight[k];
+          totR += in[i]   * wt;
+          totG += in[i+1] * wt;
+          totB += in[i+2] * wt;
         }
         // store
-        out[0] = totR >> shift;
-        out[1] = totG >> shift;
-        out[2] = totB >> shift;
+        out[0] = (Byte)(totR >> w.shift);
+        out[1] = (Byte)(totG >> w.shift);
+        out[2] = (Byte)(totB >> w.shift);
         out += 3*delta_out;
       }
     }
   }
 }
 
+/// Resample lines [line_begin, line_end), where consecutive lines are next to each other in memory
+/** This is the case for vertical passes. All lines are handled together, one output row at a time,
+ *  so the inner loops go over consecutive bytes, and can be vectorized.
+ */
+template <typename Sum>
+PIXEL_LOOP_TARGETS
+void resample_rows(const Image& img_in, Image& img_out, const ResampleWeights& w,
+                   int offset_in, int offset_out, int delta_in, int delta_out,
+                   int line_begin, int line_end)
+{
+  int length_out = (int)w.begin.size() - 1;
+  int n = line_end - line_begin;
+  bool alpha = img_in.HasAlpha();
+  vector<Sum> sums(alpha ? 4 * n : 3 * n);
+  Sum* tot   = sums.data();
+  Sum* tot_a = tot + 3 * n;
+  for (int x = 0 ; x < length_out ; ++x) {
+    fill(sums.begin(), sums.end(), 0);
+    Byte* out = img_out.GetData() + 3 * (offset_out + x * delta_out + line_begin);
+    if (alpha) {
+      for (int k = w.begin[x] ; k < w.begin[x+1] ; ++k) {
+        int i = offset_in + w.index[k] * delta_in + line_begin;
+        const Byte* in   = img_in.GetData() + 3 * i;
+        const Byte* in_a = img_in.GetAlpha() + i;
+        Sum wt = (Sum)w.weight[k];
+        for (int l = 0 ; l < n ; ++l) {
+          Sum wa = wt * in_a[l]; // multiply by alpha
+          tot[3*l]   += in[3*l]   * wa;
+          tot[3*l+1] += in[3*l+1] * wa;
+          tot[3*l+2] += in[3*l+2] * wa;
+          tot_a[l]   += wa;
+        }
+      }
+      Byte* out_a = img_out.GetAlpha() + offset_out + x * delta_out + line_begin;
+      for (int l = 0 ; l < n ; ++l) {
+        if (tot_a[l]) {
+          out[3*l]   = (Byte)(tot[3*l]   / tot_a[l]);
+          out[3*l+1] = (Byte)(tot[3*l+1] / tot_a[l]);
+          out[3*l+2] = (Byte)(tot[3*l+2] / tot_a[l]);
+          out_a[l]   = (Byte)(tot_a[l] >> w.shift);
+        } else {
+          out[3*l] = out[3*l+1] = out[3*l+2] = out_a[l] = 0; // div by 0 is bad
+        }
+      }
+    } else {
+      for (int k = w.begin[x] ; k < w.begin[x+1] ; ++k) {
+        const Byte* in = img_in.GetData() + 3 * (offset_in + w.index[k] * delta_in + line_begin);
+        Sum wt = (Sum)w.weight[k];
+        for (int j = 0 ; j < 3 * n ; ++j) {
+          tot[j] += in[j] * wt;
+        }
+      }
+      for (int j = 0 ; j < 3 * n ; ++j) {
+        out[j] = (Byte)(tot[j] >> w.shift);
+      }
+    }
+  }
+}
+
+// minimum number of output pixels for each thread
+const int MIN_PIXELS_PER_THREAD = 256 * 1024;
+
+// Resample an image only in a single direction, either horizontally or vertically
+/* Terms are based on x resampling (keeping the same number of lines):
+ *  offset     = number of elements to skip at the start
+ *  length     = length of a line
+ *  delta      = number of elements between pixels in a lines
+ *  lines      = number of lines
+ *  line_delta = number of elements between the the first pixel of two lines
+ *  1 element = 3 bytes in data, 1 byte in alpha
+ *
+ * Large images are split into blocks of lines, that are handled by multiple threads.
+ */
+void resample_pass(const Image& img_in, Image& img_out, int offset_in, int offset_out,
+                   int length_in, int delta_in, int length_out, int delta_out,
+                   int lines, int line_delta_in, int line_delta_out)
+{
+  if (img_in.HasAlpha() && !img_out.HasAlpha()) img_out.InitAlpha();
+  ResampleWeights w(length_in, length_out);
+  bool small = w.shift == ::shift; // sums fit in 32 bits
+  bool rows  = line_delta_in == 1 && line_delta_out == 1;
+  // split into blocks
+  // only from the main thread, background threads (such as the thumbnail thread) already run next to it
+  size_t max_threads = wxThread::IsMain() ? worker_thread_count() : 1;
+  size_t threads = min(max_threads, (size_t)max(1, (int)((long long)lines * length_out / MIN_PIXELS_PER_THREAD)));
+  size_t blocks  = threads > 1 ? 4 * threads : 1;
+  int block_size = (int)((lines + blocks - 1) / blocks);
+  parallel_for(blocks, threads, [&](size_t, size_t b) {
+    int begin = (int)b * block_size, end = min(lines, begin + block_size);
+    if (begin >= end) return;
+    if (rows && small) {
+      resample_rows<UInt>    (img_in, img_out, w, offset_in, offset_out, delta_in, delta_out, begin, end);
+    } else if (rows) {
+      resample_rows<uint64_t>(img_in, img_out, w, offset_in, offset_out, delta_in, delta_out, begin, end);
+    } else if (small) {
+      resample_lines<UInt>    (img_in, img_out, w, offset_in, offset_out, delta_in, delta_out, begin, end, line_delta_in, line_delta_out);
+    } else {
+      resample_lines<uint64_t>(img_in, img_out, w, offset_in, offset_out, delta_in, delta_out, begin, end, line_delta_in, line_delta_out);
+    }
+  });
+}
+
 // ----------------------------------------------------------------------------- : Resample
 
 /* The algorithm first resizes in horizontally, then vertically,
@@ -141,28 +141,6 @@ void downsample_to_alpha(Bitmap& bmp_in, Image& img_out) {
   delete[] temp;
 }
 
-// simple blur
-int blur_alpha_pixel(Byte* in, int x, int y, int width, int height) {
-  return (2 * (                      in[0])      + // center
-          (x == 0          ? in[0] : in[-1])     + // left
-          (y == 0          ? in[0] : in[-width]) + // up
-          (x == width - 1  ? in[0] : in[1])      + // right
-          (y == height - 1 ? in[0] : in[width])    // down
-         ) / 6;
-}
-
-// TODO: move me?
-void blur_image_alpha(Image& img) {
-  int width = img.GetWidth(), height = img.GetHeight();
-  Byte* data = img.GetAlpha();
-  for (int y = 0 ; y < height ; ++y) {
-    for (int x = 0 ; x < width ; ++x) {
-      *data = blur_alpha_pixel(data, x, y, width, height);
-      ++data;
-    }
-  }
-}
-
 // Draw text by first drawing it using a larger font and then downsampling it
 // optionally rotated by an angle
 void draw_resampled_text(DC& dc, const RealPoint& pos, const RealRect& rect, double stretch, Radians angle, Color color, const String& text, int blur_radius, int repeat) {
@@ -198,9 +176,7 @@ void draw_resampled_text(DC& dc, const RealPoint& pos, const RealRect& rect, dou
     set_alpha(img_small, color.Alpha() / 255.);
   }
   // blur
-  for (int i = 0 ; i < blur_radius ; ++i) {
-    blur_image_alpha(img_small);
-  }
+  blur_alpha(img_small.GetAlpha(), w, h, blur_radius);
   // step 3. draw to dc
   for (int i = 0 ; i < repeat ; ++i) {
     dc.DrawBitmap(img_small, xi, yi);
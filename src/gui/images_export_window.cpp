@@ -65,7 +65,14 @@ void ImagesExportWindow::onOk(wxCommandEvent&) {
   if (name.empty()) return;
   settings.default_export_dir = wxPathOnly(name);
   // Export
-  export_images(set, getSelection(), name, gs.images_export_filename, gs.images_export_conflicts);
+  {
+    ExportProgressDialog progress(this, _TITLE_("export images"), _TITLE_("export images"));
+    try {
+      export_images(set, getSelection(), name, gs.images_export_filename, gs.images_export_conflicts, &progress);
+    } catch (const AbortException&) {
+      // cancelled, images that were already written are kept
+    }
+  }
   // Done
   EndModal(wxID_OK);
 }
@@ -8,6 +8,7 @@
 
 #include <util/prec.hpp>
 #include <script/profiler.hpp>
+#include <util/error.hpp>
 #include <wx/dcbuffer.h>
 
 #if USE_SCRIPT_PROFILING
@@ -141,6 +142,15 @@ void ProfilerPanel::draw_profiler(wxDC& dc, int x0, int y0) {
       draw_right(dc,wxString::Format(_("%.2f"), prof->total_time()), pos[3], y);
       draw_right(dc,wxString::Format(_("%.2f"), prof->max_time()),   pos[4], y);
     }
+    // Draw counters
+    dc.SetTextForeground(fg);
+    int y = y0 + (++i) * line_height + 6;
+    dc.DrawLine(x0, y + line_height / 2, x1, y + line_height / 2);
+    FOR_EACH_CONST(c, profile_counters()) {
+      y = y0 + (++i) * line_height + 6;
+      dc.DrawText(c->name,                                    pos[0], y);
+      draw_right(dc,wxString::Format(_("%d"), (int)c->get()), pos[1], y);
+    }
     // are any fancy effects active?
     if (fancy_effects && any_active && !timer.IsRunning()) {
       timer.Start(40,wxTIMER_ONE_SHOT);
@@ -168,13 +178,69 @@ BEGIN_EVENT_TABLE(ProfilerPanel, wxPanel)
 END_EVENT_TABLE()
 
 
-void show_profiler_window(wxWindow* parent) {
-  wxDialog* dlg = new wxDialog(parent, wxID_ANY, _("Profiler"), wxDefaultPosition,wxSize(450,600), wxDEFAULT_DIALOG_STYLE|wxRESIZE_BORDER);
+// -----------------------------------------------------------------------------
+// Profiler Window
+// -----------------------------------------------------------------------------
+
+enum {
+  ID_PROFILER_EXPORT = wxID_HIGHEST + 1,
+  ID_PROFILER_SAMPLE,
+};
+
+class ProfilerWindow : public wxDialog {
+public:
+  ProfilerWindow(wxWindow* parent);
+  
+private:
+  wxCheckBox* sample;
+  
+  DECLARE_EVENT_TABLE();
+  void onExport(wxCommandEvent&);
+  void onSample(wxCommandEvent&);
+};
+
+ProfilerWindow::ProfilerWindow(wxWindow* parent)
+  : wxDialog(parent, wxID_ANY, _("Profiler"), wxDefaultPosition,wxSize(450,600), wxDEFAULT_DIALOG_STYLE|wxRESIZE_BORDER)
+{
+  // the profiler is off by default in release builds
+  if (profiler_mode() == PROFILER_OFF) set_profiler_mode(PROFILER_TIMING);
+  // init controls
+  sample = new wxCheckBox(this, ID_PROFILER_SAMPLE, _("Sample instead of timing every call"));
+  sample->SetValue(profiler_mode() == PROFILER_SAMPLING);
+  // init sizer
   wxSizer* sizer = new wxBoxSizer(wxVERTICAL);
-  sizer->Add(new ProfilerPanel(dlg,true), 1, wxEXPAND | wxALL, 8);
-  sizer->Add(dlg->CreateButtonSizer(wxOK), 0, wxALIGN_CENTER | wxALL, 8);
-  dlg->SetSizer(sizer);
-  dlg->Show();
+  sizer->Add(new ProfilerPanel(this,true), 1, wxEXPAND | wxALL, 8);
+  sizer->Add(sample, 0, wxEXPAND | wxLEFT | wxRIGHT, 8);
+    wxSizer* s2 = new wxBoxSizer(wxHORIZONTAL);
+    s2->Add(new wxButton(this, ID_PROFILER_EXPORT, _("&Export...")), 0, wxRIGHT, 8);
+    s2->Add(CreateButtonSizer(wxOK), 0);
+  sizer->Add(s2, 0, wxALIGN_CENTER | wxALL, 8);
+  SetSizer(sizer);
+}
+
+void ProfilerWindow::onExport(wxCommandEvent&) {
+  wxFileDialog dlg(this, _("Export profile"), wxEmptyString, _("profile.json"),
+                   _("Chrome trace (*.json)|*.json|Folded stacks (*.folded)|*.folded"), wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+  if (dlg.ShowModal() != wxID_OK) return;
+  try {
+    export_profile(profile_full(), dlg.GetPath(), dlg.GetFilterIndex() == 0 ? PROFILE_CHROME_TRACE : PROFILE_FOLDED);
+  } catch (const Error& e) {
+    handle_error(e);
+  }
+}
+
+void ProfilerWindow::onSample(wxCommandEvent&) {
+  set_profiler_mode(sample->GetValue() ? PROFILER_SAMPLING : PROFILER_TIMING);
+}
+
+BEGIN_EVENT_TABLE(ProfilerWindow, wxDialog)
+  EVT_BUTTON  (ID_PROFILER_EXPORT, ProfilerWindow::onExport)
+  EVT_CHECKBOX(ID_PROFILER_SAMPLE, ProfilerWindow::onSample)
+END_EVENT_TABLE()
+
+
+void show_profiler_window(wxWindow* parent) {
+  (new ProfilerWindow(parent))->Show();
 }
 
 #endif
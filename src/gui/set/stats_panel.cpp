@@ -15,7 +15,10 @@
 #include <data/game.hpp>
 #include <data/statistics.hpp>
 #include <data/action/value.hpp>
+#include <data/action/set.hpp>
+#include <script/dependency.hpp>
 #include <util/window_id.hpp>
+#include <util/parallel.hpp>
 #include <util/alignment.hpp>
 #include <util/tagged_string.hpp>
 #include <gfx/gfx.hpp>
@@ -337,16 +340,38 @@ void StatsPanel::onChangeSet() {
     categories->show(set->game);
   #endif
   card = CardP();
+  dimension_values.clear();
+  dimension_uses_card_list.clear();
   onChange();
 }
 
 void StatsPanel::onAction(const Action& action, bool undone) {
   if (!isInitialized()) return;
-  TYPE_CASE_(action, ScriptValueEvent) {
-    // ignore style only stuff
-  } else {
+  TYPE_CASE(action, ScriptValueEvent) {
+    // a ScriptValueEvent is usually followed by the ValueAction that caused it,
+    // otherwise we update when idle
+    invalidateCard(action.card);
+    up_to_date = false;
+    return;
+  }
+  TYPE_CASE(action, ValueAction) {
+    invalidateCard(action.card.get());
     onChange();
+    return;
   }
+  TYPE_CASE(action, ChangeCardStyleAction) {
+    invalidateCard(action.card.get());
+    onChange();
+    return;
+  }
+  TYPE_CASE_(action, CardListAction) {
+    invalidateCardList();
+    onChange();
+    return;
+  }
+  // something else changed, start from scratch
+  dimension_values.clear();
+  onChange();
 }
 
 void StatsPanel::initUI   (wxToolBar* tb, wxMenuBar* mb) {
@@ -426,6 +451,10 @@ void StatsPanel::onChange() {
   }
 }
 
+void StatsPanel::onIdle(wxIdleEvent&) {
+  if (active && !up_to_date) showCategory();
+}
+
 void StatsPanel::showCategory(const GraphType* prefer_layout) {
   up_to_date = true;
   // find dimensions and layout
@@ -475,21 +504,22 @@ void StatsPanel::showCategory(const GraphType* prefer_layout) {
     );
   }
   // find values for each card
+  updateDimensionValues(dims);
+  vector<const map<const Card*,String>*> values;
+  FOR_EACH(dim, dims) values.push_back(&dimension_values[dim.get()]);
   for (size_t i = 0 ; i < set->cards.size() ; ++i) {
-    Context& ctx = set->getContext(set->cards[i]);
     GraphElementP e = make_intrusive<GraphElement>(i);
     bool show = true;
-    FOR_EACH(dim, dims) {
-      try {
-        String value = untag(dim->script.invoke(ctx)->toString());
-        e->values.push_back(value);
-        if (value.empty() && !dim->show_empty) {
-          // don't show this element
-          show = false;
-          break;
-        }
-      } catch (ScriptError const& e) {
-        handle_error(ScriptError(e.what() + _("\n  in script for statistics dimension '") + dim->name + _("'")));
+    for (size_t j = 0 ; j < dims.size() ; ++j) {
+      auto it = values[j]->find(set->cards[i].get());
+      if (it == values[j]->end()) {
+        // error in script
+        show = false;
+        break;
+      }
+      e->values.push_back(it->second);
+      if (it->second.empty() && !dims[j]->show_empty) {
+        // don't show this element
         show = false;
         break;
       }
@@ -527,6 +557,85 @@ void StatsPanel::onGraphSelect(wxCommandEvent&) {
   filterCards();
 }
 
+// ----------------------------------------------------------------------------- : Dimension values
+
+// Don't bother starting threads unless each of them gets at least this many cards
+const size_t MIN_CARDS_PER_THREAD = 16;
+
+void StatsPanel::updateDimensionValues(const vector<StatsDimensionP>& dims) {
+  FOR_EACH_CONST(dim, dims) {
+    map<const Card*,String>& values = dimension_values[dim.get()];
+    // which cards need to be evaluated?
+    vector<CardP> cards;
+    FOR_EACH_CONST(c, set->cards) {
+      if (values.find(c.get()) == values.end()) cards.push_back(c);
+    }
+    if (cards.empty()) continue;
+    // evaluate, on multiple threads if the script doesn't use the caches of the card list
+    // initContextsForThreads prepares the shared state of the stylesheets, such as the settings used by check_spelling
+    size_t thread_count = usesCardList(*dim) ? 1 : min(worker_thread_count(), cards.size() / MIN_CARDS_PER_THREAD);
+    if (thread_count > 1) set->initContextsForThreads(thread_count);
+    vector<String> results(cards.size());
+    vector<char>   ok(cards.size(), false);
+    parallel_for(cards.size(), thread_count, [&](size_t thread, size_t i) {
+      Context& ctx = thread_count > 1 ? set->getContextForThread(thread, cards[i]) : set->getContext(cards[i]);
+      try {
+        results[i] = untag(dim->script.invoke(ctx)->toString());
+        ok[i] = true;
+      } catch (ScriptError const& e) {
+        handle_error(ScriptError(e.what() + _("\n  in script for statistics dimension '") + dim->name + _("'")));
+      }
+    });
+    for (size_t i = 0 ; i < cards.size() ; ++i) {
+      if (ok[i]) values[cards[i].get()] = results[i];
+    }
+  }
+}
+
+bool StatsPanel::usesCardList(const StatsDimension& dim) {
+  auto it = dimension_uses_card_list.find(&dim);
+  if (it != dimension_uses_card_list.end()) return it->second;
+  bool uses = true;
+  if (!set->cards.empty()) {
+    Dependency test(DEP_DUMMY, false, set.get());
+    try {
+      dim.script.initDependencies(set->getContext(set->cards.front()), test);
+      uses = test.index;
+    } catch (const Error&) {
+      // be careful
+    }
+  }
+  dimension_uses_card_list[&dim] = uses;
+  return uses;
+}
+
+void StatsPanel::invalidateCard(const Card* card) {
+  FOR_EACH(dv, dimension_values) {
+    if (card && !usesCardList(*dv.first)) {
+      dv.second.erase(card);
+    } else {
+      // set values changed, or the dimension can depend on other cards
+      dv.second.clear();
+    }
+  }
+}
+
+void StatsPanel::invalidateCardList() {
+  std::set<const Card*> cards;
+  FOR_EACH_CONST(c, set->cards) cards.insert(c.get());
+  FOR_EACH(dv, dimension_values) {
+    if (usesCardList(*dv.first)) {
+      dv.second.clear();
+      continue;
+    }
+    // forget removed cards, a new card could end up at the same address
+    for (auto it = dv.second.begin() ; it != dv.second.end() ; ) {
+      if (cards.count(it->first)) ++it;
+      else it = dv.second.erase(it);
+    }
+  }
+}
+
 // ----------------------------------------------------------------------------- : Filtering card list
 
 class StatsFilter : public Filter<Card> {
@@ -552,6 +661,7 @@ void StatsPanel::filterCards() {
 
 BEGIN_EVENT_TABLE(StatsPanel, wxPanel)
   EVT_GRAPH_SELECT(wxID_ANY, StatsPanel::onGraphSelect)
+  EVT_IDLE        (          StatsPanel::onIdle)
 END_EVENT_TABLE()
 
 // ----------------------------------------------------------------------------- : Selection
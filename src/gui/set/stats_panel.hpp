@@ -16,6 +16,8 @@ class StatCategoryList;
 class StatDimensionList;
 class GraphControl;
 class FilteredCardList;
+DECLARE_POINTER_TYPE(StatsDimension);
+class Card;
 
 // Pick the style here:
 #define USE_DIMENSION_LISTS 1
@@ -63,12 +65,28 @@ private:
   bool up_to_date; ///< Are the graph and card list up to date?
   bool active;     ///< Is this panel selected?
   
+  /// Value of each statistics dimension for each card
+  /** Cards that have changed are removed, so only they have to be evaluated again.
+   *  Cards without a value (because of a script error) are not shown. */
+  map<const StatsDimension*, map<const Card*,String>> dimension_values;
+  /// For each dimension, does its script depend on the card list?
+  map<const StatsDimension*, bool> dimension_uses_card_list;
+  
   void initControls();
   
   void onChange();
+  void onIdle(wxIdleEvent&);
   void onGraphSelect(wxCommandEvent&);
   void showCategory(const GraphType* prefer_layout = nullptr);
   void showLayout(GraphType);
   void filterCards();
+  
+  /// Make sure dimension_values contains values for all cards
+  void updateDimensionValues(const vector<StatsDimensionP>& dims);
+  bool usesCardList(const StatsDimension& dim);
+  /// A card has changed, its values must be evaluated again
+  void invalidateCard(const Card* card);
+  /// The card list has changed
+  void invalidateCardList();
 };
 
@@ -31,6 +31,7 @@
 #include <gui/util.hpp>
 #include <util/io/package_manager.hpp>
 #include <util/window_id.hpp>
+#include <script/profiler.hpp>
 #include <data/game.hpp>
 #include <data/set.hpp>
 #include <data/card.hpp>
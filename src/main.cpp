@@ -30,6 +30,129 @@
 
 ScriptValueP export_set(SetP const& set, vector<CardP> const& cards, ExportTemplateP const& exp, String const& outname);
 
+// ----------------------------------------------------------------------------- : Command line progress
+
+/// Show the progress of an export on the console
+class CLIProgress : public WithProgress {
+public:
+  void onProgress(float progress, const String& message) override {
+    int percent = int(progress * 100);
+    if (percent == last_percent || !cli.haveConsole()) return;
+    last_percent = percent;
+    cli << String::Format(_("\r%3d%%"), percent);
+    cli.flush();
+  }
+  ~CLIProgress() {
+    if (last_percent >= 0 && cli.haveConsole()) cli << _("\n");
+  }
+private:
+  int last_percent = -1;
+};
+
+// ----------------------------------------------------------------------------- : Batch export
+
+/// Names of the output directories for the sets in a batch export, one for each set file
+/** Set files with the same name (say a/core.mse-set and b/core.mse-set) would overwrite each other's images,
+ *  so later ones get a number added: core, core-2, core-3, ...
+ *  Names are compared case insensitively, because that is how most file systems compare them.
+ */
+vector<String> batch_export_dir_names(const vector<String>& set_files) {
+  vector<String> names;
+  set<String> used;
+  FOR_EACH_CONST(set_file, set_files) {
+    String base = wxFileName(set_file).GetName();
+    String name = base;
+    for (int i = 2 ; used.count(name.Lower()) ; ++i) {
+      name = String::Format(_("%s-%d"), base, i);
+    }
+    used.insert(name.Lower());
+    names.push_back(name);
+  }
+  return names;
+}
+
+/// Export the card images of many sets, for --export-images-batch
+/** Arguments are: [--out DIR] [--images IMAGE] [--threads N] SETFILE...
+ *  The images of each set go to DIR/<name of set file>/IMAGE, see batch_export_dir_names for sets with the same name.
+ *
+ *  All sets are handled in the same process, so games and stylesheets shared between sets are
+ *  only loaded once (package_manager keeps them open).
+ *  A set that fails to load or export is reported, and the other sets are still exported.
+ *  Returns EXIT_FAILURE if any set failed.
+ */
+int export_images_batch(const vector<String>& args) {
+  String out_dir = _(".");
+  String image_name;
+  vector<String> set_files;
+  long threads = -1;
+  for (size_t i = 1 ; i < args.size() ; ++i) {
+    String const& arg = args[i];
+    if ((arg == _("--out") || arg == _("--images") || arg == _("--threads")) && i + 1 >= args.size()) {
+      throw Error(_("Missing value for ") + arg);
+    } else if (arg == _("--out")) {
+      out_dir = args[++i];
+    } else if (arg == _("--images")) {
+      image_name = args[++i];
+    } else if (arg == _("--threads")) {
+      if (!args[++i].ToLong(&threads) || threads < 0) throw Error(_("Invalid thread count: ") + args[i]);
+    } else {
+      set_files.push_back(arg);
+    }
+  }
+  if (set_files.empty()) {
+    throw Error(_("No input files specified for --export-images-batch"));
+  }
+  if (!wxDirExists(out_dir) && !wxMkdir(out_dir)) {
+    throw Error(_("Unable to create directory: ") + out_dir);
+  }
+  // the thread count only applies to this run, it should not end up in the settings file
+  UInt old_worker_threads = settings.worker_threads;
+  if (threads >= 0) settings.worker_threads = (UInt)threads;
+  // export sets one by one
+  int failed = 0;
+  size_t total_cards = 0;
+  wxStopWatch total_time;
+  vector<String> dir_names = batch_export_dir_names(set_files);
+  for (size_t i = 0 ; i < set_files.size() ; ++i) {
+    const String& set_file = set_files[i];
+    cli << set_file << _("\n");
+    if (dir_names[i] != wxFileName(set_file).GetName()) {
+      cli << _("  another set has the same name, exporting to ") << dir_names[i] << _("\n");
+    }
+    cli.flush();
+    try {
+      wxStopWatch load_time;
+      SetP set = import_set(set_file);
+      long load_ms = load_time.Time();
+      // output directory for this set
+      String path = out_dir + _("/") + dir_names[i];
+      if (!wxDirExists(path) && !wxMkdir(path)) {
+        throw Error(_("Unable to create directory: ") + path);
+      }
+      String out = image_name.empty() ? settings.gameSettingsFor(*set->game).images_export_filename : image_name;
+      wxStopWatch export_time;
+      {
+        CLIProgress progress;
+        export_images(set, set->cards, path + _("/x"), out, CONFLICT_NUMBER_OVERWRITE, &progress);
+      }
+      long export_ms = export_time.Time();
+      total_cards += set->cards.size();
+      cli << String::Format(_("  %d cards, loaded in %ld ms, exported in %ld ms\n"), (int)set->cards.size(), load_ms, export_ms);
+    } catch (const Error& e) {
+      ++failed;
+      handle_error(e);
+      cli.print_pending_errors();
+    }
+    cli.flush();
+  }
+  settings.worker_threads = old_worker_threads;
+  cli << String::Format(_("%d sets, %d cards in %ld ms"), (int)set_files.size(), (int)total_cards, total_time.Time());
+  if (failed) cli << String::Format(_(", %d sets failed"), failed);
+  cli << _("\n");
+  cli.flush();
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 // ----------------------------------------------------------------------------- : Main function/class
 
 /// The application class for MSE.
@@ -191,6 +314,15 @@ int MSE::OnRun() {
           cli << _("\n\n  ") << BRIGHT << _("--export-images") << NORMAL << PARAM << _(" FILE") << NORMAL << _(" [") << PARAM << _("IMAGE") << NORMAL << _("]");
           cli << _("\n         \tExport the cards in a set to image files,");
           cli << _("\n         \tIMAGE is the same format as for 'export all card images'.");
+          cli << _("\n\n  ") << BRIGHT << _("--export-images-batch") << NORMAL << _(" [")
+                             << BRIGHT << _("--out") << NORMAL << PARAM << _(" DIR") << NORMAL << _("] [")
+                             << BRIGHT << _("--images") << NORMAL << PARAM << _(" IMAGE") << NORMAL << _("] [")
+                             << BRIGHT << _("--threads") << NORMAL << PARAM << _(" N") << NORMAL << _("]")
+                             << PARAM << _(" FILE") << NORMAL << _("...");
+          cli << _("\n         \tExport the cards of many sets to image files, in DIR/<set file name>/.");
+          cli << _("\n         \tSets with the same file name get a number added, DIR/<set file name>-2/.");
+          cli << _("\n         \tPackages shared between the sets are only loaded once.");
+          cli << _("\n         \tN is the number of threads used for writing images, 0 for all cores.");
           cli << _("\n\n  ") << BRIGHT << _("--cli") << NORMAL << _(" [")
                              << PARAM << _("FILE") << NORMAL << _("] [")
                              << BRIGHT << _("--quiet") << NORMAL << _("] [")
@@ -251,8 +383,11 @@ int MSE::OnRun() {
             out = out.substr(pos + 1);
           }
           // export
-          export_images(set, set->cards, path, out, CONFLICT_NUMBER_OVERWRITE);
+          CLIProgress progress;
+          export_images(set, set->cards, path, out, CONFLICT_NUMBER_OVERWRITE, &progress);
           return EXIT_SUCCESS;
+        } else if (arg == _("--export-images-batch")) {
+          return export_images_batch(args);
         } else if (args[0] == _("--export")) {
           if (args.size() < 2) {
             throw Error(_("No export template specified for --export"));
@@ -27,23 +27,24 @@ void FontTextElement::draw(RotatedDC& dc, double scale, const RealRect& rect, co
 void FontTextElement::getCharInfo(RotatedDC& dc, double scale, vector<CharInfo>& out) const {
   // font
   dc.SetFont(*font, scale);
-  // find sizes & breaks
-  double prev_width = 0;
+  double height = dc.GetCharHeight();
+  // find sizes & breaks, measuring a line at a time
+  vector<double> advances;
   size_t line_start = start; // start of the current line
-  for (size_t i = start ; i < end ; ++i) {
-    Char c = content.GetChar(i - this->start);
-    if (c == _('\n')) {
-      out.push_back(CharInfo(RealSize(0, dc.GetCharHeight()), break_style, draw_as == DRAW_ACTIVE));
-      line_start = i + 1;
-      prev_width = 0;
-    } else {
-      RealSize s = dc.GetTextExtent(content.substr(line_start - this->start, i - line_start + 1));
+  for (size_t i = start ; i <= end ; ++i) {
+    if (i < end && content.GetChar(i - this->start) != _('\n')) continue;
+    // line from line_start to i
+    dc.GetTextAdvances(content.substr(line_start - this->start, i - line_start), advances);
+    for (size_t j = line_start ; j < i ; ++j) {
       out.push_back(CharInfo(
-                       RealSize(s.width - prev_width, s.height),
-                       c == _(' ') ? LineBreak::SPACE : LineBreak::MAYBE,
+                       RealSize(advances[j - line_start], height),
+                       content.GetChar(j - this->start) == _(' ') ? LineBreak::SPACE : LineBreak::MAYBE,
                        draw_as == DRAW_ACTIVE // from <soft> tag
                    ));
-      prev_width = s.width;
+    }
+    if (i < end) {
+      out.push_back(CharInfo(RealSize(0, height), break_style, draw_as == DRAW_ACTIVE));
+      line_start = i + 1;
     }
   }
 }
@@ -8,7 +8,10 @@
 
 #include <util/prec.hpp>
 #include <render/text/viewer.hpp>
+#include <data/symbol_font.hpp>
+#include <script/profiler.hpp>
 #include <algorithm>
+#include <mutex>
 
 // ----------------------------------------------------------------------------- : Line
 
@@ -64,6 +67,134 @@ size_t TextViewer::Line::posToIndex(double x) const {
   else                      return it2 - positions.begin() + start; // it2 is closer
 }
 
+// ----------------------------------------------------------------------------- : Layout cache
+
+/// Layouts of text computed before, shared between all viewers
+/** Switching between cards and exporting often lays out the same text in the same box again.
+ *  The key contains everything that influences the layout, see layout_cache_key.
+ */
+class LayoutCache {
+public:
+  /// Find a layout, returns false if it is not in the cache
+  bool get(const String& key, vector<TextViewer::Line>& lines, double& scale, TextLayoutP& layout);
+  /// Store a layout
+  void put(const String& key, const vector<TextViewer::Line>& lines, double scale, const TextLayoutP& layout);
+  /// Remove all layouts
+  void clear();
+private:
+  struct Entry {
+    String                   key;
+    vector<TextViewer::Line> lines;
+    double                   scale;
+    TextLayoutP              layout;
+  };
+  typedef list<Entry> Entries;
+  Entries entries; ///< Cached layouts, most recently used first
+  map<String,Entries::iterator> by_key;
+  std::mutex mutex;
+};
+
+const size_t LAYOUT_CACHE_SIZE = 512;
+
+ProfileCounter layout_cache_hits  (_("text layout cache hits"));
+ProfileCounter layout_cache_misses(_("text layout cache misses"));
+
+bool LayoutCache::get(const String& key, vector<TextViewer::Line>& lines, double& scale, TextLayoutP& layout) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = by_key.find(key);
+  if (it == by_key.end()) {
+    ++layout_cache_misses;
+    return false;
+  }
+  entries.splice(entries.begin(), entries, it->second); // now the most recently used
+  ++layout_cache_hits;
+  lines  = it->second->lines;
+  scale  = it->second->scale;
+  layout = it->second->layout;
+  return true;
+}
+
+void LayoutCache::put(const String& key, const vector<TextViewer::Line>& lines, double scale, const TextLayoutP& layout) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (by_key.find(key) != by_key.end()) return;
+  entries.push_front(Entry{key, lines, scale, layout});
+  by_key.insert(make_pair(key, entries.begin()));
+  if (entries.size() > LAYOUT_CACHE_SIZE) {
+    by_key.erase(entries.back().key);
+    entries.pop_back();
+  }
+}
+
+void LayoutCache::clear() {
+  std::lock_guard<std::mutex> lock(mutex);
+  by_key.clear();
+  entries.clear();
+}
+
+LayoutCache& layout_cache() {
+  static LayoutCache cache;
+  return cache;
+}
+
+void TextViewer::clearLayoutCache() {
+  layout_cache().clear();
+}
+
+inline void add_key(String& key, double x) {
+  key += String::Format(_("%.10g|"), x);
+}
+inline void add_key(String& key, const String& x) {
+  key += x;
+  key += _('|');
+}
+
+/// Key for the layout of text in a style and in the box of a dc
+String layout_cache_key(const RotatedDC& dc, const String& text, const TextStyle& style) {
+  String key;
+  // box
+  add_key(key, dc.getInternalSize().width);
+  add_key(key, dc.getInternalSize().height);
+  add_key(key, dc.getZoom());
+  add_key(key, dc.getStretch());
+  add_key(key, dc.getQuality());
+  // line breaks depend on the measured text, see RotatedDC::GetTextAdvances
+  add_key(key, dc.getPPI().x);
+  add_key(key, dc.getPPI().y);
+  // style
+  const Font& font = style.font;
+  add_key(key, font.name);
+  add_key(key, font.italic_name);
+  add_key(key, font.size);
+  add_key(key, font.weight);
+  add_key(key, font.style);
+  add_key(key, font.underline);
+  add_key(key, font.scale_down_to);
+  add_key(key, font.max_stretch);
+  add_key(key, font.flags);
+  const SymbolFontRef& symbol_font = style.symbol_font;
+  add_key(key, symbol_font.name);
+  add_key(key, symbol_font.size);
+  add_key(key, symbol_font.scale_down_to);
+  add_key(key, symbol_font.alignment);
+  add_key(key, String::Format(_("%p"), symbol_font.font.get())); // the cache is cleared when packages are reloaded
+  add_key(key, style.always_symbol);
+  add_key(key, style.allow_formating);
+  add_key(key, style.field().multi_line);
+  add_key(key, style.alignment);
+  add_key(key, style.direction);
+  const Scriptable<double>* params[] = {
+    &style.padding_left,   &style.padding_left_min,   &style.padding_right,  &style.padding_right_min,
+    &style.padding_top,    &style.padding_top_min,    &style.padding_bottom, &style.padding_bottom_min,
+    &style.line_height_soft, &style.line_height_hard, &style.line_height_line,
+    &style.line_height_soft_max, &style.line_height_hard_max, &style.line_height_line_max,
+    &style.paragraph_height
+  };
+  for (const Scriptable<double>* p : params) add_key(key, *p);
+  // text
+  key += text;
+  return key;
+}
+
 // ----------------------------------------------------------------------------- : TextViewer
 
 // can't be declared in header because we need to know sizeof(Line)
@@ -157,7 +288,18 @@ bool TextViewer::prepare(RotatedDC& dc, const String& text, TextStyle& style, Co
   if (!prepared()) {
     // not prepared yet
     prepareElements(text, style, ctx);
+    // Reuse the layout if the same text was laid out in the same box and style before.
+    // Scripted alignment can depend on anything, and masks can change without the style changing, so those are not cached.
+    bool cacheable = !style.alignment.isScripted() && !style.mask.getFromCache().isLoaded();
+    String key;
+    if (cacheable) {
+      key = layout_cache_key(dc, text, style);
+      if (layout_cache().get(key, lines, scale, style.layout)) return true;
+    }
     prepareLines(dc, text, style, ctx);
+    if (cacheable) {
+      layout_cache().put(key, lines, scale, style.layout);
+    }
     return true;
   } else {
     return false;
@@ -442,7 +584,20 @@ inline double bound_on_min_scale(RotatedDC& dc, const TextStyle& style, const ve
   return scale * tot_height / height;
 }
 
+ProfileCounter text_layouts      (_("text layouts"));
+ProfileCounter text_layout_passes(_("text layout passes"));
+
+// sizes of characters at a different scale
+void scale_char_info(const vector<CharInfo>& chars, double scale, vector<CharInfo>& out) {
+  out = chars;
+  FOR_EACH(c, out) {
+    c.size.width  *= scale;
+    c.size.height *= scale;
+  }
+}
+
 void TextViewer::prepareLinesTryScales(RotatedDC& dc, const String& text, const TextStyle& style, vector<CharInfo>& chars) {
+  ++text_layouts;
   // Bounds
   double min_scale = elements.minScale();
   double scale_step = max(0.01,elements.scaleStep());
@@ -454,93 +609,79 @@ void TextViewer::prepareLinesTryScales(RotatedDC& dc, const String& text, const
     return;
   }
   
-  // More complicated fitting
-  double max_scale = 1.0 + scale_step;
-  double best_scale;
-  
-  // Assumption:
-  //    It is likely that the text should have the same scale as the previous render attempt
-  //    So:
-  //       - try that scale first
-  //       - if it fits
-  //           - change min_scale
-  //           - then try the scale just before it
-  //               - if that doesn't fit, we are done
-  //               - if it doesn't, we have just (almost) wasted 1 cycle, start binary search
-  //       - if it doesn't
-  //           - change max_scale  
+  // Measure the text only once, at other scales the sizes of characters are (nearly) proportional to the scale.
+  // So we can search for the scale using just the line breaking.
+  vector<CharInfo> chars_full, chars_try;
+  elements.getCharInfo(dc, 1.0, chars_full);
+  vector<Line> lines_try;
+  auto fits_at = [&](double try_scale) {
+    scale_char_info(chars_full, try_scale, chars_try);
+    return prepareLinesAtScale(dc, chars_try, style, false, lines_try);
+  };
   
-  // Try the layout at the previous scale, this could give a quick upper bound
-  elements.getCharInfo(dc, scale, chars);
-  bool fits = prepareLinesAtScale(dc, chars, style, false, lines);
-  if (fits) {
-    min_scale = scale;
-    max_scale = min(max_scale, bound_on_max_scale(dc,style,lines,scale));
-    // is there a before?
-    if (scale + scale_step >= max_scale) return;
-    // try just before
-    scale += scale_step;
-    vector<Line> lines_before;
-    vector<CharInfo> chars_before;
-    elements.getCharInfo(dc, scale, chars_before);
-    fits = prepareLinesAtScale(dc, chars_before, style, false, lines_before);
-    if (fits) {
-      // too bad
-      swap(lines, lines_before);
-      swap(chars, chars_before);
-      best_scale = min_scale = scale;
-      max_scale = min(max_scale, bound_on_max_scale(dc,style,lines,scale));
-    } else {
-      // yay
-      scale = min_scale;
-      return;
-    }
-  } else {
-    max_scale = scale;
-    min_scale = max(min_scale, bound_on_min_scale(dc,style,lines,scale));
-    // ensure invariant d (below)
-    best_scale = scale = min_scale;
-    chars.clear();
-    elements.getCharInfo(dc, scale, chars);
-    prepareLinesAtScale(dc, chars, style, false, lines);
-    max_scale = min(max_scale, bound_on_max_scale(dc,style,lines,scale));
-  }
-  
-  // The common case optimization failed, try a binary search
   // Invariant:
   //    a. The text fits at min_scale (or we force it anyway)
   //    b. but not at max_scale
-  //    c. 0 < min_scale <= real_scale < max_scale <= 1.0+epsilon
-  //    d. lines and chars give the best fitting positioning, at best_scale
-  //    try: e. min_scale <= best_scale
-    
-  // go binary search!
-  while(min_scale + scale_step < max_scale) {
-    scale = (min_scale + max_scale) / 2;
-    vector<Line> lines_try;
-    vector<CharInfo> chars_try;
-    elements.getCharInfo(dc, scale, chars_try);
-    fits = prepareLinesAtScale(dc, chars_try, style, false, lines_try);
-    if (fits) {
+  double max_scale = 1.0 + scale_step;
+  // It is likely that the text should have the same scale as the previous render attempt,
+  // try that first, it gives a bound on one side that is close to the answer.
+  if (scale > min_scale && scale < max_scale) {
+    if (fits_at(scale)) {
       min_scale = scale;
       max_scale = min(max_scale, bound_on_max_scale(dc,style,lines_try,scale));
-      best_scale = scale; // invariant d
-      swap(lines,lines_try); 
-      swap(chars,chars_try);
+      // try just before
+      if (min_scale + scale_step < max_scale) {
+        if (fits_at(min_scale + scale_step)) {
+          min_scale += scale_step;
+          max_scale = min(max_scale, bound_on_max_scale(dc,style,lines_try,min_scale));
+        } else {
+          max_scale = min_scale + scale_step;
+        }
+      }
     } else {
       max_scale = scale;
       min_scale = max(min_scale, bound_on_min_scale(dc,style,lines_try,scale));
-      // the above can break pseudo invariant e
     }
   }
-  if (best_scale != min_scale) {
-    // we'd better update lines, e doesn't hold
-    scale = min_scale;
+  // binary search
+  while (min_scale + scale_step < max_scale) {
+    double try_scale = (min_scale + max_scale) / 2;
+    if (fits_at(try_scale)) {
+      min_scale = try_scale;
+      max_scale = min(max_scale, bound_on_max_scale(dc,style,lines_try,try_scale));
+    } else {
+      max_scale = try_scale;
+      min_scale = max(min_scale, bound_on_min_scale(dc,style,lines_try,try_scale));
+    }
+  }
+  
+  // Layout at the scale we found, using the real sizes of the characters.
+  // Because of hinting and rounding the text can be slightly wider than predicted, in that case scale down a bit more.
+  auto fits_measured_at = [&](double try_scale) {
     chars.clear();
-    elements.getCharInfo(dc, scale, chars);
-    fits = prepareLinesAtScale(dc, chars, style, false, lines);
+    elements.getCharInfo(dc, try_scale, chars);
+    return prepareLinesAtScale(dc, chars, style, false, lines);
+  };
+  double lowest_scale = elements.minScale();
+  scale = min(1.0, min_scale);
+  if (fits_measured_at(scale) || scale <= lowest_scale) return;
+  // usually one step down is enough
+  scale = max(lowest_scale, scale - scale_step);
+  if (fits_measured_at(scale) || scale <= lowest_scale) return;
+  // otherwise search again using real sizes,
+  // with the same invariant as above: the text fits at min_scale (or we force it anyway), but not at max_scale
+  min_scale = lowest_scale;
+  max_scale = scale;
+  while (min_scale + scale_step < max_scale) {
+    double try_scale = (min_scale + max_scale) / 2;
+    if (fits_measured_at(try_scale)) {
+      min_scale = try_scale;
+    } else {
+      max_scale = try_scale;
+    }
   }
   scale = min_scale;
+  fits_measured_at(scale);
 }
 
 // Try to fit a blank line in the masked image, move down until it fits
@@ -555,6 +696,7 @@ RealSize TextViewer::fitLineWidth(Line& line, RotatedDC& dc, const TextStyle& st
 }
 
 bool TextViewer::prepareLinesAtScale(RotatedDC& dc, const vector<CharInfo>& chars, const TextStyle& style, bool stop_if_too_long, vector<Line>& lines) const {
+  ++text_layout_passes;
   // Try to layout the text at the current scale
   lines.clear();
 
@@ -61,6 +61,9 @@ public:
   void reset(bool related);
   /// Is the viewer prepare()d?
   bool prepared() const;
+  /// Remove all layouts from the cache shared by all viewers
+  /** Should be called when packages are reloaded, since the cache keys refer to symbol fonts by address. */
+  static void clearLayoutCache();
   
   // --------------------------------------------------- : Positions
   
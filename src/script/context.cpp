@@ -34,98 +34,134 @@ void instrTernary(TernaryInstructionType i, ScriptValueP& a, const ScriptValueP&
 void instrQuaternary(QuaternaryInstructionType i, ScriptValueP& a, const ScriptValueP& b, const ScriptValueP& c, const ScriptValueP& d);
 
 
+thread_local int script_evaluation_depth = 0;
+
+/// Marks that a script is being evaluated on this thread
+struct ScriptEvaluationScope {
+  inline ScriptEvaluationScope()  { ++script_evaluation_depth; }
+  inline ~ScriptEvaluationScope() { --script_evaluation_depth; }
+};
+
+// Use computed gotos for dispatching instructions (a GCC extension)
+/* With a single switch all instructions share one indirect jump, which the processor predicts poorly.
+ * With threaded dispatch each instruction jumps directly to the next one.
+ */
+#if !defined(USE_THREADED_DISPATCH)
+  #if defined(__GNUC__)
+    #define USE_THREADED_DISPATCH 1
+  #else
+    #define USE_THREADED_DISPATCH 0
+  #endif
+#endif
+
+// Every instruction is a block followed by VM_NEXT, outside the block.
+// A computed goto out of a block does not run destructors, so it must not jump from inside the block.
+#if USE_THREADED_DISPATCH
+  #define VM_CASE(name) vm_##name
+  #define VM_NEXT       if (instr >= end) goto vm_done; i = *instr++; goto *dispatch[i.instr]
+#else
+  #define VM_CASE(name) case name
+  #define VM_NEXT       break
+#endif
+
 ScriptValueP Context::eval(const Script& script, bool useScope) {
   if (level > 500) {
     throw ScriptError(_("Stack overflow"));
   }
+  ScriptEvaluationScope evaluating;
   
   size_t stack_size = stack.size();
   size_t scope = useScope ? openScope() : 0;
   try {
-    // Instruction pointer
-    const Instruction* instr = &script.instructions[0];
+    // Instruction pointer, into the executable code, which contains superinstructions
+    const Instruction* code  = script.executableCode();
+    const Instruction* instr = code;
     const Instruction* end   = instr + script.instructions.size();
+    Instruction i;
     
+    #if USE_THREADED_DISPATCH
+      static const void* const dispatch[32] = {
+        &&vm_I_NOP,       &&vm_I_PUSH_CONST,    &&vm_I_JUMP,          &&vm_I_JUMP_IF_NOT,
+        &&vm_I_GET_VAR,   &&vm_I_SET_VAR,       &&vm_I_MEMBER_C,      &&vm_I_LOOP,
+        &&vm_I_LOOP_WITH_KEY, &&vm_I_MAKE_OBJECT, &&vm_I_CALL,        &&vm_I_CLOSURE,
+        &&vm_I_TAILCALL,  &&vm_I_UNARY,         &&vm_I_BINARY,        &&vm_I_TERNARY,
+        &&vm_I_QUATERNARY, &&vm_I_DUP,          &&vm_I_POP,           &&vm_I_JUMP_SC_AND,
+        &&vm_I_JUMP_SC_OR, &&vm_I_MEMBER_VAR,   &&vm_I_BINARY_C,      &&vm_I_BINARY_JUMP_IF_NOT,
+        &&vm_I_BINARY_C_JUMP_IF_NOT, &&vm_I_NOP, &&vm_I_NOP,          &&vm_I_NOP,
+        &&vm_I_NOP,       &&vm_I_NOP,           &&vm_I_NOP,           &&vm_I_NOP
+      };
+      VM_NEXT;
+    #else
     // Loop until we are done
     while (instr < end) {
       // Evaluate the current instruction
-      Instruction i = *instr++;
-      // If a scope is created, destroy it at end of block.
-      unique_ptr<LocalScope> new_scope;
-
+      i = *instr++;
       switch (i.instr) {
-        case I_NOP: break;
+    #endif
+        VM_CASE(I_NOP): {
+        } VM_NEXT;
         // Push a constant
-        case I_PUSH_CONST: {
+        VM_CASE(I_PUSH_CONST): {
           stack.push_back(script.constants[i.data]);
-          break;
-        }
+        } VM_NEXT;
         // Jump
-        case I_JUMP: {
-          instr = &script.instructions[0] + i.data;
-          break;
-        }
+        VM_CASE(I_JUMP): {
+          instr = code + i.data;
+        } VM_NEXT;
         // Conditional jump
-        case I_JUMP_IF_NOT: {
+        VM_CASE(I_JUMP_IF_NOT): {
           bool condition = stack.back()->toBool();
           stack.pop_back();
           if (!condition) {
-            instr = &script.instructions[0] + i.data;
+            instr = code + i.data;
           }
-          break;
-        }
+        } VM_NEXT;
         // Short-circuiting and/or = conditional jump without pop
-        case I_JUMP_SC_AND: {
+        VM_CASE(I_JUMP_SC_AND): {
           bool condition = stack.back()->toBool();
           if (!condition) {
-            instr = &script.instructions[0] + i.data;
+            instr = code + i.data;
           } else {
             stack.pop_back();
           }
-          break;
-        }
-        case I_JUMP_SC_OR: {
+        } VM_NEXT;
+        VM_CASE(I_JUMP_SC_OR): {
           bool condition = stack.back()->toBool();
           if (condition) {
-            instr = &script.instructions[0] + i.data;
+            instr = code + i.data;
           } else {
             stack.pop_back();
           }
-          break;
-        }
+        } VM_NEXT;
         
         // Get a variable
-        case I_GET_VAR: {
+        VM_CASE(I_GET_VAR): {
           ScriptValueP value = variables[i.data].value;
           if (!value) throw ScriptErrorNoVariable(variable_to_string((Variable)i.data));
           stack.push_back(value);
-          break;
-        }
+        } VM_NEXT;
         // Set a variable
-        case I_SET_VAR: {
+        VM_CASE(I_SET_VAR): {
           setVariable((Variable)i.data, stack.back());
-          break;
-        }
+        } VM_NEXT;
         
         // Get an object member
-        case I_MEMBER_C: {
+        VM_CASE(I_MEMBER_C): {
           stack.back() = stack.back()->getMember(script.constants[i.data]->toString());
-          break;
-        }
+        } VM_NEXT;
         // Loop over a container, push next value or jump
-        case I_LOOP: {
+        VM_CASE(I_LOOP): {
           ScriptValueP& it = stack[stack.size() - 2]; // second element of stack
           ScriptValueP val = it->next();
           if (val) {
             stack.push_back(val);
           } else {
             stack.erase(stack.end() - 2); // remove iterator
-            instr = &script.instructions[0] + i.data;
+            instr = code + i.data;
           }
-          break;
-        }
+        } VM_NEXT;
         // Loop over a container, push next key;next value or jump
-        case I_LOOP_WITH_KEY: {
+        VM_CASE(I_LOOP_WITH_KEY): {
           ScriptValueP& it = stack[stack.size() - 2]; // second element of stack
           ScriptValueP key;
           ScriptValueP val = it->next(&key);
@@ -134,111 +170,103 @@ ScriptValueP Context::eval(const Script& script, bool useScope) {
             stack.push_back(key);
           } else {
             stack.erase(stack.end() - 2); // remove iterator
-            instr = &script.instructions[0] + i.data;
+            instr = code + i.data;
           }
-          break;
-        }
+        } VM_NEXT;
         // Make an object
-        case I_MAKE_OBJECT: {
+        VM_CASE(I_MAKE_OBJECT): {
           makeObject(i.data);
-          break;
-        }
+        } VM_NEXT;
         
         // Function call
-        case I_CALL:
-          new_scope.reset(new LocalScope(*this)); //new scope
-        case I_TAILCALL: {
-          // prepare arguments
-          for (unsigned int j = 0 ; j < i.data ; ++j) {
-            setVariable((Variable)instr[i.data - j - 1].data, stack.back());
-            stack.pop_back();
-          }
-          instr += i.data; // skip arguments
-          try {
-            #if USE_SCRIPT_PROFILING
-              Timer timer;
-              const Instruction* instr_bt = script.backtraceSkip(instr - i.data - 2, i.data);
-              Variable function = instr_bt && instr_bt->instr == I_GET_VAR
-                                ? (Variable)instr_bt->data
-                                : (Variable)-1;
-              Profiler prof(timer, function);
-            #endif
-            // get function and call.
-            // there is no need to open a new scope for this function, since we already did so for the arguments
-            stack.back() = stack.back()->eval(*this, false);
-            // finish profiling
-            #if USE_SCRIPT_PROFILING
-              //profile_add(function, timer.time());
-              //%timer.exclude_time();
-            #endif
-          } catch (const Error& e) {
-            // try to determine what named function was called
-            // the instructions for this look like:
-            //   I_GET_VAR   name of function
-            //   *code*      arguments
-            //   I_CALL      number of arguments = i.data
-            //   I_NOP * n   arg names
-            //   next        <--- instruction pointer points here
-            // skip the stack effect of the arguments themselfs
-            const Instruction* instr_bt = script.backtraceSkip(instr - i.data - 2, i.data);
-            // have we have reached the name
-            if (instr_bt) {
-              throw ScriptError(_ERROR_2_("in function", e.what(), script.instructionName(instr_bt)));
-            } else {
-              throw e; // rethrow
-            }
-          }
-          break;
-        }
+        VM_CASE(I_CALL): {
+          LocalScope call_scope(*this); // new scope, for the arguments
+          callFunction(script, code, i.data, instr);
+        } VM_NEXT;
+        VM_CASE(I_TAILCALL): {
+          callFunction(script, code, i.data, instr);
+        } VM_NEXT;
         
         // Closure object
-        case I_CLOSURE: {
+        VM_CASE(I_CLOSURE): {
           makeClosure(i.data, instr);
-          break;
-        }
+        } VM_NEXT;
         
         // Simple instruction: unary
-        case I_UNARY: {
+        VM_CASE(I_UNARY): {
           instrUnary(i.instr1, stack.back());
-          break;
-        }
+        } VM_NEXT;
         // Simple instruction: binary
-        case I_BINARY: {
+        VM_CASE(I_BINARY): {
           ScriptValueP  b = stack.back(); stack.pop_back();
           ScriptValueP& a = stack.back();
           instrBinary(i.instr2, a, b);
-          break;
-        }
+        } VM_NEXT;
         // Simple instruction: ternary
-        case I_TERNARY: {
+        VM_CASE(I_TERNARY): {
           ScriptValueP  c = stack.back(); stack.pop_back();
           ScriptValueP  b = stack.back(); stack.pop_back();
           ScriptValueP& a = stack.back();
           instrTernary(i.instr3, a, b, c);
-          break;
-        }
+        } VM_NEXT;
         // Simple instruction: quaternary
-        case I_QUATERNARY: {
+        VM_CASE(I_QUATERNARY): {
           ScriptValueP  d = stack.back(); stack.pop_back();
           ScriptValueP  c = stack.back(); stack.pop_back();
           ScriptValueP  b = stack.back(); stack.pop_back();
           ScriptValueP& a = stack.back();
           instrQuaternary(i.instr4, a, b, c, d);
-          break;
-        }
+        } VM_NEXT;
         // Pop off stack
-        case I_POP: {
+        VM_CASE(I_POP): {
           stack.pop_back();
-          break;
-        }
+        } VM_NEXT;
 
         // Duplicate stack
-        case I_DUP: {
+        VM_CASE(I_DUP): {
           stack.push_back(stack.at(stack.size() - i.data - 1));
-          break;
-        }
+        } VM_NEXT;
+        
+        // Superinstructions, see Script::executableCode
+        // Get a variable, then a member given by the next instruction (I_MEMBER_C)
+        VM_CASE(I_MEMBER_VAR): {
+          const ScriptValueP& value = variables[i.data].value;
+          if (!value) throw ScriptErrorNoVariable(variable_to_string((Variable)i.data));
+          stack.push_back(value->getMember(script.constants[instr->data]->toString()));
+          instr += 1;
+        } VM_NEXT;
+        // Binary instruction given by the next instruction (I_BINARY), with a constant as second argument
+        VM_CASE(I_BINARY_C): {
+          instrBinary(instr->instr2, stack.back(), script.constants[i.data]);
+          instr += 1;
+        } VM_NEXT;
+        // Binary instruction, followed by a conditional jump (I_JUMP_IF_NOT)
+        VM_CASE(I_BINARY_JUMP_IF_NOT): {
+          ScriptValueP b = stack.back(); stack.pop_back();
+          ScriptValueP a = stack.back(); stack.pop_back();
+          instrBinary(i.instr2, a, b);
+          if (!a->toBool()) {
+            instr = code + instr->data;
+          } else {
+            instr += 1;
+          }
+        } VM_NEXT;
+        // Compare with a constant (I_BINARY), followed by a conditional jump (I_JUMP_IF_NOT)
+        VM_CASE(I_BINARY_C_JUMP_IF_NOT): {
+          ScriptValueP a = stack.back(); stack.pop_back();
+          instrBinary(instr[0].instr2, a, script.constants[i.data]);
+          if (!a->toBool()) {
+            instr = code + instr[1].data;
+          } else {
+            instr += 2;
+          }
+        } VM_NEXT;
+    #if USE_THREADED_DISPATCH
+      vm_done:;
+    #else
       }
     }
+    #endif
     
     // Function return
     // restore shadowed variables
@@ -257,6 +285,47 @@ ScriptValueP Context::eval(const Script& script, bool useScope) {
   }
 }
 
+void Context::callFunction(const Script& script, const Instruction* code, unsigned int arg_count, const Instruction*& instr) {
+  // prepare arguments
+  for (unsigned int j = 0 ; j < arg_count ; ++j) {
+    setVariable((Variable)instr[arg_count - j - 1].data, stack.back());
+    stack.pop_back();
+  }
+  instr += arg_count; // skip arguments
+  // position of the call in the original instructions, for backtraces
+  const Instruction* instr_orig = &script.instructions[0] + (instr - code);
+  try {
+    #if USE_SCRIPT_PROFILING
+      Timer timer;
+      Variable function = (Variable)-1;
+      if (profiler_mode() != PROFILER_OFF) {
+        const Instruction* instr_bt = script.backtraceSkip(instr_orig - arg_count - 2, arg_count);
+        if (instr_bt && instr_bt->instr == I_GET_VAR) function = (Variable)instr_bt->data;
+      }
+      Profiler prof(timer, function);
+    #endif
+    // get function and call.
+    // there is no need to open a new scope for this function, since we already did so for the arguments
+    stack.back() = stack.back()->eval(*this, false);
+  } catch (const Error& e) {
+    // try to determine what named function was called
+    // the instructions for this look like:
+    //   I_GET_VAR   name of function
+    //   *code*      arguments
+    //   I_CALL      number of arguments = arg_count
+    //   I_NOP * n   arg names
+    //   next        <--- instruction pointer points here
+    // skip the stack effect of the arguments themselfs
+    const Instruction* instr_bt = script.backtraceSkip(instr_orig - arg_count - 2, arg_count);
+    // have we have reached the name
+    if (instr_bt) {
+      throw ScriptError(_ERROR_2_("in function", e.what(), script.instructionName(instr_bt)));
+    } else {
+      throw e; // rethrow
+    }
+  }
+}
+
 void Context::setVariable(const String& name, const ScriptValueP& value) {
   setVariable(string_to_variable(name), value);
 }
@@ -33,6 +33,17 @@ private:
 
 // ----------------------------------------------------------------------------- : Context
 
+/// Number of nested Context::eval calls on the current thread
+extern thread_local int script_evaluation_depth;
+
+/// Is a script being evaluated on the current thread?
+/** Simple values (numbers, strings) created during evaluation can only be referenced from
+ *  the evaluating thread, so they use a non-atomic reference count, see IntrusivePtrBase::makeThreadLocal.
+ */
+inline bool evaluating_script() {
+  return script_evaluation_depth > 0;
+}
+
 /// Context for script evaluation
 class Context {
 public:
@@ -121,6 +132,8 @@ private:
   void makeObject(size_t n);
   /// Make a closure with n arguments
   void makeClosure(size_t n, const Instruction*& instr);
+  /// Call the function on top of the stack, with arg_count arguments, instr points to the argument names
+  void callFunction(const Script& script, const Instruction* code, unsigned int arg_count, const Instruction*& instr);
   
   /// Get a variable name givin its value, returns (Variable)-1 if not found (slow!)
   Variable lookupVariableValue(const ScriptValueP& value);
@@ -15,7 +15,9 @@
 #include <util/error.hpp>
 #include <data/set.hpp>
 #include <data/card.hpp>
+#include <data/field/text.hpp>
 #include <data/game.hpp>
+#include <data/stylesheet.hpp>
 #include <random>
 
 // ----------------------------------------------------------------------------- : Debugging
@@ -664,18 +666,22 @@ SCRIPT_FUNCTION_WITH_DEP(expand_keywords) {
   SCRIPT_OPTIONAL_PARAM_N_(ScriptValueP, _("condition"), match_condition);
   SCRIPT_OPTIONAL_PARAM_(ScriptValueP, default_expand);
   SCRIPT_PARAM(ScriptValueP, combine);
-  KeywordDatabase& db = set->keyword_db;
-  if (db.empty()) {
-    db.prepare_parameters(set->game->keyword_parameter_types, set->keywords);
-    db.prepare_parameters(set->game->keyword_parameter_types, set->game->keywords);
-    db.add(set->keywords);
-    db.add(set->game->keywords);
-  }
+  KeywordDatabase& db = set->keywordDatabase();
   SCRIPT_OPTIONAL_PARAM_C_(CardP, card);
   try {
     KeywordUsageStatistics* stat = card ? &card->keyword_usage : nullptr;
     Value* stat_key = value_being_updated();
-    SCRIPT_RETURN(db.expand(input, KeywordExpandOptions{match_condition, default_expand, combine, ctx, stat, stat_key}));
+    // remember the expansion in the text value being updated
+    KeywordExpansionMemo* memo = nullptr;
+    if (TextValue* text_value = dynamic_cast<TextValue*>(stat_key)) {
+      if (!text_value->keyword_memo || text_value->keyword_memo->owner != text_value) {
+        text_value->keyword_memo = make_shared<KeywordExpansionMemo>(text_value);
+      }
+      memo = text_value->keyword_memo.get();
+    }
+    StyleSheetP stylesheet = set->stylesheetForP(card);
+    Age memo_valid_since = card ? card->keyword_expansions_valid_since : Age(1);
+    SCRIPT_RETURN(db.expand(input, KeywordExpandOptions{match_condition, default_expand, combine, ctx, stat, stat_key, memo, stylesheet, memo_valid_since}));
   } catch (const Error& e) {
     throw ScriptError(_ERROR_2_("in function", e.what(), _("expand_keywords")));
   }
@@ -689,6 +695,12 @@ SCRIPT_FUNCTION_DEPENDENCIES(expand_keywords) {
   default_expand ->dependencies(ctx,dep);
   combine        ->dependencies(ctx,dep);
   set->game->dependent_scripts_keywords.add(dep); // this depends on the set's keywords
+  // do the keyword scripts look at other cards? then remembered expansions can't be kept when one card changes
+  Dependency test(DEP_DUMMY, false, set);
+  if (match_condition) match_condition->dependencies(ctx,test);
+  default_expand ->dependencies(ctx,test);
+  combine        ->dependencies(ctx,test);
+  if (test.index) set->game->keyword_scripts_use_cards = true;
   return ctx.getVariable(SCRIPT_VAR_input);
 }
 
@@ -33,10 +33,8 @@ public:
     } else {
       while (matches(results, begin, str.end())) {
         Results::const_reference match = results[0];
-        String context_str(str.begin(), match.first); // before
-        context_str += _("<match>");
-        context_str.append(match.second, str.end()); // after
-        if (in_context->matches(context_str)) {
+        // does the context match before + "<match>" + after?
+        if (in_context->matches_in_context(str, match.first, match.second)) {
           return true; // the context matches, done
         }
         if (begin == match.second) {
@@ -57,7 +55,7 @@ ScriptRegexP regex_from_script(const ScriptValueP& value) {
   // is it a regex already?
   ScriptRegexP regex = dynamic_pointer_cast<ScriptRegex>(value);
   if (!regex) {
-    // TODO: introduce some kind of caching?
+    // note: this doesn't recompile the regex if the same code was used before, see RegexCache
     regex = make_intrusive<ScriptRegex>(value->toString());
   }
   return regex;
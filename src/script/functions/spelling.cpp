@@ -59,7 +59,7 @@ SCRIPT_FUNCTION(check_spelling) {
   SCRIPT_PARAM_C(String,language);
   SCRIPT_PARAM_C(String,input);
   assert_tagged(input);
-  if (!settings.stylesheetSettingsFor(*stylesheet).card_spellcheck_enabled)
+  if (!settings.cardSpellcheckEnabledFor(*stylesheet))
     SCRIPT_RETURN(input);
   SCRIPT_OPTIONAL_PARAM_(String, extra_dictionary);
   SCRIPT_OPTIONAL_PARAM_(ScriptValueP, extra_match);
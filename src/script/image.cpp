@@ -19,21 +19,19 @@
 
 Image ScriptableImage::generate(const GeneratedImage::Options& options) const {
   // generate
-  Image image;
   if (isReady()) {
     // note: Don't catch exceptions here, we don't want to return an invalid image.
     //       We could return a blank one, but the thumbnail code does want an invalid
     //       image in case of errors.
     //       This allows the caller to catch errors.
-    image = value->generate(options);
+    return value->generateConformCached(options);
   } else {
     // error, return blank image
     Image i(1,1);
     i.InitAlpha();
     i.SetAlpha(0,0,0);
-    image = i;
+    return conform_image(i, options);
   }
-  return conform_image(image, options);
 }
 
 ImageCombine ScriptableImage::combine() const {
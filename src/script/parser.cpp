@@ -10,6 +10,7 @@
 #include <script/script.hpp>
 #include <script/parser.hpp>
 #include <script/to_value.hpp>
+#include <script/context.hpp>
 #include <util/error.hpp>
 #include <util/tagged_string.hpp>
 #include <util/io/package_manager.hpp> // for "include file" semi hack
@@ -441,6 +442,81 @@ bool expectToken(TokenIterator& input, const Char* expect, const Token* opening
   }
 }
 
+// ----------------------------------------------------------------------------- : Parsing : constant folding
+
+/// Is there a jump to a position in the range [begin,end] of the script?
+bool has_jump_into(Script& script, size_t begin, size_t end) {
+  const vector<Instruction>& instrs = script.getInstructions();
+  for (size_t p = 0 ; p < instrs.size() ; ++p) {
+    const Instruction& i = instrs[p];
+    switch (i.instr) {
+      case I_JUMP: case I_JUMP_IF_NOT: case I_JUMP_SC_AND: case I_JUMP_SC_OR:
+      case I_LOOP: case I_LOOP_WITH_KEY:
+        if (i.data >= begin && i.data <= end) return true;
+        break;
+      case I_CALL: case I_TAILCALL: case I_CLOSURE:
+        p += i.data; // skip argument names
+        break;
+      default:
+        break;
+    }
+  }
+  return false;
+}
+
+/// Is the value a simple constant, that can be used for constant folding?
+bool is_foldable_constant(const ScriptValueP& value) {
+  ScriptType t = value->type();
+  return t == SCRIPT_NIL || t == SCRIPT_INT || t == SCRIPT_BOOL || t == SCRIPT_DOUBLE
+      || t == SCRIPT_STRING || t == SCRIPT_COLOR;
+}
+
+/// Does an operator always give the same result for the same arguments?
+bool is_pure_operator(InstructionType t, unsigned int op) {
+  if (t == I_UNARY)  return op != I_ITERATOR_C; // iterators have state
+  if (t == I_BINARY) return op != I_ITERATOR_R && op != I_MEMBER;
+  return t == I_TERNARY || t == I_QUATERNARY;
+}
+
+/// Add an operator instruction (I_UNARY..I_QUATERNARY) to a script.
+/** If all arguments are constants, then the operator is applied right away,
+ *  so expressions like "a"+"b" or rgb(255,0,0) are not recomputed every time the script is run.
+ */
+void addOperator(Script& script, InstructionType t, unsigned int op) {
+  size_t arity = t == I_UNARY ? 1 : t == I_BINARY ? 2 : t == I_TERNARY ? 3 : t == I_QUATERNARY ? 4 : 0;
+  vector<Instruction>& instrs = script.getInstructions();
+  if (arity > 0 && instrs.size() >= arity && is_pure_operator(t, op)) {
+    size_t first = instrs.size() - arity;
+    bool constant = true;
+    for (size_t p = first ; p < instrs.size() && constant ; ++p) {
+      constant = instrs[p].instr == I_PUSH_CONST && is_foldable_constant(script.getConstants()[instrs[p].data]);
+    }
+    // we can't fold if the code jumps to somewhere between the arguments
+    if (constant && !has_jump_into(script, first + 1, instrs.size())) {
+      Script operation;
+      for (size_t p = first ; p < instrs.size() ; ++p) {
+        operation.addInstruction(I_PUSH_CONST, script.getConstants()[instrs[p].data]);
+      }
+      operation.addInstruction(t, op);
+      try {
+        Context ctx;
+        ScriptValueP result = ctx.eval(operation, false);
+        if (is_foldable_constant(result)) {
+          instrs.resize(first);
+          script.addInstruction(I_PUSH_CONST, result);
+          script.addRemovedInstructions(arity);
+          return;
+        }
+      } catch (const Error&) {
+        // errors should be reported when the script is run
+      }
+    }
+  }
+  script.addInstruction(t, op);
+}
+
+// ----------------------------------------------------------------------------- : Parsing : expressions
+
 ExprType parseExpr(TokenIterator& input, Script& script, Precedence minPrec) {
   Token token = input.read();
   if (token == _("(")) {
@@ -496,6 +572,25 @@ ExprType parseExpr(TokenIterator& input, Script& script, Precedence minPrec) {
     } else if (token == _("if")) {
       // if AAA then BBB else CCC
       parseOper(input, script, PREC_AND);                       // AAA
+      Instruction condition = script.getInstructions().back();
+      if (condition.instr == I_PUSH_CONST && script.getConstants()[condition.data]->type() == SCRIPT_BOOL &&
+          !has_jump_into(script, script.getInstructions().size(), script.getInstructions().size())) {
+        // constant condition, only compile the branch that is taken
+        bool taken = script.getConstants()[condition.data]->toBool();
+        script.getInstructions().pop_back();
+        Script dead_code;
+        expectToken(input, _("then"));                          // then
+        ExprType type1 = parseOper(input, taken ? script : dead_code, PREC_SET); // BBB
+        ExprType type2 = EXPR_STATEMENT;
+        if (input.peek() == _("else")) {                        // else
+          input.read();
+          type2 = parseOper(input, taken ? dead_code : script, PREC_SET); // CCC
+        } else if (!taken) {
+          script.addInstruction(I_PUSH_CONST, script_nil);
+        }
+        script.addRemovedInstructions(3 + dead_code.getInstructions().size()); // condition, two jumps, dead branch
+        return type1 == EXPR_STATEMENT || type2 == EXPR_STATEMENT ? EXPR_STATEMENT : EXPR_OTHER;
+      }
       Addr jmpElse = script.addInstruction(I_JUMP_IF_NOT);      //    jnz lbl_else
       expectToken(input, _("then"));                            // then
       ExprType type1 = parseOper(input, script, PREC_SET);      // BBB
@@ -616,7 +711,7 @@ ExprType parseExpr(TokenIterator& input, Script& script, Precedence minPrec) {
       expectToken(input, _(","));
       parseOper(input, script, PREC_ALL); // b
       expectToken(input, _(")"));
-      script.addInstruction(I_TERNARY, I_RGB);
+      addOperator(script, I_TERNARY, I_RGB);
     } else if (token == _("rgba")) {
       // rgba(r, g, b, a)
       expectToken(input, _("("));
@@ -628,7 +723,7 @@ ExprType parseExpr(TokenIterator& input, Script& script, Precedence minPrec) {
       expectToken(input, _(","));
       parseOper(input, script, PREC_ALL); // a
       expectToken(input, _(")"));
-      script.addInstruction(I_QUATERNARY, I_RGBA);
+      addOperator(script, I_QUATERNARY, I_RGBA);
     } else if (token == _("min") || token == _("max")) {
       // min(x,y,z,...)
       unsigned int op = token == _("min") ? I_MIN : I_MAX;
@@ -637,7 +732,7 @@ ExprType parseExpr(TokenIterator& input, Script& script, Precedence minPrec) {
       while(input.peek() == _(",")) {
         expectToken(input, _(","));
         parseOper(input, script, PREC_ALL); // second, third, etc.
-        script.addInstruction(I_BINARY, op);
+        addOperator(script, I_BINARY, op);
       }
       expectToken(input, _(")"), &token);
     } else if (token == _("assert")) {
@@ -856,7 +951,7 @@ ExprType parseOper(TokenIterator& input, Script& script, Precedence minPrec, Ins
         if (i.instr == I_PUSH_CONST && script.getConstants()[i.data]->toString().empty()) {
           script.getInstructions().pop_back();
         } else {
-          script.addInstruction(I_BINARY, I_ADD);
+          addOperator(script, I_BINARY, I_ADD);
         }
       }
     } else if (minPrec <= PREC_NEWLINE && token.newline) {
@@ -872,7 +967,9 @@ ExprType parseOper(TokenIterator& input, Script& script, Precedence minPrec, Ins
     if (type == EXPR_VAR) type = EXPR_OTHER; // var only applies to single variables, not to things with operators
   }
   // add closing instruction
-  if (closeWith != I_NOP) {
+  if (closeWith == I_UNARY || closeWith == I_BINARY) {
+    addOperator(script, closeWith, closeWithData);
+  } else if (closeWith != I_NOP) {
     script.addInstruction(closeWith, closeWithData);
   }
   return type;
@@ -8,21 +8,130 @@
 
 #include <util/prec.hpp>
 #include <script/profiler.hpp>
+#include <util/error.hpp>
+#include <wx/wfstream.h>
+#include <wx/txtstrm.h>
+#include <thread>
+#include <mutex>
+
+// ----------------------------------------------------------------------------- : Counters
+
+// a function local static, because counters are created during static initialization
+vector<ProfileCounter*>& profile_counters_list() {
+  static vector<ProfileCounter*> counters;
+  return counters;
+}
+
+ProfileCounter::ProfileCounter(const Char* name)
+  : name(name), count(0)
+{
+  profile_counters_list().push_back(this);
+}
+
+const vector<ProfileCounter*>& profile_counters() {
+  return profile_counters_list();
+}
 
 #if USE_SCRIPT_PROFILING
 
-// don't use script profiling in final build
-#ifndef UNICODE
-  #error "It looks like you are building the final release; disable USE_SCRIPT_PROFILING!"
+// ----------------------------------------------------------------------------- : Per thread state
+
+FunctionProfile profile_root(_("root"));
+
+// The profiles of other threads are merged into this profile when the thread ends
+std::mutex      profile_other_threads_mutex;
+FunctionProfile profile_other_threads(_("other threads"));
+
+void profile_merge(FunctionProfile& into, const FunctionProfile& from);
+
+// Static initialization happens in the main thread
+const std::thread::id main_thread_id = std::this_thread::get_id();
+// The function the main thread is in, for the sampling thread
+std::atomic<FunctionProfile*> main_thread_function(&profile_root);
+
+/// The profiling state of a single thread
+/** Each thread has its own profile tree, so profiling doesn't need any locking. */
+struct ThreadProfile {
+  ThreadProfile()
+    : main(std::this_thread::get_id() == main_thread_id)
+    , root(_("thread"))
+    , function(main ? &profile_root : &root)
+  {}
+  ~ThreadProfile() {
+    if (!main) {
+      std::lock_guard<std::mutex> lock(profile_other_threads_mutex);
+      profile_merge(profile_other_threads, root);
+    }
+  }
+  
+  inline FunctionProfile* current() const { return function; }
+  inline void enter(FunctionProfile* f) {
+    function = f;
+    if (main) main_thread_function.store(f, std::memory_order_relaxed);
+  }
+  
+  const bool       main;
+  FunctionProfile  root;     ///< root for threads other than the main thread
+  FunctionProfile* function; ///< function we are in
+};
+
+thread_local ThreadProfile thread_profile;
+
+// ----------------------------------------------------------------------------- : Profiler mode
+
+#ifdef _DEBUG
+  std::atomic<ProfilerMode> profiler_mode_(PROFILER_TIMING);
+#else
+  std::atomic<ProfilerMode> profiler_mode_(PROFILER_OFF);
 #endif
 
-// ----------------------------------------------------------------------------- : Timer
+const ProfileTime SAMPLE_INTERVAL = 1000000; // 1ms
+
+/// Thread that periodically attributes time to the function the main thread is in
+class ProfileSampler {
+public:
+  ~ProfileSampler() { stop(); }
+  
+  void start() {
+    if (thread.joinable()) return;
+    stopping = false;
+    thread = std::thread([this]{ run(); });
+  }
+  void stop() {
+    if (!thread.joinable()) return;
+    stopping = true;
+    thread.join();
+  }
+private:
+  std::thread       thread;
+  std::atomic<bool> stopping;
+  
+  void run() {
+    while (!stopping) {
+      std::this_thread::sleep_for(std::chrono::nanoseconds(SAMPLE_INTERVAL));
+      // FunctionProfiles are never deleted, so we can safely walk up the stack
+      for (FunctionProfile* f = main_thread_function.load(std::memory_order_relaxed) ; f ; f = f->parent) {
+        f->sampled_ticks.fetch_add(SAMPLE_INTERVAL, std::memory_order_relaxed);
+      }
+    }
+  }
+};
+
+ProfileSampler profile_sampler;
 
-Timer::Timer() {
-  start = timer_now() + delta;
+void set_profiler_mode(ProfilerMode mode) {
+  profiler_mode_ = mode;
+  if (mode == PROFILER_SAMPLING) {
+    profile_sampler.start();
+  } else {
+    profile_sampler.stop();
+  }
 }
 
+// ----------------------------------------------------------------------------- : Timer
+
 ProfileTime Timer::time() {
+  if (!running()) return 0;
   ProfileTime end = timer_now() + delta;
   ProfileTime diff = end - start;
   start = end;
@@ -35,14 +144,26 @@ void Timer::exclude_time() {
   start -= delta_delta;
 }
 
-ProfileTime Timer::delta = 0;
+thread_local ProfileTime Timer::delta = 0;
 
 // ----------------------------------------------------------------------------- : FunctionProfile
 
-FunctionProfile profile_root(_("root"));
+FunctionProfile* FunctionProfile::find_child(size_t id) const {
+  FOR_EACH_CONST(c, children) {
+    if (c.first == id) return c.second.get();
+  }
+  return nullptr;
+}
+
+FunctionProfile& FunctionProfile::child(size_t id, const String& name) {
+  FunctionProfile* f = find_child(id);
+  if (f) return *f;
+  children.emplace_back(id, make_intrusive<FunctionProfile>(name, this));
+  return *children.back().second;
+}
 
 inline bool compare_time(const FunctionProfileP& a, const FunctionProfileP& b) {
-  return a->time_ticks < b->time_ticks;
+  return a->ticks() < b->ticks();
 }
 void FunctionProfile::get_children(vector<FunctionProfileP>& out) const {
   FOR_EACH_CONST(c,children) {
@@ -51,24 +172,54 @@ void FunctionProfile::get_children(vector<FunctionProfileP>& out) const {
   sort(out.begin(), out.end(), compare_time);
 }
 
+// add the statistics of one profile to another
+void profile_add(FunctionProfile& into, const FunctionProfile& from) {
+  into.time_ticks     += from.time_ticks;
+  into.time_ticks_max  = max(into.time_ticks_max, from.time_ticks_max);
+  into.calls          += from.calls;
+  into.sampled_ticks.fetch_add(from.sampled_ticks.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+void profile_merge(FunctionProfile& into, const FunctionProfile& from) {
+  FOR_EACH_CONST(c, from.children) {
+    FunctionProfile& fp = into.child(c.first, c.second->name);
+    profile_add(fp, *c.second);
+    profile_merge(fp, *c.second);
+  }
+}
+
 // note: not thread safe
+FunctionProfile profile_all(_("root"));
 FunctionProfile profile_aggr(_("everywhere"));
 
+const FunctionProfile& profile_full() {
+  profile_all.children.clear();
+  profile_merge(profile_all, profile_root);
+  std::lock_guard<std::mutex> lock(profile_other_threads_mutex);
+  if (!profile_other_threads.children.empty()) {
+    // id 0 is not used by any other function
+    FunctionProfile& other = profile_all.child(0, profile_other_threads.name);
+    FOR_EACH_CONST(c, profile_other_threads.children) {
+      profile_add(other, *c.second);
+    }
+    profile_merge(other, profile_other_threads);
+  }
+  return profile_all;
+}
+
 void profile_aggregate(FunctionProfile& parent, int level, int max_level, const FunctionProfile& p);
 void profile_aggregate(FunctionProfile& parent, int level, int max_level, size_t idx, const FunctionProfile& p) {
   // add to item at idx
-  FunctionProfileP& fpp = parent.children[idx];
-  if (!fpp) {
-    fpp = make_intrusive<FunctionProfile>(p.name);
-  }
-  fpp->time_ticks += p.time_ticks;
-  fpp->calls      += p.calls;
+  FunctionProfile& fp = parent.child(idx, p.name);
+  fp.time_ticks += p.time_ticks;
+  fp.calls      += p.calls;
+  fp.sampled_ticks.fetch_add(p.sampled_ticks.load(std::memory_order_relaxed), std::memory_order_relaxed);
   // recurse
   if (level == 0) {
     profile_aggregate(parent, level, max_level, p);
   }
   if (level < max_level) {
-    profile_aggregate(*fpp, level + 1, max_level, p);
+    profile_aggregate(fp, level + 1, max_level, p);
   }
 }
 void profile_aggregate(FunctionProfile& parent, int level, int max_level, const FunctionProfile& p) {
@@ -78,64 +229,127 @@ void profile_aggregate(FunctionProfile& parent, int level, int max_level, const
 }
 
 const FunctionProfile& profile_aggregated(int max_level) {
+  const FunctionProfile& full = profile_full();
   profile_aggr.children.clear();
-  profile_aggregate(profile_aggr, 0, max_level, profile_root);
+  profile_aggregate(profile_aggr, 0, max_level, full);
   return profile_aggr;
 }
 
-// ----------------------------------------------------------------------------- : Profiler
+// ----------------------------------------------------------------------------- : Export
+
+String json_string(const String& str) {
+  String out = _("\"");
+  for (size_t i = 0 ; i < str.size() ; ++i) {
+    Char c = str.GetChar(i);
+    if      (c == _('"'))  out += _("\\\"");
+    else if (c == _('\\')) out += _("\\\\");
+    else if (c < 32)       out += String::Format(_("\\u%04x"), (int)c);
+    else                   out += c;
+  }
+  return out + _("\"");
+}
+
+// Chrome trace events. The profile is aggregated, so the calls to a function are shown as a single event,
+// children are laid out one after another from the start of their parent
+void export_chrome_trace(wxTextOutputStream& out, const FunctionProfile& p, double start, bool& first) {
+  double duration = p.ticks() / 1000.0; // in microseconds
+  if (!first) out << _(",\n");
+  first = false;
+  out << String::Format(_("{\"name\":%s,\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"calls\":%d}}"),
+                        json_string(p.name), start, duration, p.calls);
+  vector<FunctionProfileP> children;
+  p.get_children(children);
+  FOR_EACH_REVERSE(c, children) {
+    export_chrome_trace(out, *c, start, first);
+    start += c->ticks() / 1000.0;
+  }
+}
+
+// Folded stacks: one line per function with the stack and the time spent in the function itself (in microseconds)
+void export_folded(wxTextOutputStream& out, const FunctionProfile& p, const String& stack) {
+  String name = p.name;
+  name.Replace(_(";"), _(":"));
+  String path = stack.empty() ? name : stack + _(";") + name;
+  ProfileTime self = p.ticks();
+  FOR_EACH_CONST(c, p.children) self -= c.second->ticks();
+  if (self > 0) out << path << _(" ") << (long)(self / 1000) << _("\n");
+  FOR_EACH_CONST(c, p.children) {
+    export_folded(out, *c.second, path);
+  }
+}
+
+void export_profile(const FunctionProfile& profile, const String& filename, ProfileFormat format) {
+  wxFileOutputStream file(filename);
+  if (!file.IsOk()) throw Error(_("Unable to write profile to ") + filename);
+  wxTextOutputStream out(file);
+  if (format == PROFILE_CHROME_TRACE) {
+    out << _("{\"traceEvents\":[\n");
+    bool first = true;
+    double start = 0;
+    FOR_EACH_CONST(c, profile.children) {
+      export_chrome_trace(out, *c.second, start, first);
+      start += c.second->ticks() / 1000.0;
+    }
+    out << _("\n],\"displayTimeUnit\":\"ms\"}\n");
+  } else {
+    FOR_EACH_CONST(c, profile.children) {
+      export_folded(out, *c.second, String());
+    }
+  }
+}
 
-FunctionProfile* Profiler::function = &profile_root;
+// ----------------------------------------------------------------------------- : Profiler
 
 // Enter a function
+template <typename MakeName>
+inline FunctionProfile* enter_function(Timer& timer, size_t id, MakeName make_name) {
+  ThreadProfile& thread = thread_profile;
+  FunctionProfile* parent = thread.current();
+  FunctionProfile* function = parent->find_child(id);
+  if (!function) {
+    function = &parent->child(id, make_name());
+  }
+  thread.enter(function);
+  timer.exclude_time();
+  return parent;
+}
+
 Profiler::Profiler(Timer& timer, Variable function_name)
   : timer(timer)
-  , parent(function) // push
+  , parent(nullptr)
 {
-  if ((int)function_name >= 0) {
-    FunctionProfileP& fpp = parent->children[(size_t)function_name << 1 | 1];
-    if (!fpp) {
-      fpp = make_intrusive<FunctionProfile>(variable_to_string(function_name));
-    }
-    function = fpp.get();
-  }
-  timer.exclude_time();
+  if (profiler_mode() == PROFILER_OFF || (int)function_name < 0) return;
+  parent = enter_function(timer, (size_t)function_name << 1 | 1, [function_name]{ return variable_to_string(function_name); });
 }
 
-// Enter a function
 Profiler::Profiler(Timer& timer, const Char* function_name)
   : timer(timer)
-  , parent(function) // push
+  , parent(nullptr)
 {
-  FunctionProfileP& fpp = parent->children[(size_t)function_name];
-  if (!fpp) {
-    fpp = make_intrusive<FunctionProfile>(function_name);
-  }
-  function = fpp.get();
-  timer.exclude_time();
+  if (profiler_mode() == PROFILER_OFF) return;
+  parent = enter_function(timer, (size_t)function_name, [function_name]{ return String(function_name); });
 }
 
-// Enter a function
 Profiler::Profiler(Timer& timer, void* function_object, const String& function_name)
   : timer(timer)
-  , parent(function) // push
+  , parent(nullptr)
 {
-  FunctionProfileP& fpp = parent->children[(size_t)function_object];
-  if (!fpp) {
-    fpp = make_intrusive<FunctionProfile>(function_name);
-  }
-  function = fpp.get();
-  timer.exclude_time();
+  if (profiler_mode() == PROFILER_OFF) return;
+  parent = enter_function(timer, (size_t)function_object, [&function_name]{ return function_name; });
 }
 
 // Leave a function
 Profiler::~Profiler() {
-  ProfileTime time = timer.time();
-  if (function == parent) return; // don't count
-  function->time_ticks += time;
-  function->time_ticks_max = max(function->time_ticks_max,time);
-  function->calls      += 1;
-  function = parent; // pop
+  if (!parent) return; // don't count
+  ThreadProfile& thread = thread_profile;
+  FunctionProfile* function = thread.current();
+  if (timer.running()) {
+    ProfileTime time = timer.time();
+    function->time_ticks += time;
+    function->time_ticks_max = max(function->time_ticks_max,time);
+  }
+  function->calls += 1;
+  thread.enter(parent); // pop
 }
 
 // ----------------------------------------------------------------------------- : EOF
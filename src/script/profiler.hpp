@@ -12,61 +12,94 @@
 #include <script/script.hpp>
 #include <script/context.hpp>
 
-#if !defined(USE_SCRIPT_PROFILING) && defined(_DEBUG)
+#include <atomic>
+
+#include <chrono>
+
+// The profiler is always compiled in, it only does work when it is turned on with set_profiler_mode.
+// Define USE_SCRIPT_PROFILING to 0 to remove it completely.
+#ifndef USE_SCRIPT_PROFILING
 #define USE_SCRIPT_PROFILING 1
 #endif
 
+// ----------------------------------------------------------------------------- : Counters
+
+/// Counts how often something happens, for example cache hits and misses
+/** Counters are cheap and thread safe, so unlike the profiler they are always enabled.
+ *  Counters should be global variables, they are shown together with the profile.
+ */
+class ProfileCounter {
+public:
+  ProfileCounter(const Char* name);
+  
+  inline void operator ++ () { count.fetch_add(1, std::memory_order_relaxed); }
+  inline void operator += (size_t n) { count.fetch_add(n, std::memory_order_relaxed); }
+  inline size_t get() const { return count.load(std::memory_order_relaxed); }
+  
+  const Char* const name;
+private:
+  std::atomic<size_t> count;
+};
+
+/// All counters, in the order they were created
+const vector<ProfileCounter*>& profile_counters();
+
 #if USE_SCRIPT_PROFILING
 
 DECLARE_POINTER_TYPE(FunctionProfile);
 
+// ----------------------------------------------------------------------------- : Profiler mode
+
+enum ProfilerMode
+{ PROFILER_OFF      ///< Don't profile, the profiler has almost no overhead
+, PROFILER_TIMING   ///< Time every profiled function call
+, PROFILER_SAMPLING ///< Periodically sample which function the main thread is in, calls are still counted
+};
+
+extern std::atomic<ProfilerMode> profiler_mode_;
+
+/// What is the profiler currently doing?
+/** By default the profiler is on in debug builds and off in release builds */
+inline ProfilerMode profiler_mode() { return profiler_mode_.load(std::memory_order_relaxed); }
+/// Turn profiling on or off, starts or stops the sampling thread as needed
+void set_profiler_mode(ProfilerMode mode);
+
 // ----------------------------------------------------------------------------- : Timer
 
-#ifdef _MSC_VER
-  typedef LONGLONG ProfileTime;
+/// Time in nanoseconds
+typedef long long ProfileTime;
 
-  inline ProfileTime timer_now() {
-    LARGE_INTEGER i;
-    QueryPerformanceCounter(&i);
-    return i.QuadPart;
-  }
-  inline ProfileTime timer_resolution() {
-    LARGE_INTEGER i;
-    QueryPerformanceFrequency(&i);
-    return i.QuadPart;
-  }
+inline ProfileTime timer_now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+inline ProfileTime timer_resolution() {
+  return 1000000000;
+}
 
+#ifdef _MSC_VER
   inline const char * mangled_name(const type_info& t) {
     return t.raw_name();
   }
 #else
-  // clock() has nanosecond resolution on Linux
-  // on any other platform, stil the best way.
-  typedef clock_t ProfileTime;
-
-  inline ProfileTime timer_now() {
-    return clock();
-  }
-  inline ProfileTime timer_resolution() {
-    return CLOCKS_PER_SEC;
-  }
-
   inline const char * mangled_name(const type_info& t) {
     return t.name();
   }
 #endif
 
 /// Simple execution timer
+/** The timer only reads the clock when the profiler is in PROFILER_TIMING mode. */
 class Timer {
 public:
-  Timer();
+  inline Timer() : start(profiler_mode() == PROFILER_TIMING ? timer_now() + delta : 0) {}
+  /// Is this timer measuring time?
+  inline bool running() const { return start != 0; }
   /// The time the timer has been running, resets the timer
-  inline ProfileTime time();
-  /// Exclude the time since the last reset from ALL running timers
-  inline void exclude_time();
+  ProfileTime time();
+  /// Exclude the time since the last reset from ALL running timers in this thread
+  void exclude_time();
 private:
   ProfileTime start;
-  static ProfileTime delta; ///< Time excluded
+  static thread_local ProfileTime delta; ///< Time excluded
 };
 
 // ----------------------------------------------------------------------------- : FunctionProfile
@@ -74,37 +107,64 @@ private:
 /// How much time was spent in a function?
 class FunctionProfile : public IntrusivePtrBase<FunctionProfile> {
 public:
-  FunctionProfile(const String& name)
-    : name(name), time_ticks(0), time_ticks_max(0), calls(0)
+  FunctionProfile(const String& name, FunctionProfile* parent = nullptr)
+    : name(name), parent(parent), time_ticks(0), time_ticks_max(0), calls(0), sampled_ticks(0)
   {}
 
-  String      name;
-  ProfileTime time_ticks;
-  ProfileTime time_ticks_max;
-  int         calls;
+  String           name;
+  FunctionProfile* parent;
+  ProfileTime      time_ticks;
+  ProfileTime      time_ticks_max;
+  int              calls;
+  /// Time attributed to this function (including its children) by the sampling thread
+  std::atomic<ProfileTime> sampled_ticks;
   
   /// for each id, called children
-  /** we (ab)use the fact that all pointers are even to store both pointers and ids */
-  map<size_t,FunctionProfileP> children;
+  /** we (ab)use the fact that all pointers are even to store both pointers and ids.
+   *  Functions have few distinct children, so a linear search is faster than a map.
+   */
+  vector<pair<size_t,FunctionProfileP>> children;
+
+  /// The child with the given id, or nullptr if it was never called
+  FunctionProfile* find_child(size_t id) const;
+  /// The child with the given id, it is created with the given name if it doesn't exist yet
+  FunctionProfile& child(size_t id, const String& name);
 
   /// The children, sorted by time
   void get_children(vector<FunctionProfileP>& out) const;
 
+  /// Measured plus sampled time
+  inline ProfileTime ticks() const { return time_ticks + sampled_ticks.load(std::memory_order_relaxed); }
   /// Time in seconds
-  inline double total_time() const { return time_ticks / (double)timer_resolution(); }
+  inline double total_time() const { return ticks() / (double)timer_resolution(); }
   inline double avg_time() const { return total_time() / calls; }
   inline double max_time() const { return time_ticks_max / (double)timer_resolution(); }
 };
 
-/// The root profile
+/// The root profile, for functions called from the main thread
+/** Only the main thread may use this profile. */
 extern FunctionProfile profile_root;
 
+/// Return the complete profile, including the functions called from other threads
+/** Must be called from the main thread */
+const FunctionProfile& profile_full();
+
 /// Return a simplified profile, where all things beyond a cerrain level are agragated
+/** Must be called from the main thread */
 const FunctionProfile& profile_aggregated(int level = 1);
 
+enum ProfileFormat
+{ PROFILE_CHROME_TRACE ///< Chrome trace event JSON, for chrome://tracing, Perfetto or speedscope
+, PROFILE_FOLDED       ///< Folded stacks, for flamegraph.pl
+};
+
+/// Write a profile to a file, throws an Error when the file can not be written
+void export_profile(const FunctionProfile& profile, const String& filename, ProfileFormat format);
+
 // ----------------------------------------------------------------------------- : Profiler
 
 /// Profile a single function call
+/** When the profiler is off, this does nothing. */
 class Profiler {
 public:
   /// Log the fact that the function  function_name  is entered, ends when profiler goes out of scope.
@@ -119,18 +179,18 @@ public:
   /// Log the fact that the function is left
   ~Profiler();
 private:
-  Timer&                  timer;
-  static FunctionProfile* function; ///< function we are in
-  FunctionProfile*        parent;
+  Timer&           timer;
+  FunctionProfile* parent; ///< function we were in, or nullptr if we are not profiling this call
 };
 
 // Profile the current function (all following code in the current block) under the given name
 #define PROFILER(name) \
   Timer profile_timer; \
   Profiler profiler(profile_timer, name)
+// Profile under the name of an object, name2 is only evaluated when profiling
 #define PROFILER2(name1,name2) \
   Timer profile_timer; \
-  Profiler profiler(profile_timer, name1,name2)
+  Profiler profiler(profile_timer, name1, profiler_mode() != PROFILER_OFF ? String(name2) : String())
 
 #else // USE_SCRIPT_PROFILING
 
@@ -138,4 +198,3 @@ private:
 #define PROFILER2(a,b)
 
 #endif // USE_SCRIPT_PROFILING
-
@@ -11,6 +11,7 @@
 #include <script/context.hpp>
 #include <script/to_value.hpp>
 #include <util/error.hpp>
+#include <mutex>
 
 // ----------------------------------------------------------------------------- : Variables
 
@@ -19,9 +20,12 @@ Variables variables;
 #ifdef _DEBUG
   vector<String> variable_names;
 #endif
+// Scripts are evaluated from multiple threads, which can all introduce new variable names
+std::mutex variables_mutex;
 
 /// Return a unique name for a variable to allow for faster loopups
 Variable string_to_variable(const String& s) {
+  std::lock_guard<std::mutex> lock(variables_mutex);
   Variables::iterator it = variables.find(s);
   if (it == variables.end()) {
     #ifdef _DEBUG
@@ -40,6 +44,7 @@ Variable string_to_variable(const String& s) {
 /** Warning: this function is slow, it should only be used for error messages and such.
  */
 String variable_to_string(Variable v) {
+  std::lock_guard<std::mutex> lock(variables_mutex);
   FOR_EACH(vi, variables) {
     if (vi.second == v) return replace_all(vi.first, _(" "), _("_"));
   }
@@ -107,6 +112,7 @@ Addr Script::addInstruction(InstructionType t) {
        || t == I_POP);
   Instruction i = {t, {INVALID_ADDRESS}};
   instructions.push_back(i);
+  code_ready = false;
   return Addr{getLabel().addr - 1};
 }
 void Script::addInstruction(InstructionType t, unsigned int d) {
@@ -120,19 +126,24 @@ void Script::addInstruction(InstructionType t, unsigned int d) {
   }*/
   Instruction i = {t, {d}};
   instructions.push_back(i);
+  code_ready = false;
 }
 void Script::addInstruction(InstructionType t, Addr d) {
   addInstruction(t, d.addr);
 }
 void Script::addInstruction(InstructionType t, const ScriptValueP& c) {
+  c->publish(); // scripts can be evaluated from multiple threads
   constants.push_back(c);
   Instruction i = {t, {(unsigned int)constants.size() - 1}};
   instructions.push_back(i);
+  code_ready = false;
 }
 void Script::addInstruction(InstructionType t, const String& s) {
   constants.push_back(to_script(s));
+  constants.back()->publish();
   Instruction i = {t, {(unsigned int)constants.size() - 1}};
   instructions.push_back(i);
+  code_ready = false;
 }
 
 void Script::comeFrom(Addr pos) {
@@ -144,12 +155,71 @@ void Script::comeFrom(Addr pos) {
        || instructions.at(pos.addr).instr == I_LOOP_WITH_KEY);
   assert( instructions.at(pos.addr).data == INVALID_ADDRESS );
   instructions.at(pos.addr).data = (unsigned int)instructions.size();
+  code_ready = false;
 }
 
 Addr Script::getLabel() const {
   return Addr{ (unsigned int)instructions.size() };
 }
 
+// ----------------------------------------------------------------------------- : Superinstructions
+
+const Instruction* Script::executableCode() const {
+  if (!code_ready.load(std::memory_order_acquire)) {
+    makeExecutableCode();
+  }
+  return code.data();
+}
+
+void Script::makeExecutableCode() const {
+  // scripts can be evaluated from multiple threads at once
+  static std::mutex code_mutex;
+  std::lock_guard<std::mutex> lock(code_mutex);
+  if (code_ready.load(std::memory_order_relaxed)) return;
+  code = instructions;
+  // Find jump targets, a superinstruction can't span these
+  vector<bool> jump_target(code.size() + 1, false);
+  for (size_t p = 0 ; p < code.size() ; ++p) {
+    const Instruction& i = code[p];
+    switch (i.instr) {
+      case I_JUMP: case I_JUMP_IF_NOT: case I_JUMP_SC_AND: case I_JUMP_SC_OR:
+      case I_LOOP: case I_LOOP_WITH_KEY:
+        if (i.data < jump_target.size()) jump_target[i.data] = true;
+        break;
+      case I_CALL: case I_TAILCALL: case I_CLOSURE:
+        p += i.data; // skip argument names
+        break;
+      default:
+        break;
+    }
+  }
+  // Is there an instruction of type t at position p that continues a superinstruction?
+  auto continues_with = [&](size_t p, InstructionType t) {
+    return p < code.size() && !jump_target[p] && code[p].instr == t;
+  };
+  // Replace common sequences of instructions.
+  // Only the first instruction of a sequence is changed, the others still provide their data
+  for (size_t p = 0 ; p < code.size() ; ++p) {
+    Instruction& i = code[p];
+    if (i.instr == I_GET_VAR && continues_with(p+1, I_MEMBER_C)) {
+      i.instr = I_MEMBER_VAR;
+      p += 1;
+    } else if (i.instr == I_PUSH_CONST && continues_with(p+1, I_BINARY) && continues_with(p+2, I_JUMP_IF_NOT)) {
+      i.instr = I_BINARY_C_JUMP_IF_NOT;
+      p += 2;
+    } else if (i.instr == I_PUSH_CONST && continues_with(p+1, I_BINARY)) {
+      i.instr = I_BINARY_C;
+      p += 1;
+    } else if (i.instr == I_BINARY && continues_with(p+1, I_JUMP_IF_NOT)) {
+      i.instr = I_BINARY_JUMP_IF_NOT;
+      p += 1;
+    } else if (i.instr == I_CALL || i.instr == I_TAILCALL || i.instr == I_CLOSURE) {
+      p += i.data; // skip argument names
+    }
+  }
+  code_ready.store(true, std::memory_order_release);
+}
+
 #ifdef _DEBUG // debugging
 
 String Script::dumpScript() const {
@@ -159,6 +229,9 @@ String Script::dumpScript() const {
     wxLogDebug(dumpInstr(pos, i));
     ret += dumpInstr(pos++, i) + _("\n");
   }
+  if (removed_instructions > 0) {
+    ret += String::Format(_("; %d instructions removed by constant folding\n"), removed_instructions);
+  }
   return ret;
 }
 
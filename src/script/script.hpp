@@ -10,6 +10,7 @@
 
 #include <util/prec.hpp>
 #include <script/value.hpp>
+#include <atomic>
 
 DECLARE_POINTER_TYPE(Script);
 
@@ -47,6 +48,11 @@ enum InstructionType
 ,  I_QUATERNARY    = 16 ///< arg = 4ary instr : pop 4 values, apply a function, push the result
 ,  I_DUP           = 17 ///< arg = int        : duplicate the k-from-top element of the stack
 ,  I_POP           = 18 ///< arg = *          : pop the top value off the stack.
+  // Superinstructions, only used in Script::executableCode, they combine the instruction with the next one(s)
+,  I_MEMBER_VAR    = 21 ///< arg = var        : I_GET_VAR; I_MEMBER_C
+,  I_BINARY_C      = 22 ///< arg = const val  : I_PUSH_CONST; I_BINARY
+,  I_BINARY_JUMP_IF_NOT   = 23 ///< arg = 2ary instr : I_BINARY; I_JUMP_IF_NOT
+,  I_BINARY_C_JUMP_IF_NOT = 24 ///< arg = const val  : I_PUSH_CONST; I_BINARY; I_JUMP_IF_NOT
 };
 
 /// Types of unary instructions (taking one argument from the stack)
@@ -194,10 +200,13 @@ public:
   Addr getLabel() const;
   
   /// Get access to the vector of instructions
-  inline vector<Instruction>& getInstructions() { return instructions; }
+  inline vector<Instruction>& getInstructions() { code_ready = false; return instructions; }
   /// Get access to the vector of constants
   inline vector<ScriptValueP>& getConstants()   { return constants; }
   
+  /// Note that n instructions were optimized away while compiling this script
+  inline void addRemovedInstructions(size_t n) { removed_instructions += (unsigned int)n; }
+  
   /// Output the instructions in a human readable format
   String dumpScript() const;
   /// Output an instruction in a human readable format
@@ -210,6 +219,19 @@ private:
   vector<Instruction>  instructions;
   /// Constant values that can be referred to from the script
   vector<ScriptValueP> constants;
+  /// Number of instructions removed by constant folding, for dumpScript
+  unsigned int removed_instructions = 0;
+  /// The instructions that are actually executed.
+  /** This is a copy of instructions, where common sequences of instructions are replaced by superinstructions.
+   *  Positions in code and in instructions correspond, so jump targets and backtraces are unaffected.
+   */
+  mutable vector<Instruction> code;
+  mutable std::atomic<bool>   code_ready{false};
+  
+  /// Get the code to execute, constructs it if needed
+  const Instruction* executableCode() const;
+  /// Construct the executable code
+  void makeExecutableCode() const;
   
   /// Do a backtrace for error messages.
   /** Starting from instr, move backwards until the nett stack effect
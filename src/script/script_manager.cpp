@@ -19,7 +19,9 @@
 #include <data/action/set.hpp>
 #include <data/action/value.hpp>
 #include <data/action/keyword.hpp>
+#include <data/settings.hpp>
 #include <util/error.hpp>
+#include <util/parallel.hpp>
 
 // ----------------------------------------------------------------------------- : SetScriptContext : initialization
 
@@ -78,6 +80,8 @@ Context& SetScriptContext::getContext(const CardP& card) {
 
 SetScriptManager::SetScriptManager(Set& set)
   : SetScriptContext(set)
+  , dependency_count(0)
+  , order_changed(true)
   , delay(0)
 {
   // add as an action listener for the set, so we receive actions
@@ -140,6 +144,20 @@ void SetScriptManager::initDependencies(Context& ctx, StyleSheet& stylesheet) {
 // ----------------------------------------------------------------------------- : ScriptManager : updating
 
 void SetScriptManager::onAction(const Action& action, bool undone) {
+  // Remembered keyword expansions (see KeywordExpansionMemo) can depend on the keywords and on any data the scripts read.
+  // Unless the keyword scripts look at other cards, a change to a card value only affects the expansions on that card,
+  // and changes to the card list don't affect any.
+  // Style changes leave them valid, the stylesheet is part of the memo.
+  bool use_cards = set.game->keyword_scripts_use_cards;
+  const ValueAction* value_action = dynamic_cast<const ValueAction*>(&action);
+  if (value_action && value_action->card && !use_cards) {
+    value_action->card->keyword_expansions_valid_since = Age();
+  } else if (dynamic_cast<const CardListAction*>(&action) && !use_cards) {
+    // still valid
+  } else if (!dynamic_cast<const ScriptValueEvent*>(&action) && !dynamic_cast<const ChangeCardStyleAction*>(&action)
+                                                             && !dynamic_cast<const ChangeSetStyleAction*>(&action)) {
+    set.keyword_db.invalidateExpansions();
+  }
   TYPE_CASE(action, ValueAction) {
     if (action.card) {
       updateValue(*action.valueP, action.card);
@@ -180,6 +198,7 @@ void SetScriptManager::onAction(const Action& action, bool undone) {
     // note: fallthrough
   }
   TYPE_CASE_(action, CardListAction) {
+    order_changed = true;
     #ifdef LOG_UPDATES
       wxLogDebug(_("Card dependencies"));
     #endif
@@ -197,9 +216,11 @@ void SetScriptManager::onAction(const Action& action, bool undone) {
     return;
   }
   TYPE_CASE(action, ChangeCardStyleAction) {
+    valueChanged(action.card);
     updateAllDependend(set.game->dependent_scripts_stylesheet, action.card);
   }
   TYPE_CASE_(action, ChangeSetStyleAction) {
+    order_changed = true;
     updateAllDependend(set.game->dependent_scripts_stylesheet);
     return;
   }
@@ -248,13 +269,15 @@ void SetScriptManager::updateDelayed() {
 
 void SetScriptManager::updateValue(Value& value, const CardP& card) {
   Age starting_age; // the start of the update process
-  deque<ToUpdate> to_update;
+  UpdateQueue to_update;
   // execute script for initial changed value
   value.update(getContext(card));
+  valueChanged(card);
   #ifdef LOG_UPDATES
     wxLogDebug(_("Start:     %s"), value.fieldP->name);
   #endif
   // update dependent scripts
+  updateDependencyInfo();
   alsoUpdate(to_update, value.fieldP->dependent_scripts, card);
   updateRecursive(to_update, starting_age);
   #ifdef LOG_UPDATES
@@ -278,89 +301,223 @@ void SetScriptManager::updateAll() {
     }
   }
   // update card data of all cards
-  FOR_EACH(card, set.cards) {
-    Context& ctx = getContext(card);
+  updateAllCards();
+  order_changed = true;
+  // update things that depend on the card list
+  updateAllDependend(set.game->dependent_scripts_cards);
+  #ifdef LOG_UPDATES
+    wxLogDebug(_("-------------------------------\n"));
+  #endif
+}
+
+// Don't bother starting threads unless each of them gets at least this many cards
+const size_t MIN_CARDS_PER_THREAD = 16;
+
+void SetScriptManager::updateAllCards() {
+  size_t thread_count = min(worker_thread_count(), set.cards.size() / MIN_CARDS_PER_THREAD);
+  if (thread_count <= 1) {
+    FOR_EACH(card, set.cards) {
+      Context& ctx = getContext(card);
+      FOR_EACH(v, card->data) {
+        try {
+          PROFILER2(v->fieldP.get(), _("update card.") + v->fieldP->name);
+          v->update(ctx);
+        } catch (const ScriptError& e) {
+          handle_error(ScriptError(e.what() + _("\n  while updating card value '") + v->fieldP->name + _("'")));
+        }
+      }
+    }
+    return;
+  }
+  initWorkerContexts(thread_count);
+  // Fields that depend on the card list use caches in the set (positionOfCard) and the main context,
+  // so they can't be evaluated on a worker thread. They are updated by updateAllDependend afterwards.
+  updateDependencyInfo();
+  parallel_for(set.cards.size(), thread_count, [&](size_t thread, size_t i) {
+    const CardP& card = set.cards[i];
+    Context& ctx = getContextForThread(thread, card);
     FOR_EACH(v, card->data) {
+      if (!card_field_local[v->fieldP->index]) continue;
       try {
-        #if USE_SCRIPT_PROFILING
-          Timer t;
-          Profiler prof(t, v->fieldP.get(), _("update card.") + v->fieldP->name);
-        #endif
+        PROFILER2(v->fieldP.get(), _("update card.") + v->fieldP->name);
         v->update(ctx);
       } catch (const ScriptError& e) {
         handle_error(ScriptError(e.what() + _("\n  while updating card value '") + v->fieldP->name + _("'")));
       }
     }
+  });
+}
+
+void SetScriptManager::initWorkerContexts(size_t thread_count) {
+  // Everything that is lazily initialized must be initialized here on the main thread:
+  // the dependencies of all stylesheets in use, their styling data and settings, and the keyword database.
+  std::set<const StyleSheet*> stylesheets;
+  FOR_EACH(card, set.cards) {
+    StyleSheetP stylesheet = set.stylesheetForP(card);
+    if (stylesheets.insert(stylesheet.get()).second) {
+      getContext(stylesheet);
+      set.stylingDataFor(*stylesheet);
+      settings.stylesheetSettingsFor(*stylesheet); // used by check_spelling
+    }
+  }
+  set.keywordDatabase();
+  // Each worker thread gets its own context, the main thread takes part as thread 0
+  while (worker_contexts.size() + 1 < thread_count) {
+    worker_contexts.push_back(make_unique<SetScriptContext>(set));
+  }
+}
+
+Context& SetScriptManager::getContextForThread(size_t thread, const CardP& card) {
+  if (thread == 0) {
+    return getContext(card);
+  } else {
+    return worker_contexts.at(thread - 1)->getContext(card);
   }
-  // update things that depend on the card list
-  updateAllDependend(set.game->dependent_scripts_cards);
-  #ifdef LOG_UPDATES
-    wxLogDebug(_("-------------------------------\n"));
-  #endif
 }
 
 void SetScriptManager::updateAllDependend(const vector<Dependency>& dependent_scripts, const CardP& card) {
-  deque<ToUpdate> to_update;
+  UpdateQueue to_update;
   Age starting_age;
+  updateDependencyInfo();
   alsoUpdate(to_update, dependent_scripts, card);
   updateRecursive(to_update, starting_age);
 }
 
-void SetScriptManager::updateRecursive(deque<ToUpdate>& to_update, Age starting_age) {
+// ----------------------------------------------------------------------------- : ScriptManager : update queue
+
+void SetScriptManager::UpdateQueue::push(const ToUpdate& u, int rank) {
+  if (scheduled.insert(u.value).second) {
+    waves[rank].push_back(u);
+  }
+}
+
+void SetScriptManager::UpdateQueue::popWave(vector<ToUpdate>& wave) {
+  assert(!waves.empty());
+  wave.clear();
+  swap(wave, waves.begin()->second);
+  waves.erase(waves.begin());
+}
+
+void SetScriptManager::updateRecursive(UpdateQueue& to_update, Age starting_age) {
   if (to_update.empty()) return;
-  set.clearOrderCache(); // clear caches before evaluating a round of scripts
+  // bring the order caches up to date before evaluating a round of scripts
+  if (order_changed) {
+    set.clearOrderCache();
+  } else {
+    set.invalidateOrderCache(changed_cards);
+  }
+  order_changed = false;
+  changed_cards.clear();
+  vector<ToUpdate> wave;
   while (!to_update.empty()) {
-    updateToUpdate(to_update.front(), to_update, starting_age);
-    to_update.pop_front();
+    to_update.popWave(wave);
+    updateWave(wave, to_update, starting_age);
   }
 }
 
-void SetScriptManager::updateToUpdate(const ToUpdate& u, deque<ToUpdate>& to_update, Age starting_age) {
+// Don't bother starting threads unless a wave has at least this many values
+const size_t MIN_VALUES_PER_WAVE = 64;
+
+void SetScriptManager::updateWave(const vector<ToUpdate>& wave, UpdateQueue& to_update, Age starting_age) {
+  size_t thread_count = wave.size() >= MIN_VALUES_PER_WAVE ? worker_thread_count() : 1;
+  // only card values that don't depend on the card list can be updated in another thread
+  if (thread_count > 1) {
+    FOR_EACH_CONST(u, wave) {
+      if (!u.card || !card_field_local[u.value->fieldP->index]) {
+        thread_count = 1;
+        break;
+      }
+    }
+  }
+  if (thread_count <= 1) {
+    FOR_EACH_CONST(u, wave) {
+      if (updateToUpdate(u, getContext(u.card), starting_age)) {
+        onUpdated(u, to_update);
+      }
+    }
+    return;
+  }
+  // group the values by card, values of the same card share data (such as keyword usage statistics),
+  // so they are always updated by the same thread
+  map<const Card*,size_t> group_of_card;
+  vector<vector<size_t>> groups;
+  for (size_t i = 0 ; i < wave.size() ; ++i) {
+    auto it = group_of_card.insert(make_pair(wave[i].card.get(), groups.size()));
+    if (it.second) groups.emplace_back();
+    groups[it.first->second].push_back(i);
+  }
+  // builtins that use shared state (such as check_spelling) must lock it, see initWorkerContexts
+  initWorkerContexts(thread_count);
+  vector<char> changed(wave.size(), false); // note: not vector<bool>, elements are written concurrently
+  parallel_for(groups.size(), thread_count, [&](size_t thread, size_t g) {
+    FOR_EACH_CONST(i, groups[g]) {
+      changed[i] = updateToUpdate(wave[i], getContextForThread(thread, wave[i].card), starting_age);
+    }
+  });
+  // events are sent from the main thread, in the order the values were scheduled
+  for (size_t i = 0 ; i < wave.size() ; ++i) {
+    if (changed[i]) onUpdated(wave[i], to_update);
+  }
+}
+
+bool SetScriptManager::updateToUpdate(const ToUpdate& u, Context& ctx, Age starting_age) {
   Age age = u.value->last_script_update;
-  if (starting_age <= age)  return; // this value was already updated
-  Context& ctx = getContext(u.card);
+  if (starting_age <= age)  return false; // this value was already updated
   bool changes = false;
   try {
     changes = u.value->update(ctx);
   } catch (const ScriptError& e) {
     handle_error(ScriptError(e.what() + _("\n  while updating value '") + u.value->fieldP->name + _("'")));
   }
-  if (changes) {
-    // changed, send event
-    ScriptValueEvent change(u.card.get(), u.value);
-    set.actions.tellListeners(change, false);
-    // u.value has changed, also update values with a dependency on u.value
-    alsoUpdate(to_update, u.value->fieldP->dependent_scripts, u.card);
   #ifdef LOG_UPDATES
-    wxLogDebug(_("Changed: %s"), u.value->fieldP->name);
+    wxLogDebug(changes ? _("Changed: %s") : _("Same:    %s"), u.value->fieldP->name);
   #endif
+  return changes;
+}
+
+void SetScriptManager::onUpdated(const ToUpdate& u, UpdateQueue& to_update) {
+  // changed, send event
+  ScriptValueEvent change(u.card.get(), u.value);
+  set.actions.tellListeners(change, false);
+  valueChanged(u.card);
+  // u.value has changed, also update values with a dependency on u.value
+  alsoUpdate(to_update, u.value->fieldP->dependent_scripts, u.card);
+}
+
+void SetScriptManager::valueChanged(const CardP& card) {
+  if (card) {
+    changed_cards.push_back(card);
+  } else {
+    order_changed = true; // a set value, the order of all cards can depend on it
   }
-  #ifdef LOG_UPDATES
-  else
-    wxLogDebug(_("Same:    %s"), u.value->fieldP->name);
-  #endif
 }
 
-void SetScriptManager::alsoUpdate(deque<ToUpdate>& to_update, const vector<Dependency>& deps, const CardP& card) {
+// rank of a field, or 0 if it is not known (yet)
+inline int field_rank(const vector<int>& ranks, size_t index) {
+  return index < ranks.size() ? ranks[index] : 0;
+}
+
+void SetScriptManager::alsoUpdate(UpdateQueue& to_update, const vector<Dependency>& deps, const CardP& card) {
   FOR_EACH_CONST(d, deps) {
     switch (d.type) {
       case DEP_SET_FIELD: {
         ValueP value = set.data.at(d.index);
-        to_update.push_back(ToUpdate(value.get(), CardP()));
+        to_update.push(ToUpdate(value.get(), CardP()), field_rank(set_field_ranks, d.index));
         break;
       } case DEP_CARD_FIELD: {
         if (card) {
           ValueP value = card->data.at(d.index);
-          to_update.push_back(ToUpdate(value.get(), card));
+          to_update.push(ToUpdate(value.get(), card), field_rank(card_field_ranks, d.index));
           break;
         } else {
           // There is no card, so the update should affect all cards (fall through).
         }
       } case DEP_CARDS_FIELD: {
         // something invalidates a card value for all cards, so all cards need updating
+        int rank = field_rank(card_field_ranks, d.index);
         FOR_EACH(card, set.cards) {
           ValueP value = card->data.at(d.index);
-          to_update.push_back(ToUpdate(value.get(), card));
+          to_update.push(ToUpdate(value.get(), card), rank);
         }
         break;
       } case DEP_CARD_STYLE: {
@@ -380,7 +537,7 @@ void SetScriptManager::alsoUpdate(deque<ToUpdate>& to_update, const vector<Depen
           StyleSheet* stylesheet_card = &set.stylesheetFor(card);
           if (stylesheet == stylesheet_card) {
             ValueP value = card->extra_data.at(d.index);
-            to_update.push_back(ToUpdate(value.get(), card));
+            to_update.push(ToUpdate(value.get(), card), 0);
           }
         }*/
         break;
@@ -399,3 +556,83 @@ void SetScriptManager::alsoUpdate(deque<ToUpdate>& to_update, const vector<Depen
     }
   }
 }
+
+// ----------------------------------------------------------------------------- : ScriptManager : dependency graph
+
+// Find the fields that are updated when a field with the given dependent_scripts changes.
+// Card field i is node i, set field i is node card_fields.size()+i.
+void add_dependent_fields(const Game& game, const vector<Dependency>& deps, std::set<size_t>& out, std::set<const Field*>& copied) {
+  FOR_EACH_CONST(d, deps) {
+    switch (d.type) {
+      case DEP_CARD_FIELD: case DEP_CARDS_FIELD: {
+        out.insert(d.index);
+        break;
+      } case DEP_SET_FIELD: {
+        out.insert(game.card_fields.size() + d.index);
+        break;
+      } case DEP_CARD_COPY_DEP: case DEP_SET_COPY_DEP: {
+        const vector<FieldP>& fields = d.type == DEP_CARD_COPY_DEP ? game.card_fields : game.set_fields;
+        const Field* f = fields.at(d.index).get();
+        if (copied.insert(f).second) {
+          add_dependent_fields(game, f->dependent_scripts, out, copied);
+        }
+        break;
+      } default:
+        break; // styles are invalidated right away, they are not scheduled
+    }
+  }
+}
+
+void SetScriptManager::updateDependencyInfo() {
+  const Game& game = *set.game;
+  // dependencies are only ever added (when a stylesheet is initialized), so counting them is enough to detect changes
+  size_t count = game.dependent_scripts_cards.size();
+  FOR_EACH_CONST(f, game.card_fields) count += f->dependent_scripts.size();
+  FOR_EACH_CONST(f, game.set_fields)  count += f->dependent_scripts.size();
+  if (count == dependency_count && card_field_local.size() == game.card_fields.size()) return;
+  dependency_count = count;
+  // which fields depend on the card list?
+  card_field_local.assign(game.card_fields.size(), true);
+  FOR_EACH_CONST(d, game.dependent_scripts_cards) {
+    if ((d.type == DEP_CARD_FIELD || d.type == DEP_CARDS_FIELD) && d.index < card_field_local.size()) {
+      card_field_local[d.index] = false;
+    }
+  }
+  // build the dependency graph between fields
+  size_t card_count = game.card_fields.size();
+  size_t n = card_count + game.set_fields.size();
+  vector<std::set<size_t>> dependents(n);
+  vector<int> in_degree(n, 0);
+  for (size_t i = 0 ; i < n ; ++i) {
+    const Field& f = i < card_count ? *game.card_fields[i] : *game.set_fields[i - card_count];
+    std::set<const Field*> copied;
+    add_dependent_fields(game, f.dependent_scripts, dependents[i], copied);
+    dependents[i].erase(i); // a value is never updated twice in one round anyway
+    FOR_EACH_CONST(j, dependents[i]) in_degree[j]++;
+  }
+  // topological sort (Kahn's algorithm), the rank of a field is the longest path leading to it
+  vector<int> rank(n, 0);
+  vector<size_t> ready;
+  for (size_t i = 0 ; i < n ; ++i) {
+    if (in_degree[i] == 0) ready.push_back(i);
+  }
+  size_t next_in_cycle = 0;
+  while (true) {
+    while (!ready.empty()) {
+      size_t i = ready.back();
+      ready.pop_back();
+      FOR_EACH_CONST(j, dependents[i]) {
+        if (in_degree[j] <= 0) continue; // edge closing a cycle
+        rank[j] = max(rank[j], rank[i] + 1);
+        if (--in_degree[j] == 0) ready.push_back(j);
+      }
+    }
+    // the remaining fields are on (or after) a cycle, break it by treating one of them as ready
+    while (next_in_cycle < n && in_degree[next_in_cycle] <= 0) ++next_in_cycle;
+    if (next_in_cycle == n) break;
+    in_degree[next_in_cycle] = 0;
+    ready.push_back(next_in_cycle);
+  }
+  card_field_ranks.assign(rank.begin(), rank.begin() + card_count);
+  set_field_ranks .assign(rank.begin() + card_count, rank.end());
+}
@@ -13,7 +13,7 @@
 #include <util/age.hpp>
 #include <script/context.hpp>
 #include <script/dependency.hpp>
-#include <queue>
+#include <unordered_set>
 
 class Set;
 class Value;
@@ -70,12 +70,23 @@ public:
    */
   void updateAll();
   
+  /// Make sure there are contexts for the given number of threads
+  /** Must be called from the main thread, before the contexts are used from other threads. */
+  void initWorkerContexts(size_t thread_count);
+  /// The context to use for a card on a given thread, thread 0 is the main thread
+  Context& getContextForThread(size_t thread, const CardP& card);
+  
 private:
   void onInit(const StyleSheetP& stylesheet, Context& ctx) override;
   
   void initDependencies(Context&, Game&);
   void initDependencies(Context&, StyleSheet&);
   
+  /// Update all card fields of all cards, used by updateAll
+  /** Fields that depend only on their own card are updated in parallel when there are many cards.
+   *  Fields that depend on the card list are left to updateAllDependend.
+   */
+  void updateAllCards();
   /// Update a map of styles
   void updateStyles(Context& ctx, const IndexMap<FieldP,StyleP>& styles, bool only_content_dependent);
   /// Updates scripts, starting at some value
@@ -90,13 +101,53 @@ private:
     Value* value;  ///< value to update
     CardP  card;   ///< card the value is in, or CadP() if it is not a card field
   };
+  
+  /// Values that are waiting to be updated, in dependency order
+  /** Each value is scheduled at most once.
+   *  Values are handed out in waves of the same rank, where a value has a higher rank than all values it depends on.
+   *  So the values in a wave don't depend on each other, and can be updated in any order, or concurrently.
+   */
+  class UpdateQueue {
+  public:
+    /// Schedule a value to be updated, unless it was already scheduled before
+    void push(const ToUpdate& u, int rank);
+    inline bool empty() const { return waves.empty(); }
+    /// Move the values with the lowest rank to wave
+    void popWave(vector<ToUpdate>& wave);
+  private:
+    map<int,vector<ToUpdate>> waves;     ///< Values that still need updating, by rank
+    std::unordered_set<const Value*> scheduled; ///< All values that have been pushed
+  };
+  
   /// Update all things in to_update, and things that depent on them, etc.
   /** Only update things that are older than starting_age. */
-  void updateRecursive(deque<ToUpdate>& to_update, Age starting_age);
-  /// Update a value given by a ToUpdate object, and add things depending on it to to_update
-  void updateToUpdate(const ToUpdate& u, deque<ToUpdate>& to_update, Age starting_age);
+  void updateRecursive(UpdateQueue& to_update, Age starting_age);
+  /// Update all values in a wave, and add things depending on them to to_update
+  void updateWave(const vector<ToUpdate>& wave, UpdateQueue& to_update, Age starting_age);
+  /// Update a value given by a ToUpdate object, return true if it changed
+  bool updateToUpdate(const ToUpdate& u, Context& ctx, Age starting_age);
+  /// A value has changed, send an event and add things depending on it to to_update
+  void onUpdated(const ToUpdate& u, UpdateQueue& to_update);
   /// Schedule all things in deps to be updated by adding them to to_update
-  void alsoUpdate(deque<ToUpdate>& to_update, const vector<Dependency>& deps, const CardP& card);
+  void alsoUpdate(UpdateQueue& to_update, const vector<Dependency>& deps, const CardP& card);
+  
+  /// Recompute card_field_ranks, set_field_ranks and card_field_local if dependencies have been added
+  void updateDependencyInfo();
+  
+  vector<int>  card_field_ranks;  ///< Rank of each card field in the dependency graph
+  vector<int>  set_field_ranks;   ///< Rank of each set field in the dependency graph
+  vector<bool> card_field_local;  ///< Does a card field only depend on its own card (and not on the card list)?
+  size_t       dependency_count;  ///< Number of dependencies used to compute the above
+  
+  /// Cards whose values changed since the start of the last round of updates, for the order cache of the set
+  vector<CardP> changed_cards;
+  /// Has something changed that can affect the order of all cards (such as the card list or set values)?
+  bool          order_changed;
+  /// Note that a value has changed, for the order cache of the set
+  void valueChanged(const CardP& card);
+  
+  /// Contexts for worker threads, worker_contexts[i] belongs to thread i+1, the main thread uses its own context
+  vector<unique_ptr<SetScriptContext>> worker_contexts;
   
   /// Delayed update for (bitmask)...
   enum Delay
@@ -267,10 +267,7 @@ public:
     ScriptValueP d = getDefault(); return d ? d->toImage() : ScriptValue::toImage();
   }
   ScriptValueP getMember(const String& name) const override {
-    #if USE_SCRIPT_PROFILING
-      Timer t;
-      Profiler prof(t, (void*)mangled_name(typeid(T)), _("get member of ") + type_name(*value));
-    #endif
+    PROFILER2((void*)mangled_name(typeid(T)), _("get member of ") + type_name(*value));
     // Use reflection to find the member of the object
     GetMember gm(name);
     gm.handle(*value);
@@ -14,6 +14,7 @@
 #include <gfx/generated_image.hpp>
 #include <util/error.hpp>
 #include <boost/pool/singleton_pool.hpp>
+#include <cmath>
 
 // ----------------------------------------------------------------------------- : ScriptValue
 // Base cases
@@ -218,7 +219,9 @@ ScriptValueP rangeIterator(int start, int end) {
 // Integer values
 class ScriptInt : public ScriptValue {
 public:
-  ScriptInt(int v) : value(v) {}
+  ScriptInt(int v) : value(v) {
+    if (evaluating_script()) makeThreadLocal();
+  }
   ScriptType type() const override { return SCRIPT_INT; }
   String typeName() const override { return _TYPE_("integer"); }
   String toString() const override { return String() << value; }
@@ -241,7 +244,37 @@ private:
   }
 #endif
 
+/// Range of integers (and integral doubles) that are preallocated
+/** Most numbers that scripts compute with are small (counters, indices, lengths),
+ *  by sharing these values arithmetic doesn't have to allocate.
+ */
+const int SMALL_NUMBER_MIN = -256;
+const int SMALL_NUMBER_MAX = 1024;
+
+inline bool is_small_number(int v) {
+  return v >= SMALL_NUMBER_MIN && v <= SMALL_NUMBER_MAX;
+}
+
+/// Preallocated values for small numbers, constructed on first use
+template <typename T>
+const ScriptValueP* small_numbers() {
+  // function local static: to_script can be called during static initialization of other globals
+  static const vector<ScriptValueP> values = [] {
+    vector<ScriptValueP> vs;
+    vs.reserve(SMALL_NUMBER_MAX - SMALL_NUMBER_MIN + 1);
+    for (int i = SMALL_NUMBER_MIN ; i <= SMALL_NUMBER_MAX ; ++i) {
+      vs.push_back(make_intrusive<T>(i));
+      vs.back()->publish(); // shared by all threads
+    }
+    return vs;
+  }();
+  return values.data() - SMALL_NUMBER_MIN;
+}
+
 ScriptValueP to_script(int v) {
+  if (is_small_number(v)) {
+    return small_numbers<ScriptInt>()[v];
+  }
 #if USE_POOL_ALLOCATOR
   #if USE_INTRUSIVE_PTR
     return ScriptValueP(
@@ -284,7 +317,9 @@ ScriptValueP script_false(new ScriptBool(false));
 // Double values
 class ScriptDouble : public ScriptValue {
 public:
-  ScriptDouble(double v) : value(v) {}
+  ScriptDouble(double v) : value(v) {
+    if (evaluating_script()) makeThreadLocal();
+  }
   ScriptType type() const override { return SCRIPT_DOUBLE; }
   String typeName() const override { return _TYPE_("double"); }
   String toString() const override { return String() << value; }
@@ -295,6 +330,13 @@ private:
 };
 
 ScriptValueP to_script(double v) {
+  // integral doubles are common as well (but not -0, which prints differently)
+  if (v >= SMALL_NUMBER_MIN && v <= SMALL_NUMBER_MAX) {
+    int i = (int)v;
+    if (i == v && (i != 0 || !signbit(v))) {
+      return small_numbers<ScriptDouble>()[i];
+    }
+  }
   return make_intrusive<ScriptDouble>(v);
 }
 
@@ -319,7 +361,9 @@ String quote_string(String const& str) {
 // String values
 class ScriptString : public ScriptValue {
 public:
-  ScriptString(const String& v) : value(v) {}
+  ScriptString(const String& v) : value(v) {
+    if (evaluating_script()) makeThreadLocal();
+  }
   ScriptType type() const override { return SCRIPT_STRING; }
   String typeName() const override { return _TYPE_("string") + _(" (\"") + (value.size() < 30 ? value : value.substr(0,30) + _("...")) + _("\")"); }
   String toString() const override { return value; }
@@ -9,6 +9,7 @@
 #include <util/prec.hpp>
 #include <util/io/package.hpp>
 #include <util/io/package_manager.hpp>
+#include <util/io/zip.hpp>
 #include <util/error.hpp>
 #include <script/to_value.hpp> // for reflection
 #include <script/profiler.hpp> // for PROFILER
@@ -22,7 +23,6 @@ IMPLEMENT_DYNAMIC_ARG(Package*, writing_package,   nullptr);
 IMPLEMENT_DYNAMIC_ARG(Package*, clipboard_package, nullptr);
 
 Package::Package()
-  : zipStream (nullptr)
 {}
 
 Package::~Package() {
@@ -84,7 +84,8 @@ void Package::open(const String& n, bool fast) {
 void Package::reopen() {
   if (wxDirExists(filename)) {
     // make sure we have no zip open
-    zipStream.reset();
+    FOR_EACH(f, files) f.second.zipEntry = nullptr;
+    zipArchive.reset();
   } else {
     // reopen only needed for zipfile
     openZipfile();
@@ -128,11 +129,10 @@ void Package::removeTempFiles(bool remove_unused) {
       ++it;
       files.erase(to_remove);
     } else {
-      // free zip entry, we will reopen the file
+      // forget zip entry, we will reopen the file
       it->second.keep = false;
       it->second.tempName.clear();
-      delete it->second.zipEntry; 
-      it->second.zipEntry = 0;
+      it->second.zipEntry = nullptr;
       ++it;
     }
   }
@@ -156,7 +156,8 @@ protected:
 };
 
 /// Class that is a wxZipInputStream over a wxFileInput stream
-/** Note that wxFileInputStream is also a base class, because it must be constructed first
+/** Note that wxFileInputStream is also a base class, because it must be constructed first.
+ *  Only used for copying entries when saving, reading is done with ZipArchive.
  */
 class ZipFileInputStream : private FileInputStream_aux, public wxZipInputStream {
 public:
@@ -164,11 +165,6 @@ public:
     : FileInputStream_aux(filename)
     , wxZipInputStream(file_stream)
   {}
-  ZipFileInputStream(const String& filename, wxZipEntry* entry)
-    : ZipFileInputStream(filename)
-  {
-    OpenEntry(*entry);
-  }
 };
 
 /// A buffered version of wxFileInputStream
@@ -206,9 +202,9 @@ unique_ptr<wxInputStream> Package::openIn(const String& file) {
   } else if (wxFileExists(filename+_("/")+file)) {
     // a file in directory package
     stream = make_unique<wxFileInputStream>(filename+_("/")+file);
-  } else if (wxFileExists(filename) && it != files.end() && it->second.zipEntry) {
+  } else if (zipArchive && it != files.end() && it->second.zipEntry) {
     // a file in a zip archive
-    stream = make_unique<ZipFileInputStream>(filename, it->second.zipEntry);
+    stream = zipArchive->openEntry(*it->second.zipEntry);
   } else {
     // shouldn't happen, packaged changed by someone else since opening it
     throw FileNotFoundError(file, filename);
@@ -350,19 +346,12 @@ Package::FileInfo::FileInfo()
   : keep(false), created(false), zipEntry(nullptr)
 {}
 
-Package::FileInfo::~FileInfo() {
-  delete zipEntry;
-}
-
-void Package::loadZipStream() {
+void Package::loadZipArchive() {
   files.clear();
-  while (true) {
-    wxZipEntry* entry = zipStream->GetNextEntry();
-    if (!entry) break;
-    String name = normalize_internal_filename(entry->GetName(wxPATH_UNIX));
-    files[name].zipEntry = entry;
+  FOR_EACH_CONST(entry, zipArchive->getEntries()) {
+    String name = normalize_internal_filename(entry.name);
+    files[name].zipEntry = &entry;
   }
-  zipStream->CloseEntry();
 }
 
 void Package::openDirectory(bool fast) {
@@ -392,11 +381,9 @@ void Package::openSubdir(const String& name) {
 }
 
 void Package::openZipfile() {
-  // open stream
-  zipStream = make_unique<ZipFileInputStream>(filename);
-  if (!zipStream->IsOk())  throw PackageError(_ERROR_1_("package not found", filename));
-  // read zip entries
-  loadZipStream();
+  // read the central directory
+  zipArchive = make_shared<ZipArchive>(filename);
+  loadZipArchive();
 }
 
 void Package::saveToDirectory(const String& saveAs, bool remove_unused, bool is_copy) {
@@ -444,6 +431,10 @@ void Package::saveToDirectory(const String& saveAs, bool remove_unused, bool is_
 }
 
 void Package::saveToZipfile(const String& saveAs, bool remove_unused, bool is_copy) {
+  // when saving to the same file, try to only append the changes
+  if (!is_copy && saveAs == filename && appendToZipfile(remove_unused)) {
+    return;
+  }
   // create a temporary zip file name
   String tempFile = saveAs + _(".tmp");
   remove_file(tempFile);
@@ -453,17 +444,27 @@ void Package::saveToZipfile(const String& saveAs, bool remove_unused, bool is_co
     if (!newFile->IsOk()) throw PackageError(_ERROR_("unable to open output file"));
     unique_ptr<wxZipOutputStream>  newZip(new wxZipOutputStream(*newFile));
     if (!newZip->IsOk())  throw PackageError(_ERROR_("unable to open output file"));
+    // Entries that are not changed are copied without recompressing them.
+    // That needs a wxZipInputStream and its wxZipEntries, so we only enumerate those when saving.
+    unique_ptr<ZipFileInputStream> oldZip;
+    map<String, unique_ptr<wxZipEntry>> oldEntries;
+    if (zipArchive) {
+      oldZip = make_unique<ZipFileInputStream>(zipArchive->getFilename());
+      if (!oldZip->IsOk()) throw PackageError(_ERROR_1_("package not found", zipArchive->getFilename()));
+      while (wxZipEntry* entry = oldZip->GetNextEntry()) {
+        oldEntries[normalize_internal_filename(entry->GetName(wxPATH_UNIX))].reset(entry);
+      }
+      oldZip->CloseEntry();
+      newZip->CopyArchiveMetaData(*oldZip);
+    }
     // copy everything to a new zip file, unless it's updated or removed
-    if (zipStream) newZip->CopyArchiveMetaData(*zipStream);
     FOR_EACH(f, files) {
+      auto old_entry = f.second.zipEntry && !f.second.wasWritten() ? oldEntries.find(f.first) : oldEntries.end();
       if (!f.second.keep && remove_unused) {
         // to remove a file simply don't copy it
-      } else if (!is_copy && f.second.zipEntry && !f.second.wasWritten()) {
+      } else if (old_entry != oldEntries.end() && old_entry->second) {
         // old file, was also in zip, not changed
-        // can't do this when saving a copy, since it destroys the zip entry
-        zipStream->CloseEntry();
-        newZip->CopyEntry(f.second.zipEntry, *zipStream);
-        f.second.zipEntry = 0;
+        newZip->CopyEntry(old_entry->second.release(), *oldZip);
       } else {
         // changed file, or the old package was not a zipfile
         newZip->PutNextEntry(f.first);
@@ -472,8 +473,10 @@ void Package::saveToZipfile(const String& saveAs, bool remove_unused, bool is_co
       }
     }
     // close the old file
+    oldZip.reset();
     if (!is_copy) {
-      zipStream.reset();
+      FOR_EACH(f, files) f.second.zipEntry = nullptr;
+      zipArchive.reset();
     }
   } catch (Error const& e) {
     // when things go wrong delete the temp file
@@ -492,6 +495,49 @@ void Package::saveToZipfile(const String& saveAs, bool remove_unused, bool is_co
   openZipfile();
 }
 
+/// Fraction of an appended zip file that may be taken up by old data, before we write a new file
+const double ZIP_MAX_DEAD_FRACTION = 0.25;
+
+/// Save changes by appending them to the zip file, return false if this is not possible.
+/** In that case the zip file is unchanged.
+ *  The old data is never overwritten, so the .bak file is not updated, it keeps the version of the last full save.
+ *  Copying it would make every save take time proportional to the size of the package.
+ *  Instead, if appending fails the file is truncated to its old length, restoring the old end record.
+ *  If the program stops in the middle of an append, the old end record is found again when the file is opened.
+ */
+bool Package::appendToZipfile(bool remove_unused) {
+  if (!zipArchive || !ZipAppender::canAppend(*zipArchive)) return false;
+  // how much of the file would be dead space after saving?
+  wxFileOffset live = 0;
+  FOR_EACH_CONST(f, files) {
+    if (f.second.zipEntry && !f.second.wasWritten() && (f.second.keep || !remove_unused)) {
+      live += f.second.zipEntry->storedSize();
+    }
+  }
+  wxFileOffset dead = zipArchive->getFileSize() - live;
+  if (dead > zipArchive->getFileSize() * ZIP_MAX_DEAD_FRACTION) return false;
+  // append
+  try {
+    ZipAppender zip(*zipArchive);
+    FOR_EACH(f, files) {
+      if (!f.second.keep && remove_unused) {
+        // to remove a file simply leave it out of the central directory
+      } else if (f.second.zipEntry && !f.second.wasWritten()) {
+        // old file, not changed, the data stays where it is
+        zip.keepEntry(*f.second.zipEntry);
+      } else {
+        // changed or new file
+        auto temp_stream = openIn(f.first);
+        zip.addEntry(f.first, *temp_stream);
+      }
+    }
+    zip.commit();
+  } catch (const PackageError&) {
+    // the appender has restored the old file, a full save might still work
+    return false;
+  }
+  return true;
+}
 
 Package::FileInfos::iterator Package::addFile(const String& name) {
   return files.insert(make_pair(normalize_internal_filename(name), FileInfo())).first;
@@ -501,7 +547,7 @@ DateTime Package::modificationTime(const pair<String, FileInfo>& fi) const {
   if (fi.second.wasWritten()) {
     return wxFileName(fi.first).GetModificationTime();
   } else if (fi.second.zipEntry) {
-    return fi.second.zipEntry->GetDateTime();
+    return fi.second.zipEntry->dateTime();
   } else if (wxFileExists(filename+_("/")+fi.first)) {
     return wxFileName(filename+_("/")+fi.first).GetModificationTime();
   } else {
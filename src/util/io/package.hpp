@@ -16,8 +16,8 @@
 
 class Package;
 class wxFileInputStream;
-class wxZipInputStream;
-class wxZipEntry;
+struct ZipEntryInfo;
+DECLARE_SHARED_POINTER_TYPE(ZipArchive);
 DECLARE_POINTER_TYPE(PackageDependency);
 
 /// The package that is currently being written to
@@ -70,13 +70,12 @@ private:
  *  To accomplish this modified files are first written to temporary files, when save() is called
  *  the temporary files are moved/copied.
  *
- *  Zip files are accessed using wxZip(Input|Output)Stream.
- *  The zip input stream appears to only allow one file at a time, since the stream itself maintains
- *  state about what file we are reading.
- *  There are multiple solutions:
- *    1. (currently used) Open a new ZipInputStream for each file
- *    2. (may be faster) First read the file into a memory buffer,
- *      return a stream based on that buffer (StringInputStream).
+ *  Zip files are read using a ZipArchive, which only reads the central directory when opening
+ *  the package. Files in the package are then read directly at their offset,
+ *  all using the same file handle.
+ *  When a zip file is saved in place, only the changed files and a new central directory are appended
+ *  to the end of the file (see ZipAppender). Once too much of the file is taken up by old data,
+ *  or when saving to a different file, a new zip file is written using wxZipOutputStream.
  *
  *  TODO: maybe support sub packages (a package inside another package)?
  */
@@ -194,11 +193,10 @@ protected:
   /// Information about a file in the package
   struct FileInfo {
     FileInfo();
-    ~FileInfo();
     bool keep;               ///< Should this file be kept in the package? (as opposed to deleting it)
     bool created;            ///< Was this file just created (e.g. should the VCS add it?)
     String tempName;         ///< Name of the temporary file where new contents of this file are placed
-    wxZipEntry* zipEntry;    ///< Entry in the zip file for this file
+    const ZipEntryInfo* zipEntry; ///< Entry in the zip file for this file, owned by zipArchive
     /// Is this file changed, and therefore written to a temporary file?
     inline bool wasWritten() const { return !tempName.empty(); }
   };
@@ -217,10 +215,10 @@ public:
 private:
   /// All files in the package
   FileInfos files;
-  /// Filestream/zipstream for reading zip files
-  unique_ptr<wxZipInputStream> zipStream;
+  /// Index of the zip file we are reading from
+  ZipArchiveP zipArchive;
 
-  void loadZipStream();
+  void loadZipArchive();
   void openDirectory(bool fast = false);
   void openSubdir(const String&);
   void openZipfile();
@@ -228,6 +226,7 @@ private:
   void removeTempFiles(bool remove_unused);
   void clearKeepFlag();
   void saveToZipfile(const String&,   bool remove_unused, bool is_copy);
+  bool appendToZipfile(bool remove_unused);
   void saveToDirectory(const String&, bool remove_unused, bool is_copy);
   FileInfos::iterator addFile(const String& file);
 
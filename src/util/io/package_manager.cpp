@@ -15,6 +15,8 @@
 #include <data/symbol_font.hpp>
 #include <data/locale.hpp>
 #include <data/export_template.hpp>
+#include <gfx/generated_image.hpp>
+#include <render/text/viewer.hpp>
 #include <data/installer.hpp>
 #include <wx/stdpaths.h>
 #include <wx/wfstream.h>
@@ -34,9 +36,13 @@ void PackageManager::init() {
 }
 void PackageManager::destroy() {
   loaded_packages.clear();
+  GeneratedImage::clearCache();
+  TextViewer::clearLayoutCache();
 }
 void PackageManager::reset() {
   loaded_packages.clear();
+  GeneratedImage::clearCache(); // cached images refer to the packages by address
+  TextViewer::clearLayoutCache(); // and so do cached text layouts, through their symbol font
 }
 
 PackagedP PackageManager::openAny(const String& name_, bool just_header) {
@@ -0,0 +1,442 @@
+//+----------------------------------------------------------------------------+
+//| Description:  Magic Set Editor - Program to make Magic (tm) cards          |
+//| Copyright:    (C) Twan van Laarhoven and the other MSE developers          |
+//| License:      GNU General Public License 2 or later (see file COPYING)     |
+//+----------------------------------------------------------------------------+
+
+// ----------------------------------------------------------------------------- : Includes
+
+#include <util/prec.hpp>
+#include <util/io/zip.hpp>
+#include <util/error.hpp>
+#include <wx/zstream.h>
+#include <wx/wfstream.h>
+#if defined(__WXMSW__)
+  #include <io.h>
+#else
+  #include <unistd.h>
+#endif
+
+// ----------------------------------------------------------------------------- : Zip format
+
+// Signatures of the records we use
+const UInt ZIP_LOCAL_HEADER       = 0x04034b50;
+const UInt ZIP_CENTRAL_HEADER     = 0x02014b50;
+const UInt ZIP_END_RECORD         = 0x06054b50;
+const UInt ZIP64_END_RECORD       = 0x06064b50;
+const UInt ZIP64_END_LOCATOR      = 0x07064b50;
+// Sizes of the fixed parts of the records
+const size_t ZIP_LOCAL_HEADER_SIZE   = 30;
+const size_t ZIP_CENTRAL_HEADER_SIZE = 46;
+const size_t ZIP_END_RECORD_SIZE     = 22;
+const size_t ZIP64_END_RECORD_SIZE   = 56;
+const size_t ZIP64_END_LOCATOR_SIZE  = 20;
+const size_t ZIP_MAX_COMMENT_SIZE    = 0xFFFF;
+const size_t ZIP_SEARCH_BLOCK_SIZE   = 0x10000;
+const size_t ZIP_DATA_DESCRIPTOR_SIZE = 16;
+// Flags
+const UInt ZIP_FLAG_DATA_DESCRIPTOR = 0x0008;
+const UInt ZIP_FLAG_UTF8          = 0x0800;
+// Largest values that fit in the non-zip64 records
+const wxFileOffset ZIP_MAX_OFFSET  = 0xFFFFFFFE;
+const size_t       ZIP_MAX_ENTRIES = 0xFFFE;
+
+inline UInt read16(const unsigned char* p) {
+  return p[0] | (p[1] << 8);
+}
+inline UInt read32(const unsigned char* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((UInt)p[3] << 24);
+}
+inline wxFileOffset read64(const unsigned char* p) {
+  return (wxFileOffset)((unsigned long long)read32(p) | ((unsigned long long)read32(p+4) << 32));
+}
+inline void write16(unsigned char* p, UInt x) {
+  p[0] = (unsigned char)x;
+  p[1] = (unsigned char)(x >> 8);
+}
+inline void write32(unsigned char* p, UInt x) {
+  write16(p, x & 0xFFFF);
+  write16(p + 2, x >> 16);
+}
+
+/// CRC-32 as used by zip files, continuing from a previous crc
+UInt zip_crc32(UInt crc, const unsigned char* data, size_t size) {
+  static const vector<UInt> table = [] {
+    vector<UInt> table(256);
+    for (UInt i = 0 ; i < 256 ; ++i) {
+      UInt c = i;
+      for (int k = 0 ; k < 8 ; ++k) c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+      table[i] = c;
+    }
+    return table;
+  }();
+  crc = ~crc;
+  for (size_t i = 0 ; i < size ; ++i) {
+    crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+DateTime ZipEntryInfo::dateTime() const {
+  DateTime t;
+  t.SetFromDOS(dos_time);
+  return t;
+}
+
+wxFileOffset ZipEntryInfo::storedSize() const {
+  // assume that the local header has the same name and extra field as the central directory record
+  return compressed_size + ZIP_LOCAL_HEADER_SIZE
+       + (central_record.size() - ZIP_CENTRAL_HEADER_SIZE - read16(&central_record[32]))
+       + ((flags & ZIP_FLAG_DATA_DESCRIPTOR) ? ZIP_DATA_DESCRIPTOR_SIZE : 0);
+}
+
+// ----------------------------------------------------------------------------- : Streams
+
+/// Stream for reading a range of bytes from a zip archive
+/** Large reads go directly into the caller's buffer,
+ *  small reads (such as GetC() from read_utf8_line) are served from a buffer.
+ */
+class ZipRangeInputStream : public wxInputStream {
+public:
+  ZipRangeInputStream(const ZipArchiveP& archive, wxFileOffset start, wxFileOffset size)
+    : archive(archive), start(start), size(size), pos(0)
+    , buffer_start(0), buffer_size(0)
+  {}
+
+  wxFileOffset GetLength() const override { return size; }
+  bool IsSeekable() const override { return true; }
+
+protected:
+  size_t OnSysRead(void* out, size_t count) override {
+    wxFileOffset remaining = size - pos;
+    if (remaining <= 0) {
+      m_lasterror = wxSTREAM_EOF;
+      return 0;
+    }
+    if ((wxFileOffset)count > remaining) count = (size_t)remaining;
+    size_t read;
+    if (pos >= buffer_start && pos + (wxFileOffset)count <= buffer_start + (wxFileOffset)buffer_size) {
+      // in the buffer
+      memcpy(out, buffer.get() + (pos - buffer_start), count);
+      read = count;
+    } else if (count >= BUFFER_SIZE) {
+      // large read, don't bother copying
+      read = archive->readAt(start + pos, out, count);
+    } else {
+      // refill buffer
+      if (!buffer) buffer = make_unique<char[]>(BUFFER_SIZE);
+      buffer_start = pos;
+      buffer_size  = archive->readAt(start + pos, buffer.get(), (size_t)min((wxFileOffset)BUFFER_SIZE, remaining));
+      read = min(count, buffer_size);
+      memcpy(out, buffer.get(), read);
+    }
+    if (read < count) m_lasterror = wxSTREAM_READ_ERROR;
+    pos += read;
+    return read;
+  }
+  wxFileOffset OnSysSeek(wxFileOffset offset, wxSeekMode mode) override {
+    wxFileOffset new_pos = mode == wxFromStart   ? offset
+                         : mode == wxFromCurrent ? pos + offset
+                         :                         size + offset;
+    if (new_pos < 0 || new_pos > size) return wxInvalidOffset;
+    pos = new_pos;
+    return pos;
+  }
+  wxFileOffset OnSysTell() const override { return pos; }
+
+private:
+  static const size_t BUFFER_SIZE = 16384;
+  ZipArchiveP  archive; ///< keep the archive (and its file handle) alive
+  wxFileOffset start, size, pos;
+  unique_ptr<char[]> buffer;
+  wxFileOffset buffer_start;
+  size_t       buffer_size;
+};
+
+/// Stream for reading a deflated entry from a zip archive
+class ZipInflateInputStream : public wxZlibInputStream {
+public:
+  ZipInflateInputStream(wxInputStream* compressed, wxFileOffset size)
+    : wxZlibInputStream(compressed, wxZLIB_NO_HEADER) // takes ownership of compressed
+    , size(size)
+  {}
+  wxFileOffset GetLength() const override { return size; }
+private:
+  wxFileOffset size;
+};
+
+// ----------------------------------------------------------------------------- : ZipArchive
+
+ZipArchive::ZipArchive(const String& filename)
+  : filename(filename)
+  , file_size(0)
+  , simple_layout(false)
+{
+  if (!wxFileExists(filename) || !file.Open(filename)) {
+    throw PackageError(_ERROR_1_("package not found", filename));
+  }
+  file_size = file.Length();
+  readCentralDirectory();
+}
+
+size_t ZipArchive::readAt(wxFileOffset pos, void* buffer, size_t size) {
+  std::lock_guard<std::mutex> lock(file_mutex);
+  if (file.Seek(pos) == wxInvalidOffset) return 0;
+  ssize_t read = file.Read(buffer, size);
+  return read == wxInvalidOffset ? 0 : (size_t)read;
+}
+
+void ZipArchive::readCentralDirectory() {
+  auto corrupt = [this]() { return PackageError(_ERROR_1_("package not found", filename)); };
+  // find the end of central directory record, it is followed only by the archive comment
+  size_t tail_size = (size_t)min(file_size, (wxFileOffset)(ZIP_END_RECORD_SIZE + ZIP_MAX_COMMENT_SIZE));
+  wxFileOffset tail_start = file_size - tail_size;
+  vector<unsigned char> buffer(tail_size);
+  if (tail_size < ZIP_END_RECORD_SIZE || readAt(tail_start, buffer.data(), tail_size) != tail_size) throw corrupt();
+  for (size_t end_pos = tail_size - ZIP_END_RECORD_SIZE + 1 ; end_pos-- > 0 ; ) {
+    if (read32(&buffer[end_pos]) == ZIP_END_RECORD && readCentralDirectoryAt(tail_start + end_pos, false)) return;
+  }
+  // When appending (see ZipAppender) was interrupted, the file ends in a partial entry of any size.
+  // The end record of the previous version of the archive comes right after its central directory, search back for it.
+  wxFileOffset block_end = tail_start;
+  while (block_end > 0) {
+    wxFileOffset block_start = max((wxFileOffset)0, block_end - (wxFileOffset)ZIP_SEARCH_BLOCK_SIZE);
+    size_t size = (size_t)(block_end - block_start) + 3; // signatures can cross the block boundary
+    buffer.resize(size);
+    if (readAt(block_start, buffer.data(), size) != size) throw corrupt();
+    for (size_t end_pos = size - 3 ; end_pos-- > 0 ; ) {
+      if (read32(&buffer[end_pos]) == ZIP_END_RECORD && readCentralDirectoryAt(block_start + end_pos, true)) return;
+    }
+    block_end = block_start;
+  }
+  throw corrupt();
+}
+
+bool ZipArchive::readCentralDirectoryAt(wxFileOffset end_offset, bool directly_after_directory) {
+  unsigned char end[ZIP_END_RECORD_SIZE];
+  if (readAt(end_offset, end, sizeof(end)) != sizeof(end) || read32(end) != ZIP_END_RECORD) return false;
+  wxFileOffset entry_count = read16(end + 10);
+  wxFileOffset dir_size    = read32(end + 12);
+  wxFileOffset dir_offset  = read32(end + 16);
+  wxFileOffset record_offset = end_offset;
+  size_t comment_size = (size_t)min((wxFileOffset)read16(end + 20), file_size - end_offset - (wxFileOffset)ZIP_END_RECORD_SIZE);
+  vector<unsigned char> new_comment(comment_size);
+  if (readAt(end_offset + ZIP_END_RECORD_SIZE, new_comment.data(), comment_size) != comment_size) return false;
+  bool zip64 = false;
+  // zip64?
+  unsigned char locator[ZIP64_END_LOCATOR_SIZE];
+  if (end_offset >= (wxFileOffset)ZIP64_END_LOCATOR_SIZE
+      && readAt(end_offset - ZIP64_END_LOCATOR_SIZE, locator, sizeof(locator)) == sizeof(locator)
+      && read32(locator) == ZIP64_END_LOCATOR) {
+    unsigned char end64[ZIP64_END_RECORD_SIZE];
+    wxFileOffset end64_offset = read64(locator + 8);
+    if (readAt(end64_offset, end64, sizeof(end64)) != sizeof(end64) || read32(end64) != ZIP64_END_RECORD) return false;
+    entry_count   = read64(end64 + 32);
+    dir_size      = read64(end64 + 40);
+    dir_offset    = read64(end64 + 48);
+    record_offset = end64_offset;
+    zip64         = true;
+  }
+  // data may be prepended to the archive (self extracting zip files), in which case all offsets are off
+  wxFileOffset skew = record_offset - dir_size - dir_offset;
+  if (skew < 0 || dir_size < 0 || entry_count < 0) return false;
+  if (directly_after_directory && (zip64 || skew != 0)) return false;
+  bool new_simple_layout = !zip64 && skew == 0;
+  // read the whole central directory at once
+  vector<unsigned char> dir((size_t)dir_size);
+  if (readAt(dir_offset + skew, dir.data(), dir.size()) != dir.size()) return false;
+  vector<ZipEntryInfo> new_entries;
+  new_entries.reserve((size_t)min(entry_count, dir_size / (wxFileOffset)ZIP_CENTRAL_HEADER_SIZE));
+  size_t pos = 0;
+  for (wxFileOffset i = 0 ; i < entry_count ; ++i) {
+    if (pos + ZIP_CENTRAL_HEADER_SIZE > dir.size()) return false;
+    const unsigned char* h = &dir[pos];
+    if (read32(h) != ZIP_CENTRAL_HEADER) return false;
+    size_t name_size    = read16(h + 28);
+    size_t extra_size   = read16(h + 30);
+    size_t comment_size = read16(h + 32);
+    if (pos + ZIP_CENTRAL_HEADER_SIZE + name_size + extra_size + comment_size > dir.size()) return false;
+    ZipEntryInfo e;
+    e.flags           = read16(h + 8);
+    e.method          = read16(h + 10);
+    e.dos_time        = read32(h + 12);
+    e.compressed_size = read32(h + 20);
+    e.size            = read32(h + 24);
+    e.header_offset   = read32(h + 42);
+    e.data_offset     = -1;
+    e.central_record.assign(h, h + ZIP_CENTRAL_HEADER_SIZE + name_size + extra_size + comment_size);
+    const char* name = reinterpret_cast<const char*>(h + ZIP_CENTRAL_HEADER_SIZE);
+    e.name = String(name, (e.flags & ZIP_FLAG_UTF8) ? (const wxMBConv&)wxConvUTF8 : (const wxMBConv&)wxConvLocal, name_size);
+    // zip64 extra field, contains the fields that didn't fit
+    const unsigned char* extra     = h + ZIP_CENTRAL_HEADER_SIZE + name_size;
+    const unsigned char* extra_end = extra + extra_size;
+    while (extra + 4 <= extra_end) {
+      UInt id = read16(extra), size = read16(extra + 2);
+      const unsigned char* field = extra + 4, *field_end = min(field + size, extra_end);
+      if (id == 0x0001) {
+        if (e.size            == 0xFFFFFFFF && field + 8 <= field_end) { e.size            = read64(field); field += 8; }
+        if (e.compressed_size == 0xFFFFFFFF && field + 8 <= field_end) { e.compressed_size = read64(field); field += 8; }
+        if (e.header_offset   == 0xFFFFFFFF && field + 8 <= field_end) { e.header_offset   = read64(field); field += 8; }
+      }
+      extra = field_end;
+    }
+    if (e.header_offset == 0xFFFFFFFF || e.compressed_size == 0xFFFFFFFF) new_simple_layout = false;
+    e.header_offset += skew;
+    new_entries.push_back(move(e));
+    pos += ZIP_CENTRAL_HEADER_SIZE + name_size + extra_size + comment_size;
+  }
+  entries.swap(new_entries);
+  comment.swap(new_comment);
+  simple_layout = new_simple_layout;
+  return true;
+}
+
+wxFileOffset ZipArchive::dataOffset(const ZipEntryInfo& entry) {
+  {
+    std::lock_guard<std::mutex> lock(entry_mutex);
+    if (entry.data_offset >= 0) return entry.data_offset;
+  }
+  // the size of the name and extra field in the local header can differ from the central directory
+  unsigned char h[ZIP_LOCAL_HEADER_SIZE];
+  if (readAt(entry.header_offset, h, sizeof(h)) != sizeof(h) || read32(h) != ZIP_LOCAL_HEADER) {
+    return -1;
+  }
+  wxFileOffset offset = entry.header_offset + ZIP_LOCAL_HEADER_SIZE + read16(h + 26) + read16(h + 28);
+  std::lock_guard<std::mutex> lock(entry_mutex);
+  entry.data_offset = offset;
+  return offset;
+}
+
+unique_ptr<wxInputStream> ZipArchive::openEntry(const ZipEntryInfo& entry) {
+  if (entry.isEncrypted() || (entry.method != 0 && entry.method != 8)) {
+    throw FileNotFoundError(entry.name, filename);
+  }
+  wxFileOffset offset = dataOffset(entry);
+  if (offset < 0 || offset + entry.compressed_size > file_size) {
+    throw FileNotFoundError(entry.name, filename);
+  }
+  auto data = make_unique<ZipRangeInputStream>(shared_from_this(), offset, entry.compressed_size);
+  if (entry.isStored()) {
+    return data;
+  } else {
+    return make_unique<ZipInflateInputStream>(data.release(), entry.size);
+  }
+}
+
+// ----------------------------------------------------------------------------- : ZipAppender
+
+bool ZipAppender::canAppend(const ZipArchive& archive) {
+  return archive.simple_layout && archive.entries.size() <= ZIP_MAX_ENTRIES;
+}
+
+ZipAppender::ZipAppender(const ZipArchive& archive)
+  : filename(archive.filename)
+  , original_size(archive.file_size)
+  , entry_count(0)
+  , comment(archive.comment)
+  , committed(false)
+{
+  if (!canAppend(archive) || !file.Open(filename, wxFile::read_write) || file.Length() != original_size) {
+    throw PackageError(_ERROR_("unable to open output file"));
+  }
+  if (file.SeekEnd() == wxInvalidOffset) {
+    throw PackageError(_ERROR_("unable to open output file"));
+  }
+}
+
+ZipAppender::~ZipAppender() {
+  if (!committed && file.IsOpened()) {
+    // restore the old archive
+    #if defined(__WXMSW__)
+      _chsize_s(file.fd(), original_size);
+    #else
+      if (ftruncate(file.fd(), original_size) != 0) {} // nothing more we can do
+    #endif
+  }
+}
+
+void ZipAppender::write(const void* data, size_t size) {
+  if (file.Write(data, size) != size) {
+    throw PackageError(_ERROR_("unable to store file"));
+  }
+}
+
+void ZipAppender::keepEntry(const ZipEntryInfo& entry) {
+  directory.insert(directory.end(), entry.central_record.begin(), entry.central_record.end());
+  entry_count++;
+}
+
+void ZipAppender::addEntry(const String& name, wxInputStream& data) {
+  wxCharBuffer name_utf8 = name.utf8_str();
+  size_t name_size = strlen(name_utf8.data());
+  wxFileOffset header_offset = file.Tell();
+  UInt dos_time = (UInt)wxDateTime::Now().GetAsDOS();
+  // local header, the crc and sizes are filled in later
+  unsigned char header[ZIP_LOCAL_HEADER_SIZE] = {0};
+  write32(header,      ZIP_LOCAL_HEADER);
+  write16(header + 4,  20); // version needed to extract
+  write16(header + 6,  ZIP_FLAG_UTF8);
+  write16(header + 8,  8);  // deflate
+  write32(header + 10, dos_time);
+  write16(header + 26, (UInt)name_size);
+  write(header, sizeof(header));
+  write(name_utf8.data(), name_size);
+  // compressed data
+  wxFileOffset data_offset = file.Tell();
+  UInt crc = 0;
+  wxFileOffset size = 0;
+  {
+    wxFileOutputStream out(file);
+    wxZlibOutputStream deflate(out, -1, wxZLIB_NO_HEADER);
+    unsigned char buffer[16384];
+    while (data.CanRead()) {
+      size_t read = data.Read(buffer, sizeof(buffer)).LastRead();
+      if (read == 0) break;
+      crc = zip_crc32(crc, buffer, read);
+      size += read;
+      if (!deflate.Write(buffer, read).IsOk()) throw PackageError(_ERROR_("unable to store file"));
+    }
+    if (!deflate.Close() || !out.IsOk()) throw PackageError(_ERROR_("unable to store file"));
+  }
+  wxFileOffset end_offset = file.Tell();
+  wxFileOffset compressed_size = end_offset - data_offset;
+  if (end_offset > ZIP_MAX_OFFSET || size > ZIP_MAX_OFFSET || entry_count >= ZIP_MAX_ENTRIES) {
+    throw PackageError(_ERROR_("unable to store file")); // would need zip64
+  }
+  // fill in header
+  write32(header + 14, crc);
+  write32(header + 18, (UInt)compressed_size);
+  write32(header + 22, (UInt)size);
+  if (file.Seek(header_offset) == wxInvalidOffset) throw PackageError(_ERROR_("unable to store file"));
+  write(header, sizeof(header));
+  if (file.Seek(end_offset) == wxInvalidOffset) throw PackageError(_ERROR_("unable to store file"));
+  // central directory record
+  unsigned char record[ZIP_CENTRAL_HEADER_SIZE] = {0};
+  write32(record,      ZIP_CENTRAL_HEADER);
+  write16(record + 4,  20); // version made by
+  memcpy(record + 6, header + 4, 26); // same as in local header: version needed .. name size
+  write32(record + 42, (UInt)header_offset);
+  directory.insert(directory.end(), record, record + sizeof(record));
+  directory.insert(directory.end(), name_utf8.data(), name_utf8.data() + name_size);
+  entry_count++;
+}
+
+void ZipAppender::commit() {
+  wxFileOffset dir_offset = file.Tell();
+  if (dir_offset + (wxFileOffset)directory.size() > ZIP_MAX_OFFSET) {
+    throw PackageError(_ERROR_("unable to store file")); // would need zip64
+  }
+  write(directory.data(), directory.size());
+  unsigned char end[ZIP_END_RECORD_SIZE] = {0};
+  write32(end,      ZIP_END_RECORD);
+  write16(end + 8,  (UInt)entry_count);
+  write16(end + 10, (UInt)entry_count);
+  write32(end + 12, (UInt)directory.size());
+  write32(end + 16, (UInt)dir_offset);
+  write16(end + 20, (UInt)comment.size());
+  write(end, sizeof(end));
+  write(comment.data(), comment.size());
+  if (!file.Flush()) throw PackageError(_ERROR_("unable to store file"));
+  file.Close();
+  committed = true;
+}
@@ -0,0 +1,128 @@
+//+----------------------------------------------------------------------------+
+//| Description:  Magic Set Editor - Program to make Magic (tm) cards          |
+//| Copyright:    (C) Twan van Laarhoven and the other MSE developers          |
+//| License:      GNU General Public License 2 or later (see file COPYING)     |
+//+----------------------------------------------------------------------------+
+
+#pragma once
+
+// ----------------------------------------------------------------------------- : Includes
+
+#include <util/prec.hpp>
+#include <wx/file.h>
+#include <mutex>
+
+DECLARE_SHARED_POINTER_TYPE(ZipArchive);
+
+// ----------------------------------------------------------------------------- : ZipEntryInfo
+
+/// Information on a single file in a zip archive, as found in the central directory
+struct ZipEntryInfo {
+  String  name;              ///< Name of the file, using '/' as path separator
+  UInt    method;            ///< Compression method, 0 = stored, 8 = deflated
+  UInt    flags;             ///< General purpose flags
+  UInt    dos_time;          ///< Modification time, in MS-DOS format
+  wxFileOffset compressed_size;
+  wxFileOffset size;         ///< Uncompressed size
+  wxFileOffset header_offset;///< Offset of the local header in the file
+  mutable wxFileOffset data_offset; ///< Offset of the data in the file, or -1 if the local header has not been read yet
+  vector<unsigned char> central_record; ///< The raw central directory record of this entry
+
+  inline bool isStored()    const { return method == 0; }
+  inline bool isEncrypted() const { return (flags & 1) != 0; }
+  /// Modification time of this entry
+  DateTime dateTime() const;
+  /// (Approximate) number of bytes this entry takes up in the file, outside the central directory
+  wxFileOffset storedSize() const;
+};
+
+// ----------------------------------------------------------------------------- : ZipArchive
+
+/// A zip file that is open for reading
+/** Only the central directory is read when the archive is opened,
+ *  the local headers and the data of the files is read on demand.
+ *
+ *  All streams opened with openEntry share a single file handle.
+ *  They keep the archive alive, so the streams can outlive the Package that opened them.
+ *  Reads from stored (uncompressed) entries go directly from the file into the caller's buffer.
+ */
+class ZipArchive : public std::enable_shared_from_this<ZipArchive> {
+public:
+  /// Open a zip file, read its central directory.
+  /** Throws a PackageError if the file can not be opened or is not a valid zip file. */
+  ZipArchive(const String& filename);
+
+  inline const String& getFilename() const { return filename; }
+  inline const vector<ZipEntryInfo>& getEntries() const { return entries; }
+  inline wxFileOffset getFileSize() const { return file_size; }
+
+  /// Open a stream for reading the (uncompressed) contents of an entry
+  /** Throws a FileNotFoundError if the entry can not be read. */
+  unique_ptr<wxInputStream> openEntry(const ZipEntryInfo& entry);
+
+  /// Read size bytes starting at offset pos in the file
+  /** Returns the number of bytes read.
+   *  Safe to call from multiple threads. */
+  size_t readAt(wxFileOffset pos, void* buffer, size_t size);
+
+private:
+  String               filename;
+  wxFile               file;          ///< The one file handle used for all reads
+  wxFileOffset         file_size;
+  std::mutex           file_mutex;    ///< Lock for file, since reads need a seek
+  vector<ZipEntryInfo> entries;
+  std::mutex           entry_mutex;   ///< Lock for ZipEntryInfo::data_offset
+  vector<unsigned char> comment;      ///< Archive comment
+  bool                 simple_layout; ///< No zip64 records, and nothing prepended to the archive
+
+  void readCentralDirectory();
+  /// Read the central directory of the end record at end_offset, return false if they are not valid
+  /** If directly_after_directory, only accept an end record that directly follows its central directory,
+   *  as written by ZipAppender. */
+  bool readCentralDirectoryAt(wxFileOffset end_offset, bool directly_after_directory);
+  /// Offset of the data of the entry, reads the local header if needed
+  wxFileOffset dataOffset(const ZipEntryInfo& entry);
+  friend class ZipAppender;
+};
+
+// ----------------------------------------------------------------------------- : ZipAppender
+
+/// Writes a new version of a zip archive by appending to the end of the existing file
+/** The data of entries that are kept stays where it is, only new entries are written,
+ *  followed by a new central directory that refers to both.
+ *  Readers only look at the last central directory, so the old data becomes dead space.
+ *
+ *  The existing contents of the file are never modified.
+ *  If the appender is destroyed before commit() the file is truncated back to its old size,
+ *  so a failed save leaves the old archive intact.
+ *  If the program stops before that, ZipArchive finds the old end record behind the partial data.
+ *
+ *  Throws a PackageError if anything goes wrong, including when the archive would need zip64 records.
+ */
+class ZipAppender {
+public:
+  ZipAppender(const ZipArchive& archive);
+  ~ZipAppender();
+
+  /// Can we append to this archive?
+  /** Only possible for simple archives, without zip64 records or data before the start of the archive. */
+  static bool canAppend(const ZipArchive& archive);
+
+  /// Keep an entry of the original archive
+  void keepEntry(const ZipEntryInfo& entry);
+  /// Add a new entry with the given data, it is compressed with deflate
+  void addEntry(const String& name, wxInputStream& data);
+  /// Write the new central directory, only after this the changes are visible
+  void commit();
+
+private:
+  String                filename;
+  wxFile                file;
+  wxFileOffset          original_size;
+  vector<unsigned char> directory;   ///< The new central directory
+  size_t                entry_count;
+  vector<unsigned char> comment;
+  bool                  committed;
+
+  void write(const void* data, size_t size);
+};
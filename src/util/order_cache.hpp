@@ -13,7 +13,10 @@
 // ----------------------------------------------------------------------------- : OrderCache
 
 /// Object that cashes an ordered version of a list of items, for finding the position of objects
-/** Can be used as a map "void* -> int" for finding the position of an object */
+/** Can be used as a map "void* -> int" for finding the position of an object.
+ *  When the value of a single item changes, it can be moved to its new position with update,
+ *  without having to sort all items again.
+ */
 template <typename T>
 class OrderCache : public IntrusivePtrBase<OrderCache<T>> {
 public:
@@ -26,29 +29,45 @@ public:
   /// Find the position of the given key in the cache, returns -1 if not found
   int find(const T& key) const;
   
+  /// Change the value of a key, and whether it is kept, and move it to its new position
+  /** Returns false if the key is not in the cache */
+  bool update(const T& key, const String& value, bool keep = true);
+  
 private:
+  struct Item {
+    void*  key;
+    int    index; ///< Index in the original list, to break ties between equal values
+    String value;
+    bool   keep;
+  };
   struct CompareKeys;
-  struct CompareValues;
-  typedef pair<void*,int> KV;
-  vector<KV> positions;
+  struct CompareOrder;
+  vector<Item> items; ///< All items, sorted by key
+  vector<int>  order; ///< Indices in items of the kept items, sorted by value
+  
+  /// Find the index in items of a key, or -1
+  int findItem(void* key) const;
 };
 
 // ----------------------------------------------------------------------------- : Implementation
 
 template <typename T>
 struct OrderCache<T>::CompareKeys {
-  inline bool operator () (const KV& a, void*     b) { return a.first < b; }
-  inline bool operator () (const KV& a, const KV& b) { return a.first < b.first; }
-  inline bool operator () (void*     a, const KV& b) { return a       < b.first; }
+  inline bool operator () (const Item& a, void*       b) { return a.key < b; }
+  inline bool operator () (const Item& a, const Item& b) { return a.key < b.key; }
+  inline bool operator () (void*       a, const Item& b) { return a     < b.key; }
 };
 
 template <typename T>
-struct OrderCache<T>::CompareValues {
-  const vector<String>& values;
-  CompareValues(const vector<String>& values) : values(values) {}
+struct OrderCache<T>::CompareOrder {
+  const vector<Item>& items;
+  CompareOrder(const vector<Item>& items) : items(items) {}
   
-  inline bool operator () (const KV& a, const KV& b) {
-    return smart_less(values[a.second], values[b.second]);
+  inline bool operator () (int a, int b) {
+    const Item& x = items[a], &y = items[b];
+    if (smart_less(x.value, y.value)) return true;
+    if (smart_less(y.value, x.value)) return false;
+    return x.index < y.index;
   }
 };
 
@@ -56,29 +75,48 @@ template <typename T>
 OrderCache<T>::OrderCache(const vector<T>& keys, const vector<String>& values, vector<int>* keep) {
   assert(keys.size() == values.size());
   assert(!keep || keep->size() == keys.size());
-  // initialize positions, use pos to point back to the values vector
-  positions.reserve(keys.size());
-  int i = 0;
-  for (typename vector<T>::const_iterator it = keys.begin() ; it != keys.end() ; ++it, ++i) {
-    if (!keep || (*keep)[i]) {
-      positions.push_back(KV(&**it, i));
-    }
+  // initialize items, sorted by key
+  items.reserve(keys.size());
+  for (size_t i = 0 ; i < keys.size() ; ++i) {
+    items.push_back(Item{&*keys[i], (int)i, values[i], !keep || (*keep)[i]});
   }
-  // sort the KVs by the values
-  sort(positions.begin(), positions.end(), CompareValues(values));
-  // update positions, to point to sorted list
-  i = 0;
-  for (typename vector<KV>::iterator it = positions.begin() ; it != positions.end() ; ++it, ++i) {
-    it->second = i;
+  sort(items.begin(), items.end(), CompareKeys());
+  // sort the kept items by value
+  order.reserve(items.size());
+  for (size_t i = 0 ; i < items.size() ; ++i) {
+    if (items[i].keep) order.push_back((int)i);
   }
-  // sort the KVs by the keys
-  sort(positions.begin(), positions.end(), CompareKeys());
+  sort(order.begin(), order.end(), CompareOrder(items));
+}
+
+template <typename T>
+int OrderCache<T>::findItem(void* key) const {
+  typename vector<Item>::const_iterator it = lower_bound(items.begin(), items.end(), key, CompareKeys());
+  if (it == items.end() || it->key != key) return -1;
+  return (int)(it - items.begin());
 }
 
 template <typename T>
 int OrderCache<T>::find(const T& key) const {
-  vector<KV>::const_iterator it = lower_bound(positions.begin(), positions.end(), &*key, CompareKeys());
-  if (it == positions.end() || it->first != &*key) return -1;
-  return it->second;
+  int i = findItem(&*key);
+  if (i < 0 || !items[i].keep) return -1;
+  return (int)(lower_bound(order.begin(), order.end(), i, CompareOrder(items)) - order.begin());
 }
 
+template <typename T>
+bool OrderCache<T>::update(const T& key, const String& value, bool keep) {
+  int i = findItem(&*key);
+  if (i < 0) return false;
+  Item& item = items[i];
+  if (item.keep) {
+    vector<int>::iterator it = lower_bound(order.begin(), order.end(), i, CompareOrder(items));
+    assert(it != order.end() && *it == i);
+    order.erase(it);
+  }
+  item.value = value;
+  item.keep  = keep;
+  if (item.keep) {
+    order.insert(lower_bound(order.begin(), order.end(), i, CompareOrder(items)), i);
+  }
+  return true;
+}
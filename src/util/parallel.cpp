@@ -0,0 +1,23 @@
+//+----------------------------------------------------------------------------+
+//| Description:  Magic Set Editor - Program to make Magic (tm) cards          |
+//| Copyright:    (C) Twan van Laarhoven and the other MSE developers          |
+//| License:      GNU General Public License 2 or later (see file COPYING)     |
+//+----------------------------------------------------------------------------+
+
+// ----------------------------------------------------------------------------- : Includes
+
+#include <util/prec.hpp>
+#include <util/parallel.hpp>
+#include <data/settings.hpp>
+
+// ----------------------------------------------------------------------------- : Worker threads
+
+thread_local bool in_parallel_for = false;
+
+size_t worker_thread_count() {
+  if (settings.worker_threads > 0) {
+    return settings.worker_threads;
+  }
+  size_t cores = std::thread::hardware_concurrency();
+  return cores > 0 ? cores : 1; // hardware_concurrency returns 0 if it is not known
+}
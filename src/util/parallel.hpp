@@ -0,0 +1,82 @@
+//+----------------------------------------------------------------------------+
+//| Description:  Magic Set Editor - Program to make Magic (tm) cards          |
+//| Copyright:    (C) Twan van Laarhoven and the other MSE developers          |
+//| License:      GNU General Public License 2 or later (see file COPYING)     |
+//+----------------------------------------------------------------------------+
+
+#pragma once
+
+/** @file util/parallel.hpp
+ *
+ *  @brief Utilities for distributing work over multiple threads
+ */
+
+// ----------------------------------------------------------------------------- : Includes
+
+#include <util/prec.hpp>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+
+// ----------------------------------------------------------------------------- : Worker threads
+
+/// Number of threads that should be used for parallel work, always at least 1
+/** Uses settings.worker_threads, or the number of processor cores if that is 0.
+ */
+size_t worker_thread_count();
+
+/// Is the calling thread doing the work of a parallel_for?
+/** A parallel_for inside another one runs on the calling thread only, so the number of threads doesn't multiply. */
+extern thread_local bool in_parallel_for;
+
+/// Sets in_parallel_for while it is in scope
+class ParallelForScope {
+public:
+  ParallelForScope() : was_in_parallel_for(in_parallel_for) { in_parallel_for = true; }
+  ~ParallelForScope() { in_parallel_for = was_in_parallel_for; }
+private:
+  bool was_in_parallel_for;
+};
+
+/// Call f(thread, i) for all i in [0,n), using at most thread_count threads
+/** The calling thread takes part in the work as thread 0,
+ *  the other threads are numbered 1..thread_count-1.
+ *  Each thread can therefore use its own (non thread safe) state, indexed by thread.
+ *
+ *  Items are handed out one at a time, so the order in which they are processed is not defined.
+ *  When called from inside another parallel_for, everything is done by the calling thread.
+ *  If f throws an exception, no new items are started, and the first exception is rethrown
+ *  in the calling thread after all threads have finished.
+ */
+template <typename F>
+void parallel_for(size_t n, size_t thread_count, F f) {
+  if (thread_count > n) thread_count = n;
+  if (thread_count <= 1 || in_parallel_for) {
+    for (size_t i = 0 ; i < n ; ++i) f((size_t)0, i);
+    return;
+  }
+  std::atomic<size_t> next(0);
+  std::exception_ptr  error;
+  std::mutex          error_mutex;
+  auto work = [&](size_t thread) {
+    ParallelForScope scope;
+    try {
+      for (size_t i = next++ ; i < n ; i = next++) {
+        f(thread, i);
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (!error) error = std::current_exception();
+      next = n; // stop handing out work
+    }
+  };
+  vector<std::thread> threads;
+  threads.reserve(thread_count - 1);
+  for (size_t t = 1 ; t < thread_count ; ++t) {
+    threads.emplace_back(work, t);
+  }
+  work(0);
+  FOR_EACH(t, threads) t.join();
+  if (error) std::rethrow_exception(error);
+}
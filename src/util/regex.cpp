@@ -9,14 +9,37 @@
 #include <util/prec.hpp>
 #include <util/regex.hpp>
 #include <util/error.hpp>
+#include <script/profiler.hpp>
+#include <list>
+#include <mutex>
 
 #if USE_BOOST_REGEX
-// ----------------------------------------------------------------------------- : Regex : boost
+// ----------------------------------------------------------------------------- : Regex : cache
 
-void Regex::assign(const String& code) {
-  // compile string
+/// Cache of compiled regular expressions, by their code
+/** Compiling a regex is expensive, and scripts construct the same regexes from strings
+ *  again and again, for every card.
+ *  The cache is shared by all threads, and keeps at most REGEX_CACHE_SIZE regexes,
+ *  the least recently used one is thrown out first.
+ */
+class RegexCache {
+public:
+  shared_ptr<const Regex::CompiledRegex> get(const String& code);
+private:
+  typedef list<pair<String,shared_ptr<const Regex::CompiledRegex>>> Entries;
+  Entries entries; ///< Cached regexes, most recently used first
+  map<String,Entries::iterator> by_code;
+  std::mutex mutex;
+};
+
+const size_t REGEX_CACHE_SIZE = 256;
+
+ProfileCounter regex_cache_hits  (_("regex cache hits"));
+ProfileCounter regex_cache_misses(_("regex cache misses"));
+
+shared_ptr<const Regex::CompiledRegex> compile_regex(const String& code) {
   try {
-    regex.assign(toStdString(code));
+    return make_shared<Regex::CompiledRegex>(toStdString(code));
   } catch (const boost::regex_error& e) {
     /// TODO: be more precise
     throw ScriptError(String::Format(_("Error while compiling regular expression: '%s'\nAt position: %d\n%s"),
@@ -24,8 +47,137 @@ void Regex::assign(const String& code) {
   }
 }
 
+shared_ptr<const Regex::CompiledRegex> RegexCache::get(const String& code) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = by_code.find(code);
+    if (it != by_code.end()) {
+      entries.splice(entries.begin(), entries, it->second); // now the most recently used
+      ++regex_cache_hits;
+      return it->second->second;
+    }
+  }
+  // compile without holding the lock, errors are not cached
+  ++regex_cache_misses;
+  shared_ptr<const Regex::CompiledRegex> regex = compile_regex(code);
+  std::lock_guard<std::mutex> lock(mutex);
+  if (by_code.find(code) == by_code.end()) { // another thread could have compiled the same regex in the meantime
+    entries.push_front(make_pair(code, regex));
+    by_code.insert(make_pair(code, entries.begin()));
+    if (entries.size() > REGEX_CACHE_SIZE) {
+      by_code.erase(entries.back().first);
+      entries.pop_back();
+    }
+  }
+  return regex;
+}
+
+RegexCache& regex_cache() {
+  static RegexCache cache; // function local static, the cache might be needed during static initialization
+  return cache;
+}
+
+// ----------------------------------------------------------------------------- : Regex : boost
+
+const Regex::CompiledRegex Regex::no_regex;
+
+void Regex::assign(const String& code) {
+  regex = regex_cache().get(code);
+}
+
+// ----------------------------------------------------------------------------- : Regex : in context
+
+/// Iterator over a string, where a part is replaced by "<match>"
+/** This is a concatenation of three segments:
+ *    0. [str.begin(), match_begin)
+ *    1. "<match>"
+ *    2. [match_end, str.end())
+ *  Positions are kept normalized: an iterator is never at the end of segment 0 or 1,
+ *  so equal positions compare equal.
+ */
+class InContextIterator {
+public:
+  typedef std::bidirectional_iterator_tag iterator_category;
+  typedef Char                            value_type;
+  typedef ptrdiff_t                       difference_type;
+  typedef const Char*                     pointer;
+  typedef Char                            reference;
+  
+  struct Parts {
+    String::const_iterator begin, match_begin, match_end, end;
+  };
+  
+  InContextIterator() : parts(nullptr), segment(2), marker_pos(0) {}
+  InContextIterator(const Parts& parts, int segment, const String::const_iterator& it)
+    : parts(&parts), segment(segment), it(it), marker_pos(0)
+  {
+    normalize();
+  }
+  
+  inline Char operator * () const {
+    return segment == 1 ? marker[marker_pos] : (Char)*it;
+  }
+  InContextIterator& operator ++ () {
+    if (segment == 1) ++marker_pos;
+    else              ++it;
+    normalize();
+    return *this;
+  }
+  InContextIterator& operator -- () {
+    if (segment == 2 && it == parts->match_end) {
+      segment = 1;
+      marker_pos = MARKER_SIZE - 1;
+    } else if (segment == 1 && marker_pos == 0) {
+      segment = 0;
+      it = parts->match_begin;
+      --it;
+    } else if (segment == 1) {
+      --marker_pos;
+    } else {
+      --it;
+    }
+    return *this;
+  }
+  inline InContextIterator operator ++ (int) { InContextIterator before = *this; ++*this; return before; }
+  inline InContextIterator operator -- (int) { InContextIterator before = *this; --*this; return before; }
+  
+  inline bool operator == (const InContextIterator& that) const {
+    return segment == that.segment && (segment == 1 ? marker_pos == that.marker_pos : it == that.it);
+  }
+  inline bool operator != (const InContextIterator& that) const {
+    return !(*this == that);
+  }
+  
+private:
+  static const Char marker[];
+  static const size_t MARKER_SIZE = 7;
+  const Parts* parts;
+  int segment;
+  String::const_iterator it; ///< Position in segment 0 or 2
+  size_t marker_pos;         ///< Position in segment 1
+  
+  inline void normalize() {
+    if (segment == 0 && it == parts->match_begin) {
+      segment = 1;
+      marker_pos = 0;
+    }
+    if (segment == 1 && marker_pos == MARKER_SIZE) {
+      segment = 2;
+      it = parts->match_end;
+    }
+  }
+};
+const Char InContextIterator::marker[] = _("<match>");
+
+bool Regex::matches_in_context(const String& str, const String::const_iterator& match_begin, const String::const_iterator& match_end) const {
+  InContextIterator::Parts parts = {str.begin(), match_begin, match_end, str.end()};
+  return regex_search(InContextIterator(parts, 0, parts.begin), InContextIterator(parts, 2, parts.end), compiled());
+}
+
+// ----------------------------------------------------------------------------- : Regex : replace
+
 String Regex::replace_all(const String& input, const String& format) const {
-  return regex_replace(toStdString(input), regex, toStdString(format), boost::format_sed);
+  return regex_replace(toStdString(input), compiled(), toStdString(format), boost::format_sed);
 }
 
 #else // USE_BOOST_REGEX
@@ -71,27 +71,48 @@
       }
     };
     
+    typedef boost::basic_regex<Char> CompiledRegex;
+    
     inline Regex() {}
     inline Regex(const String& code) { assign(code); }
     
+    /// Compile a regular expression, or get an already compiled one from the regex cache
     void assign(const String& code);
     inline bool matches(const String& str) const {
-      return regex_search(toStdString(str), regex);
+      // note: iterate directly over the string, instead of making a std::string copy
+      return regex_search(str.begin(), str.end(), compiled());
     }
     inline bool matches(Results& results, const String& str, size_t start = 0) const {
       return matches(results, str.begin() + start, str.end());
     }
     inline bool matches(Results& results, const String::const_iterator& begin, const String::const_iterator& end) const {
-      return regex_search(begin, end, results, regex);
+      return regex_search(begin, end, results, compiled());
+    }
+    /// Does the regex match starting exactly at pos?
+    /** [begin,end) is the whole string, the characters before pos are used for assertions like word boundaries */
+    inline bool matches_at(Results& results, const String::const_iterator& pos, const String::const_iterator& begin, const String::const_iterator& end) const {
+      return regex_search(pos, end, results, compiled(),
+                          pos == begin ? boost::match_continuous : boost::match_continuous | boost::match_prev_avail);
     }
+    /// Does the regex match str, with the part [match_begin,match_end) replaced by "<match>"?
+    /** Used for the in_context parameter of the regex functions.
+     *  The replaced string is not constructed, it is iterated over in place.
+     */
+    bool matches_in_context(const String& str, const String::const_iterator& match_begin, const String::const_iterator& match_end) const;
     String replace_all(const String& input, const String& format) const;
     
     inline bool empty() const {
-      return regex.empty();
+      return !regex || regex->empty();
     }
     
   private:
-    boost::basic_regex<Char> regex; ///< The regular expression
+    /// The regular expression, shared with other Regex objects with the same code
+    /** Compiled regular expressions can safely be used from multiple threads */
+    shared_ptr<const CompiledRegex> regex;
+    static const CompiledRegex no_regex;
+    inline const CompiledRegex& compiled() const {
+      return regex ? *regex : no_regex;
+    }
   };
 
 // ----------------------------------------------------------------------------- : Wx implementation
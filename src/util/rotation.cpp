@@ -10,6 +10,8 @@
 #include <util/rotation.hpp>
 #include <gfx/gfx.hpp>
 #include <data/font.hpp>
+#include <script/profiler.hpp>
+#include <unordered_map>
 
 // ----------------------------------------------------------------------------- : Rotation
 
@@ -349,6 +351,69 @@ RealSize RotatedDC::GetTextExtent(const String& text) const {
     return RealSize(w / (zoomX * text_scaling), h / (zoomY * text_scaling));
   }
 }
+ProfileCounter text_advance_cache_hits  (_("text advance cache hits"));
+ProfileCounter text_advance_cache_misses(_("text advance cache misses"));
+
+/// Advances of characters in device pixels, keyed on the character and the one before it (0 at the start)
+/** The pair captures kerning, text is remeasured whenever a pair is missing. */
+typedef unordered_map<unsigned long long, int> TextAdvances;
+
+inline unsigned long long advance_key(Char prev, Char c) {
+  return (unsigned long long)(unsigned int)prev << 32 | (unsigned int)c;
+}
+
+// Don't let the cache grow without bounds
+const size_t MAX_ADVANCE_CACHE_FONTS = 64;
+
+/// Advances for each font on a dc, the key is the native font description, which includes the size,
+/// together with the resolution of the dc, since the same point size measures differently on a printer or screen.
+/** Per thread, so that text can be measured in multiple threads without locking. */
+TextAdvances& text_advances_for(const wxDC& dc) {
+  thread_local map<String, TextAdvances> cache;
+  wxSize ppi = dc.GetPPI();
+  String key = String::Format(_("%d,%d;"), ppi.x, ppi.y) + dc.GetFont().GetNativeFontInfoDesc();
+  if (cache.size() >= MAX_ADVANCE_CACHE_FONTS && cache.find(key) == cache.end()) {
+    cache.clear();
+  }
+  return cache[key];
+}
+
+void RotatedDC::GetTextAdvances(const String& text, vector<double>& out) const {
+  size_t n = text.size();
+  out.resize(n);
+  if (n == 0) return;
+  double factor = quality == QUALITY_LOW ? 1. / zoomX : 1. / (zoomX * text_scaling);
+  TextAdvances& advances = text_advances_for(dc);
+  // everything in the cache?
+  Char prev = 0;
+  size_t i = 0;
+  for ( ; i < n ; ++i) {
+    Char c = text.GetChar(i);
+    TextAdvances::const_iterator it = advances.find(advance_key(prev, c));
+    if (it == advances.end()) break;
+    out[i] = it->second * factor;
+    prev = c;
+  }
+  if (i == n) {
+    ++text_advance_cache_hits;
+    return;
+  }
+  // measure all characters in one go
+  ++text_advance_cache_misses;
+  wxArrayInt widths;
+  dc.GetPartialTextExtents(text, widths);
+  prev = 0;
+  int prev_width = 0;
+  for (i = 0 ; i < n ; ++i) {
+    Char c = text.GetChar(i);
+    int advance = widths[i] - prev_width;
+    advances[advance_key(prev, c)] = advance;
+    out[i] = advance * factor;
+    prev = c;
+    prev_width = widths[i];
+  }
+}
+
 double RotatedDC::GetCharHeight() const {
   int h = dc.GetCharHeight();
   #ifdef __WXGTK__
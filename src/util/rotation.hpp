@@ -200,6 +200,11 @@ public:
   
   RealSize GetTextExtent(const String& text) const;
   double GetCharHeight() const;
+  /// The advance width of each character in text, when drawn as a single string
+  /** Advances are cached per font and pair of adjacent characters,
+   *  so measuring text that was measured before with the same font doesn't need the dc.
+   */
+  void GetTextAdvances(const String& text, vector<double>& out) const;
   
   void SetClippingRegion(const RealRect& rect);
   void DestroyClippingRegion();
@@ -210,6 +215,9 @@ public:
   Bitmap GetBackground(const RealRect& r);
   
   inline wxDC& getDC() { return dc; }
+  inline RenderQuality getQuality() const { return quality; }
+  /// Resolution of the dc, text measures differently at different resolutions
+  inline wxSize getPPI() const { return dc.GetPPI(); }
   
 private:
   wxDC& dc;        ///< The actual dc
@@ -26,6 +26,11 @@ using std::make_unique;
   #define USE_INTRUSIVE_PTR 1
 #endif
 
+// Allow objects to use non-atomic reference counting while they are only used by one thread
+#ifndef USE_THREAD_LOCAL_REF_COUNT
+  #define USE_THREAD_LOCAL_REF_COUNT 1
+#endif
+
 // ----------------------------------------------------------------------------- : Intrusive pointers
 
 #if USE_INTRUSIVE_PTR
@@ -41,21 +46,57 @@ public:
   // don't copy or assign ref count
   IntrusivePtrBase(IntrusivePtrBase const&) {}
   void operator = (IntrusivePtrBase const&) {}
+  
+  /// Allow this object to be referenced from other threads, see makeThreadLocal.
+  /** Must be called by the thread that owns the object, before it is handed to another thread.
+   */
+  inline void publish() const {
+    ref_count.fetch_and(~THREAD_LOCAL_BIT);
+  }
 protected:
   inline void destroy() const {
     delete static_cast<const T*>(this);
   }
+  /// Mark this object as only being referenced from one thread at a time.
+  /** The reference count is then updated without atomic read-modify-write operations.
+   *  Should be called from the constructor, before any intrusive_ptr to the object exists.
+   *  Before the object can be shared with other threads, publish() must be called.
+   */
+  inline void makeThreadLocal() {
+    #if USE_THREAD_LOCAL_REF_COUNT
+      ref_count.store(THREAD_LOCAL_BIT, std::memory_order_relaxed);
+    #endif
+  }
 private:
-  mutable std::atomic<unsigned int> ref_count = 0;
+  static const unsigned int THREAD_LOCAL_BIT = 1u << 31;
+  mutable std::atomic<unsigned int> ref_count = 0; ///< Reference count, with THREAD_LOCAL_BIT
   template <typename U> friend void intrusive_ptr_add_ref(const IntrusivePtrBase<U>* ptr);
   template <typename U> friend void intrusive_ptr_release(const IntrusivePtrBase<U>* ptr);
 };
 
 template <typename T> void intrusive_ptr_add_ref(const IntrusivePtrBase<T>* ptr) {
+  #if USE_THREAD_LOCAL_REF_COUNT
+    unsigned int count = ptr->ref_count.load(std::memory_order_relaxed);
+    if (count & IntrusivePtrBase<T>::THREAD_LOCAL_BIT) {
+      ptr->ref_count.store(count + 1, std::memory_order_relaxed);
+      return;
+    }
+  #endif
   ++(ptr->ref_count);
 }
 
 template <typename T> void intrusive_ptr_release(const IntrusivePtrBase<T>* ptr) {
+  #if USE_THREAD_LOCAL_REF_COUNT
+    unsigned int count = ptr->ref_count.load(std::memory_order_relaxed);
+    if (count & IntrusivePtrBase<T>::THREAD_LOCAL_BIT) {
+      if (count == (IntrusivePtrBase<T>::THREAD_LOCAL_BIT | 1)) {
+        static_cast<const T*>(ptr)->destroy();
+      } else {
+        ptr->ref_count.store(count - 1, std::memory_order_relaxed);
+      }
+      return;
+    }
+  #endif
   if (--(ptr->ref_count) == 0) {
     static_cast<const T*>(ptr)->destroy();
   }
@@ -81,7 +122,12 @@ inline intrusive_ptr<T> make_intrusive(Args&&... args) {
 template <typename T> using intrusive_ptr = shared_ptr<T>;
 
 /// Base class for types that can be pointed to
-template <typename T> class IntrusivePtrBase {};
+template <typename T> class IntrusivePtrBase {
+public:
+  inline void publish() const {}
+protected:
+  inline void makeThreadLocal() {}
+};
 
 template <typename T>
 class IntrusiveFromThis : public std::enable_shared_from_this<T> {
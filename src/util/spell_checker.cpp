@@ -14,8 +14,10 @@
 // ----------------------------------------------------------------------------- : Spell checker : construction
 
 map<String,SpellCheckerP> SpellChecker::spellers;
+std::mutex SpellChecker::spellers_mutex;
 
 SpellChecker* SpellChecker::get(const String& language) {
+  std::lock_guard<std::mutex> lock(spellers_mutex);
   SpellCheckerP& speller = spellers[language];
   if (!speller) {
     String local_dir  = package_manager.getDictionaryDir(true);
@@ -34,6 +36,7 @@ SpellChecker* SpellChecker::get(const String& language) {
 }
 
 SpellChecker* SpellChecker::get(const String& filename, const String& language) {
+  std::lock_guard<std::mutex> lock(spellers_mutex);
   SpellCheckerP& speller = spellers[filename + _(".") + language];
   if (!speller) {
     String prefix = package_manager.openFilenameFromPackage(nullptr, filename) + _(".");
@@ -63,6 +66,7 @@ SpellChecker::SpellChecker(const char* aff_path, const char* dic_path)
 {}
 
 void SpellChecker::destroyAll() {
+  std::lock_guard<std::mutex> lock(spellers_mutex);
   spellers.clear();
 }
 
@@ -106,6 +110,7 @@ bool SpellChecker::spell(const String& word) {
   if (word.empty()) return true; // empty word is okay
   CharBuffer str;
   if (!convert_encoding(word,str)) return false;
+  std::lock_guard<std::mutex> lock(mutex);
   return Hunspell::spell(str);
 }
 
@@ -114,7 +119,11 @@ void SpellChecker::suggest(const String& word, vector<String>& suggestions_out)
   if (!convert_encoding(word,str)) return;
   // call Hunspell
   char** suggestions;
-  int num_suggestions = Hunspell::suggest(&suggestions, str);
+  int num_suggestions;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    num_suggestions = Hunspell::suggest(&suggestions, str);
+  }
   // copy sugestions
   for (int i = 0 ; i < num_suggestions ; ++i) {
     suggestions_out.push_back(String(suggestions[i],encoding));
@@ -11,6 +11,7 @@
 #include <util/prec.hpp>
 #undef near
 #include "hunspell/hunspell.hxx"
+#include <mutex>
 
 DECLARE_POINTER_TYPE(SpellChecker);
 
@@ -27,17 +28,18 @@ class SpellChecker : public Hunspell, public IntrusivePtrBase<SpellChecker> {
 public:
   SpellChecker(const char* aff_path, const char* dic_path);
   /// Get a SpellChecker object for the given language.
-  /** Returns nullptr on error
-   *  Note: This is not threadsafe yet */
+  /** Returns nullptr on error.
+   *  Can be called from worker threads, the returned object lives until destroyAll. */
   static SpellChecker* get(const String& language);
   /// Get a SpellChecker object for the given language and filename
-  /** Returns nullptr on error
-   *  Note: This is not threadsafe yet */
+  /** Returns nullptr on error.
+   *  Can be called from worker threads, the returned object lives until destroyAll. */
   static SpellChecker* get(const String& filename, const String& language);
   /// Destroy all cached SpellChecker objects
   static void destroyAll();
 
   /// Check the spelling of a single word
+  /** Hunspell is not thread safe, so calls on the same checker are serialized */
   bool spell(const String& word);
 
   /// Give spelling suggestions
@@ -47,7 +49,9 @@ private:
   /// Convert between String and dictionary encoding
   wxCSConv encoding;
   bool convert_encoding(const String& word, CharBuffer& out);
+  std::mutex mutex; ///< Lock for using Hunspell
 
   static map<String,SpellCheckerP> spellers; //< Cached checkers for each language
+  static std::mutex spellers_mutex;          //< Lock for spellers
 };
 
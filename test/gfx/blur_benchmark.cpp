@@ -0,0 +1,55 @@
+//+----------------------------------------------------------------------------+
+//| Description:  Magic Set Editor - Program to make Magic (tm) cards          |
+//| Copyright:    (C) Twan van Laarhoven and the other MSE developers          |
+//| License:      GNU General Public License 2 or later (see file COPYING)     |
+//+----------------------------------------------------------------------------+
+
+// ----------------------------------------------------------------------------- : Includes
+
+#include "gfx_tests.hpp"
+#include <gfx/gfx.hpp>
+
+// ----------------------------------------------------------------------------- : Reference
+
+// The text shadow blur before gaussian_blur: blur_radius passes of a 5 point kernel, in place
+void iterated_blur(Byte* data, int w, int h, int blur_radius) {
+  for (int i = 0 ; i < blur_radius ; ++i) {
+    Byte* in = data;
+    for (int y = 0 ; y < h ; ++y) {
+      for (int x = 0 ; x < w ; ++x) {
+        *in = (2 * in[0] + (x == 0 ? in[0] : in[-1]) + (y == 0 ? in[0] : in[-w])
+                         + (x == w - 1 ? in[0] : in[1]) + (y == h - 1 ? in[0] : in[w])) / 6;
+        ++in;
+      }
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------- : Benchmark
+
+bool blur_benchmark() {
+  const int w = 1024, h = 1024;
+  vector<Byte> input(w * h), a, b;
+  fill_random(input.data(), input.size(), 23);
+  bool ok = true;
+  // text shadows
+  for (int radius : {1, 2, 4, 8, 9, 16, 32, 64}) {
+    a = b = input;
+    double old_ms = time_ms([&] { iterated_blur(a.data(), w, h, radius); });
+    double new_ms = time_ms([&] { blur_alpha(b.data(), w, h, radius); });
+    printf("  radius %2d: passes %8.2f ms, blur_alpha %8.2f ms\n", radius, old_ms, new_ms);
+    // small radii still use the passes, so they must give the same result
+    if (radius <= 8 && a != b) {
+      printf("  radius %d: blur_alpha differs from the passes of the small kernel\n", radius);
+      ok = false;
+    }
+  }
+  // drop shadows, gaussian_blur_tests checks that the results are close
+  for (double sigma : {2.0, 4.0, 8.0, 16.0, 32.0, 64.0}) {
+    a = b = input;
+    double old_ms = time_ms([&] { kernel_blur(a.data(), w, h, sigma, sigma); });
+    double new_ms = time_ms([&] { gaussian_blur(b.data(), w, h, sigma, sigma); });
+    printf("  sigma %4.1f: kernel %8.2f ms, gaussian_blur %8.2f ms\n", sigma, old_ms, new_ms);
+  }
+  return ok;
+}
@@ -0,0 +1,252 @@
+//+----------------------------------------------------------------------------+
+//| Description:  Magic Set Editor - Program to make Magic (tm) cards          |
+//| Copyright:    (C) Twan van Laarhoven and the other MSE developers          |
+//| License:      GNU General Public License 2 or later (see file COPYING)     |
+//+----------------------------------------------------------------------------+
+
+// ----------------------------------------------------------------------------- : Includes
+
+#include "gfx_tests.hpp"
+#include <gfx/gfx.hpp>
+#include <gfx/generated_image.hpp>
+
+// ----------------------------------------------------------------------------- : Reference
+
+/// Weights of a gaussian kernel with a range of 3 sigma, normalized to sum to 1
+vector<double> gaussian_kernel(double sigma, int max_range) {
+  double sigsqr2 = 1 / (2 * sigma * sigma);
+  int range = min(max_range, (int)(3*sigma));
+  vector<double> kernel;
+  double total = 0;
+  for (int d = -range ; d <= range ; ++d) {
+    kernel.push_back(exp(-d * d * sigsqr2));
+    total += kernel.back();
+  }
+  for (double& k : kernel) k /= total;
+  return kernel;
+}
+
+void kernel_blur(Byte* data, int w, int h, double sigma_x, double sigma_y) {
+  // blur horizontally
+  vector<double> blur_x(w*h, 0.0);
+  {
+    vector<double> kernel = gaussian_kernel(sigma_x, w);
+    int range = (int)kernel.size() / 2;
+    for (int d = -range ; d <= range ; ++d) {
+      double factor = kernel[d + range];
+      int x_start = max(0, -d), x_end = min(w, w-d);
+      for (int y = 0 ; y < h ; ++y) {
+        for (int x = x_start ; x < x_end ; ++x) {
+          blur_x[x + y*w] += data[x + d + y*w] * factor;
+        }
+      }
+    }
+  }
+  // blur vertically
+  vector<double> out(w*h, 0.0);
+  {
+    vector<double> kernel = gaussian_kernel(sigma_y, h);
+    int range = (int)kernel.size() / 2;
+    for (int d = -range ; d <= range ; ++d) {
+      double factor = kernel[d + range];
+      int y_start = max(0, -d), y_end = min(h, h-d);
+      for (int y = y_start ; y < y_end ; ++y) {
+        for (int x = 0 ; x < w ; ++x) {
+          out[x + y*w] += blur_x[x + (d + y)*w] * factor;
+        }
+      }
+    }
+  }
+  for (int i = 0 ; i < w * h ; ++i) {
+    data[i] = (Byte)min(255.0, out[i] + 0.5);
+  }
+}
+
+// ----------------------------------------------------------------------------- : Shapes
+
+// An alpha channel with a filled disc and a filled rectangle, so there are straight and round edges
+void draw_shapes(Byte* data, int w, int h) {
+  for (int y = 0 ; y < h ; ++y) {
+    for (int x = 0 ; x < w ; ++x) {
+      double dx = x - w * 0.35, dy = y - h * 0.4;
+      bool disc = dx * dx + dy * dy < w * h * 0.04;
+      bool rect = x > w * 0.55 && x < w * 0.8 && y > h * 0.3 && y < h * 0.75;
+      data[x + y*w] = disc || rect ? 255 : 0;
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------- : Properties
+
+// Blur a block in the middle of an empty array, and check that
+//  * the total weight is kept
+//  * the variance increases by sigma^2 in each direction
+//  * nothing spreads further than the three boxes reach, about 3 sigma
+bool check_blur_block(double sigma) {
+  const int w = 512, h = 384, block = 32;
+  vector<Byte> data(w * h, 0);
+  int x0 = w/2 - block/2, y0 = h/2 - block/2;
+  for (int y = y0 ; y < y0 + block ; ++y) {
+    for (int x = x0 ; x < x0 + block ; ++x) data[x + y*w] = 255;
+  }
+  double sigma_y_expected = sigma * 0.75;
+  gaussian_blur(data.data(), w, h, sigma, sigma_y_expected);
+  // moments
+  double total = 0, sum_x = 0, sum_y = 0, sum_xx = 0, sum_yy = 0;
+  int reach_x = 0, reach_y = 0;
+  for (int y = 0 ; y < h ; ++y) {
+    for (int x = 0 ; x < w ; ++x) {
+      double v = data[x + y*w];
+      if (v == 0) continue;
+      double dx = x - (w - 1) / 2.0, dy = y - (h - 1) / 2.0;
+      total += v;
+      sum_x += v * dx;  sum_xx += v * dx * dx;
+      sum_y += v * dy;  sum_yy += v * dy * dy;
+      reach_x = max(reach_x, abs(x - w/2) - block/2);
+      reach_y = max(reach_y, abs(y - h/2) - block/2);
+    }
+  }
+  double expected_total = 255.0 * block * block;
+  double block_variance = (block * block - 1) / 12.0;
+  double sigma_x = sqrt(max(0.0, sum_xx / total - (sum_x / total) * (sum_x / total) - block_variance));
+  double sigma_y = sqrt(max(0.0, sum_yy / total - (sum_y / total) * (sum_y / total) - block_variance));
+  bool ok = true;
+  if (fabs(total - expected_total) > 0.01 * expected_total) {
+    printf("  sigma %g: total weight %g, expected %g\n", sigma, total, expected_total);
+    ok = false;
+  }
+  if (fabs(sigma_x - sigma) > 0.1 * sigma || fabs(sigma_y - sigma_y_expected) > 0.1 * sigma_y_expected) {
+    printf("  sigma %g: measured spread %g x %g, expected %g x %g\n", sigma, sigma_x, sigma_y, sigma, sigma_y_expected);
+    ok = false;
+  }
+  if (reach_x > 3 * sigma + 3 || reach_y > 3 * sigma_y_expected + 3) {
+    printf("  sigma %g: blur reaches %d x %d pixels\n", sigma, reach_x, reach_y);
+    ok = false;
+  }
+  return ok;
+}
+
+// ----------------------------------------------------------------------------- : Comparison with the kernel
+
+// The boxes only approximate a gaussian, a per pixel difference up to this much is not visible in a shadow.
+// The largest differences are for small sigmas, where the box sizes are coarse.
+const int MAX_KERNEL_DIFFERENCE = 10;
+
+bool check_against_kernel(double sigma) {
+  const int w = 400, h = 300;
+  vector<Byte> a(w * h), b;
+  draw_shapes(a.data(), w, h);
+  b = a;
+  kernel_blur(a.data(), w, h, sigma, sigma);
+  gaussian_blur(b.data(), w, h, sigma, sigma);
+  int max_diff = 0;
+  for (int i = 0 ; i < w * h ; ++i) {
+    max_diff = max(max_diff, abs(a[i] - b[i]));
+  }
+  if (max_diff > MAX_KERNEL_DIFFERENCE) {
+    printf("  sigma %g: gaussian_blur differs from the kernel by up to %d\n", sigma, max_diff);
+    return false;
+  }
+  return true;
+}
+
+// Blur a completely opaque array, values outside it count as 0, so the edges should become lighter like they do with the kernel
+bool check_blur_edges(double sigma) {
+  const int w = 256, h = 192;
+  vector<Byte> a(w * h, 255), b(w * h, 255);
+  kernel_blur(a.data(), w, h, sigma, sigma);
+  gaussian_blur(b.data(), w, h, sigma, sigma);
+  int max_diff = 0;
+  for (int i = 0 ; i < w * h ; ++i) {
+    max_diff = max(max_diff, abs(a[i] - b[i]));
+  }
+  if (max_diff > MAX_KERNEL_DIFFERENCE) {
+    printf("  sigma %g: edges of an opaque array differ from the kernel by up to %d\n", sigma, max_diff);
+    return false;
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------- : Drop shadow
+
+/// A generated image that is a given image
+class FixedImage : public GeneratedImage {
+public:
+  FixedImage(const Image& image) : image(image) {}
+  Image generate(const Options&) const override { return image.Copy(); }
+  bool operator == (const GeneratedImage& that) const override { return this == &that; }
+private:
+  Image image;
+};
+
+// DropShadowImage with the kernel blur, the way it was before gaussian_blur
+Image reference_drop_shadow(Image img, double offset_x, double offset_y, double shadow_alpha, double shadow_blur_radius, Color shadow_color) {
+  int w = img.GetWidth(), h = img.GetHeight();
+  Byte* alpha = img.GetAlpha();
+  vector<Byte> shadow(alpha, alpha + w*h);
+  kernel_blur(shadow.data(), w, h, shadow_blur_radius * w, shadow_blur_radius * h);
+  Byte* data = img.GetData();
+  int dw = int(w * offset_x), dh = int(h * offset_y);
+  int x_start = max(0,   dw), y_start = max(0,   dh);
+  int x_end   = min(w, w+dw), y_end   = min(h, h+dh);
+  int delta = dw + w * dh;
+  int sa = (int)(shadow_alpha * (1 << 16));
+  for (int y = y_start ; y < y_end ; ++y) {
+    for (int x = x_start ; x < x_end ; ++x) {
+      int p  = x + y * w;
+      int a = alpha[p];
+      int shad = ((((255 - a)*sa)>>16) * shadow[p - delta]) / 255;
+      int factor = max(1, a + shad);
+      data[3 * p    ] = (a * data[3 * p    ] + shad * shadow_color.Red()  ) / factor;
+      data[3 * p + 1] = (a * data[3 * p + 1] + shad * shadow_color.Green()) / factor;
+      data[3 * p + 2] = (a * data[3 * p + 2] + shad * shadow_color.Blue() ) / factor;
+      alpha[p] = a + shad;
+    }
+  }
+  return img;
+}
+
+// The shadow is the only part that changed, so the result can differ as much as the blur does
+bool check_drop_shadow(double shadow_blur_radius) {
+  const int w = 300, h = 200;
+  Image img(w, h, false);
+  fill_random(img.GetData(), 3 * w * h, 29);
+  img.InitAlpha();
+  draw_shapes(img.GetAlpha(), w, h);
+  Color shadow_color(40, 0, 80);
+  Image expected = reference_drop_shadow(img.Copy(), 0.05, 0.08, 0.75, shadow_blur_radius, shadow_color);
+  Image actual = DropShadowImage(make_intrusive<FixedImage>(img), 0.05, 0.08, 0.75, shadow_blur_radius, shadow_color)
+                   .generate(GeneratedImage::Options());
+  int max_diff = 0;
+  for (int i = 0 ; i < w * h ; ++i) {
+    max_diff = max(max_diff, abs(expected.GetAlpha()[i] - actual.GetAlpha()[i]));
+    // colors only mix in the shadow where the image is transparent, and mostly keep the shadow color there
+    if (actual.GetAlpha()[i] > 8) {
+      for (int c = 0 ; c < 3 ; ++c) {
+        max_diff = max(max_diff, abs(expected.GetData()[3*i+c] - actual.GetData()[3*i+c]));
+      }
+    }
+  }
+  if (max_diff > MAX_KERNEL_DIFFERENCE) {
+    printf("  radius %g: drop shadow differs from the kernel version by up to %d\n", shadow_blur_radius, max_diff);
+    return false;
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------- : Tests
+
+bool gaussian_blur_tests() {
+  bool ok = true;
+  // below about 2 the whole pixel box sizes are too coarse to approximate a gaussian
+  for (double sigma : {2.0, 3.5, 8.0, 17.0, 40.0}) {
+    ok &= check_blur_block(sigma);
+    ok &= check_blur_edges(sigma);
+    ok &= check_against_kernel(sigma);
+  }
+  // radii relative to the image size, the larger ones are more than 8 pixels
+  for (double radius : {0.01, 0.03, 0.05, 0.1}) {
+    ok &= check_drop_shadow(radius);
+  }
+  return ok;
+}
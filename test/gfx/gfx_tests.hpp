@@ -0,0 +1,47 @@
+//+----------------------------------------------------------------------------+
+//| Description:  Magic Set Editor - Program to make Magic (tm) cards          |
+//| Copyright:    (C) Twan van Laarhoven and the other MSE developers          |
+//| License:      GNU General Public License 2 or later (see file COPYING)     |
+//+----------------------------------------------------------------------------+
+
+#pragma once
+
+// ----------------------------------------------------------------------------- : Includes
+
+#include <util/prec.hpp>
+#include <chrono>
+#include <random>
+
+// ----------------------------------------------------------------------------- : Tests
+
+// Each test returns true if it passed, failures are reported on stdout.
+// Benchmarks print their timings, they only fail if the results are wrong.
+
+/// Time blur_alpha against the passes of the small kernel that it replaces,
+/// and gaussian_blur against the full kernel that DropShadowImage used before
+bool blur_benchmark();
+/// Check the spread and edges of gaussian_blur, and compare it and DropShadowImage with the full kernel
+bool gaussian_blur_tests();
+/// Compare the vectorized per pixel loops (see PIXEL_LOOP_TARGETS) with their scalar versions
+bool pixel_loop_tests();
+/// Compare resample with the original single pass resampler, for random sizes
+bool resample_tests();
+
+// ----------------------------------------------------------------------------- : Utilities
+
+/// Milliseconds taken by calling f
+template <typename F>
+double time_ms(F f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// Fill an array with random bytes, the same ones on each run
+void fill_random(Byte* data, size_t n, unsigned seed);
+
+/// The blur of DropShadowImage before gaussian_blur, a full gaussian kernel in each direction
+/** sigma_x and sigma_y are in pixels, values outside the array count as 0.
+ *  The old code rounded the weights to 8 bits, which is too coarse for large sigmas, so this uses exact weights.
+ */
+void kernel_blur(Byte* data, int w, int h, double sigma_x, double sigma_y);
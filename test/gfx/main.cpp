@@ -0,0 +1,59 @@
+//+----------------------------------------------------------------------------+
+//| Description:  Magic Set Editor - Program to make Magic (tm) cards          |
+//| Copyright:    (C) Twan van Laarhoven and the other MSE developers          |
+//| License:      GNU General Public License 2 or later (see file COPYING)     |
+//+----------------------------------------------------------------------------+
+
+// ----------------------------------------------------------------------------- : Includes
+
+#include "gfx_tests.hpp"
+#include <wx/init.h>
+
+// ----------------------------------------------------------------------------- : Utilities
+
+void fill_random(Byte* data, size_t n, unsigned seed) {
+  std::mt19937 gen(seed);
+  for (size_t i = 0 ; i < n ; ++i) {
+    data[i] = (Byte)(gen() & 0xFF);
+  }
+}
+
+// ----------------------------------------------------------------------------- : Main
+
+struct GfxTest {
+  const char* name;
+  bool (*run)();
+};
+
+const GfxTest gfx_tests[] = {
+  {"blur-benchmark",   blur_benchmark},
+  {"gaussian-blur",    gaussian_blur_tests},
+  {"pixel-loops",      pixel_loop_tests},
+  {"resample",         resample_tests},
+};
+
+/// Test program for the image functions in src/gfx
+/** Usage: gfx-tests NAME...
+ *  Runs the named tests (see test/tests.cmake), or all of them when no name is given.
+ */
+int main(int argc, char** argv) {
+  wxInitializer init;
+  if (!init.IsOk()) {
+    printf("Failed to initialize wxWidgets\n");
+    return EXIT_FAILURE;
+  }
+  bool ok = true;
+  for (auto const& test : gfx_tests) {
+    bool selected = argc <= 1;
+    for (int i = 1 ; i < argc ; ++i) {
+      if (strcmp(argv[i], test.name) == 0) selected = true;
+    }
+    if (!selected) continue;
+    printf("%s\n", test.name);
+    if (!test.run()) {
+      printf("%s: FAILED\n", test.name);
+      ok = false;
+    }
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,224 @@
+//+----------------------------------------------------------------------------+
+//| Description:  Magic Set Editor - Program to make Magic (tm) cards          |
+//| Copyright:    (C) Twan van Laarhoven and the other MSE developers          |
+//| License:      GNU General Public License 2 or later (see file COPYING)     |
+//+----------------------------------------------------------------------------+
+
+// ----------------------------------------------------------------------------- : Includes
+
+#include "gfx_tests.hpp"
+#include <gfx/gfx.hpp>
+#include <util/vector2d.hpp>
+
+// ----------------------------------------------------------------------------- : Reference
+
+// The scalar versions of the per pixel loops, from before they were vectorized.
+// The optimized versions must give exactly the same results.
+
+int reference_combine(ImageCombine combine, int a, int b) {
+  switch (combine) {
+    case COMBINE_DEFAULT:
+    case COMBINE_NORMAL:      return b;
+    case COMBINE_ADD:         return top(a + b);
+    case COMBINE_SUBTRACT:    return bot(a - b);
+    case COMBINE_STAMP:       return col(a - 2 * b + 256);
+    case COMBINE_DIFFERENCE:  return abs(a - b);
+    case COMBINE_NEGATION:    return 255 - abs(255 - a - b);
+    case COMBINE_MULTIPLY:    return (a * b) / 255;
+    case COMBINE_DARKEN:      return min(a, b);
+    case COMBINE_LIGHTEN:     return max(a, b);
+    case COMBINE_COLOR_DODGE: return b == 255 ? 255 : top(a * 255 / (255 - b));
+    case COMBINE_COLOR_BURN:  return b == 0   ? 0   : bot(255 - (255-a) * 255 / b);
+    case COMBINE_SCREEN:      return 255 - (((255 - a) * (255 - b)) / 255);
+    case COMBINE_OVERLAY:     return a < 128 ? (a * b) >> 7 : 255 - (((255 - a) * (255 - b)) >> 7);
+    case COMBINE_HARD_LIGHT:  return b < 128 ? (a * b) >> 7 : 255 - (((255 - a) * (255 - b)) >> 7);
+    case COMBINE_SOFT_LIGHT:  return b;
+    case COMBINE_REFLECT:     return b == 255 ? 255 : top(a * a / (255 - b));
+    case COMBINE_GLOW:        return a == 255 ? 255 : top(b * b / (255 - a));
+    case COMBINE_FREEZE:      return b == 0 ? 0 : bot(255 - (255 - a) * (255 - a) / b);
+    case COMBINE_HEAT:        return a == 0 ? 0 : bot(255 - (255 - b) * (255 - b) / a);
+    case COMBINE_AND:         return a & b;
+    case COMBINE_OR:          return a | b;
+    case COMBINE_XOR:         return a ^ b;
+    case COMBINE_SHADOW:      return (b * a * a) / (255 * 255);
+    case COMBINE_SYMMETRIC_OVERLAY:
+      return (reference_combine(COMBINE_OVERLAY, a, b) + reference_combine(COMBINE_OVERLAY, b, a)) / 2;
+  }
+  return b;
+}
+
+void reference_linear_blend(Image& img1, const Image& img2, double x1,double y1, double x2,double y2) {
+  int width = img1.GetWidth(), height = img1.GetHeight();
+  const int fixed = 1<<16;
+  double a = fixed / (width * width * (x1-x2) * (x1-x2)  +  height * height * (y1-y2) * (y1-y2));
+  int xm = to_int( (x2 - x1) * width  * a );
+  int ym = to_int( (y2 - y1) * height * a );
+  int d  = to_int( - (x1 * width * xm + y1 * height * ym) );
+  Byte *data1 = img1.GetData(), *data2 = img2.GetData();
+  for (int y = 0 ; y < height ; ++y) {
+    for (int x = 0 ; x < width ; ++x) {
+      int mult = x * xm + y * ym + d;
+      if (mult < 0)      mult = 0;
+      if (mult > fixed)  mult = fixed;
+      data1[0] = data1[0] + mult * (data2[0] - data1[0]) / fixed;
+      data1[1] = data1[1] + mult * (data2[1] - data1[1]) / fixed;
+      data1[2] = data1[2] + mult * (data2[2] - data1[2]) / fixed;
+      data1 += 3;
+      data2 += 3;
+    }
+  }
+}
+
+void reference_mask_blend(Image& img1, const Image& img2, const Image& mask) {
+  UInt size = img1.GetWidth() * img1.GetHeight() * 3;
+  Byte *data1 = img1.GetData(), *data2 = img2.GetData(), *dataM = mask.GetData();
+  for (UInt i = 0 ; i < size ; ++i) {
+    data1[i] = (data1[i] * dataM[i] + data2[i] * (255 - dataM[i])) / 255;
+  }
+}
+
+void reference_invert(Image& img) {
+  Byte* data = img.GetData();
+  int n = 3 * img.GetWidth() * img.GetHeight();
+  for (int i = 0 ; i < n ; ++i) {
+    data[i] = 255 - data[i];
+  }
+}
+
+void reference_saturate(Image& image, double amount) {
+  Byte* pix = image.GetData();
+  Byte* end = pix + image.GetWidth() * image.GetHeight() * 3;
+  int factor = int(256 * amount);
+  if (factor == 0) {
+    return;
+  } else if (factor == 256) {
+    for ( ; pix != end ; pix += 3) {
+      int r = pix[0], g = pix[1], b = pix[2];
+      pix[0] = r+r > g+b ? 255 : 0;
+      pix[1] = g+g > b+r ? 255 : 0;
+      pix[2] = b+b > r+g ? 255 : 0;
+    }
+  } else if (factor > 0) {
+    int div = 768 - 3 * factor;
+    for ( ; pix != end ; pix += 3) {
+      int r = pix[0], g = pix[1], b = pix[2];
+      int avg = factor*(r+g+b);
+      pix[0] = col((768*r - avg) / div);
+      pix[1] = col((768*g - avg) / div);
+      pix[2] = col((768*b - avg) / div);
+    }
+  } else {
+    int factor1 = -factor;
+    int factor2 = 768 - 3*factor1;
+    for ( ; pix != end ; pix += 3) {
+      int r = pix[0], g = pix[1], b = pix[2];
+      int avg = factor1*(r+g+b);
+      pix[0] = (factor2*r + avg) / 768;
+      pix[1] = (factor2*g + avg) / 768;
+      pix[2] = (factor2*b + avg) / 768;
+    }
+  }
+}
+
+void reference_recolor(Image& img, RGB cr, RGB cg, RGB cb, RGB cw) {
+  RGB* data = (RGB*)img.GetData();
+  int n = img.GetWidth() * img.GetHeight();
+  for (int i = 0 ; i < n ; ++i) {
+    RGB x = data[i];
+    int lo = min(x.r,min(x.g,x.b));
+    int nr = x.r - lo, ng = x.g - lo, nb = x.b - lo, nw = lo;
+    int total = max(255, nr+ng+nb+nw);
+    data[i] = RGB(
+        static_cast<Byte>( (nr * cr.r + ng * cg.r + nb * cb.r + nw * cw.r) / total ),
+        static_cast<Byte>( (nr * cr.g + ng * cg.g + nb * cb.g + nw * cw.g) / total ),
+        static_cast<Byte>( (nr * cr.b + ng * cg.b + nb * cb.b + nw * cw.b) / total )
+      );
+  }
+}
+
+// ----------------------------------------------------------------------------- : Tests
+
+Image random_image(int w, int h, unsigned seed) {
+  Image img(w, h, false);
+  fill_random(img.GetData(), 3 * w * h, seed);
+  return img;
+}
+
+bool same_pixels(const Image& a, const Image& b, const char* what) {
+  if (memcmp(a.GetData(), b.GetData(), 3 * a.GetWidth() * a.GetHeight()) == 0) return true;
+  printf("  %s: result differs from the scalar version (%d x %d)\n", what, a.GetWidth(), a.GetHeight());
+  return false;
+}
+
+bool pixel_loop_tests() {
+  bool ok = true;
+  // the sizes are not multiples of the vector width, so the remainder loops are tested as well
+  const wxSize sizes[] = {wxSize(1,1), wxSize(37,23), wxSize(256,256), wxSize(1001,17)};
+  for (size_t s = 0 ; s < sizeof(sizes) / sizeof(sizes[0]) ; ++s) {
+    int w = sizes[s].x, h = sizes[s].y;
+    Image a = random_image(w, h, 2*s), b = random_image(w, h, 2*s+1);
+    if (w == 256 && h == 256) {
+      // all combinations of inputs in the first channel
+      for (int i = 0 ; i < w * h ; ++i) {
+        a.GetData()[3*i] = (Byte)(i & 0xFF);
+        b.GetData()[3*i] = (Byte)(i >> 8);
+      }
+    }
+    // combine_image, all modes
+    for (int c = COMBINE_NORMAL ; c <= COMBINE_SYMMETRIC_OVERLAY ; ++c) {
+      ImageCombine combine = (ImageCombine)c;
+      Image result = a.Copy(), expected = a.Copy();
+      combine_image(result, b, combine);
+      Byte *e = expected.GetData();
+      const Byte* bd = b.GetData();
+      for (int i = 0 ; i < 3 * w * h ; ++i) {
+        e[i] = (Byte)reference_combine(combine, e[i], bd[i]);
+      }
+      string name = "combine_image " + to_string(c);
+      ok &= same_pixels(result, expected, name.c_str());
+    }
+    // linear_blend, with a few directions
+    const double blends[][4] = {{0,0,1,1}, {0.2,0.9,0.7,0.1}, {0.5,0,0.5,1}, {-0.5,0.3,1.5,0.4}};
+    for (auto const& p : blends) {
+      Image result = a.Copy(), expected = a.Copy();
+      linear_blend(result, b, p[0], p[1], p[2], p[3]);
+      reference_linear_blend(expected, b, p[0], p[1], p[2], p[3]);
+      ok &= same_pixels(result, expected, "linear_blend");
+    }
+    // mask_blend
+    {
+      Image mask = random_image(w, h, 1000 + s);
+      Image result = a.Copy(), expected = a.Copy();
+      mask_blend(result, b, mask);
+      reference_mask_blend(expected, b, mask);
+      ok &= same_pixels(result, expected, "mask_blend");
+    }
+    // invert
+    {
+      Image result = a.Copy(), expected = a.Copy();
+      invert(result);
+      reference_invert(expected);
+      ok &= same_pixels(result, expected, "invert");
+    }
+    // saturate, with amounts for each of its cases
+    for (double amount : {-1.5, -0.75, -0.1, 0.1, 0.5, 0.95, 1.0}) {
+      Image result = a.Copy(), expected = a.Copy();
+      saturate(result, amount);
+      reference_saturate(expected, amount);
+      ok &= same_pixels(result, expected, "saturate");
+    }
+    // recolor, the totals are often more than 255 for random pixels
+    const RGB recolors[][4] = {
+      {RGB(255,0,0), RGB(0,255,0), RGB(0,0,255), RGB(255,255,255)},
+      {RGB(200,30,90), RGB(0,0,0), RGB(255,255,255), RGB(250,240,200)},
+      {RGB(17,250,3), RGB(128,128,128), RGB(90,0,255), RGB(0,0,0)},
+    };
+    for (auto const& c : recolors) {
+      Image result = a.Copy(), expected = a.Copy();
+      recolor(result, c[0], c[1], c[2], c[3]);
+      reference_recolor(expected, c[0], c[1], c[2], c[3]);
+      ok &= same_pixels(result, expected, "recolor");
+    }
+  }
+  return ok;
+}
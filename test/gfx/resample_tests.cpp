@@ -0,0 +1,128 @@
+//+----------------------------------------------------------------------------+
+//| Description:  Magic Set Editor - Program to make Magic (tm) cards          |
+//| Copyright:    (C) Twan van Laarhoven and the other MSE developers          |
+//| License:      GNU General Public License 2 or later (see file COPYING)     |
+//+----------------------------------------------------------------------------+
+
+// ----------------------------------------------------------------------------- : Includes
+
+#include "gfx_tests.hpp"
+#include <gfx/gfx.hpp>
+
+// ----------------------------------------------------------------------------- : Reference
+
+// The resampler from before the weights were precomputed: a single pass that 'eats' input pixels.
+// Originally it always used a shift of 14 with 32 bit sums, which overflows for lines longer than 1024 pixels.
+// The current resampler switches to a shift of 30 with 64 bit sums for those, so the reference does the same.
+template <typename Sum>
+void reference_resample_pass(const Image& img_in, Image& img_out, int shift, int offset_in, int offset_out,
+                             int length_in, int delta_in, int length_out, int delta_out,
+                             int lines, int line_delta_in, int line_delta_out)
+{
+  bool alpha = img_in.HasAlpha();
+  if (alpha && !img_out.HasAlpha()) img_out.InitAlpha();
+  Sum out_fact = ((Sum)length_out << shift) / length_in;
+  Sum out_rest = ((Sum)length_out << shift) % length_in;
+  for (int l = 0 ; l < lines ; ++l) {
+    Byte* in  = img_in .GetData() + 3 * (offset_in  + l * line_delta_in);
+    Byte* out = img_out.GetData() + 3 * (offset_out + l * line_delta_out);
+    Byte* in_a  = alpha ? img_in .GetAlpha() + (offset_in  + l * line_delta_in)  : nullptr;
+    Byte* out_a = alpha ? img_out.GetAlpha() + (offset_out + l * line_delta_out) : nullptr;
+    Sum in_rem = out_fact + out_rest;
+    for (int x = 0 ; x < length_out ; ++x) {
+      Sum out_rem = (Sum)1 << shift;
+      Sum totR = 0, totG = 0, totB = 0, totA = 0;
+      while (out_rem >= in_rem) {
+        Sum a = alpha ? in_a[0] : 1;
+        totR += in[0] * in_rem * a;
+        totG += in[1] * in_rem * a;
+        totB += in[2] * in_rem * a;
+        totA += in_rem * a;
+        out_rem -= in_rem;
+        in_rem = out_fact;
+        in += 3*delta_in;
+        if (alpha) in_a += delta_in;
+      }
+      if (out_rem > 0) {
+        Sum a = alpha ? in_a[0] : 1;
+        totR += in[0] * out_rem * a;
+        totG += in[1] * out_rem * a;
+        totB += in[2] * out_rem * a;
+        totA += out_rem * a;
+        in_rem -= out_rem;
+      }
+      if (!alpha) {
+        out[0] = (Byte)(totR >> shift);
+        out[1] = (Byte)(totG >> shift);
+        out[2] = (Byte)(totB >> shift);
+      } else if (totA) {
+        out[0] = (Byte)(totR / totA);
+        out[1] = (Byte)(totG / totA);
+        out[2] = (Byte)(totB / totA);
+        out_a[0] = (Byte)(totA >> shift);
+      } else {
+        out[0] = out[1] = out[2] = out_a[0] = 0;
+      }
+      out += 3*delta_out;
+      if (alpha) out_a += delta_out;
+    }
+  }
+}
+
+void reference_resample_pass(const Image& img_in, Image& img_out, int offset_in, int offset_out,
+                             int length_in, int delta_in, int length_out, int delta_out,
+                             int lines, int line_delta_in, int line_delta_out)
+{
+  if (length_in <= 1024 && length_out <= 1024) {
+    reference_resample_pass<UInt>    (img_in, img_out, 14, offset_in, offset_out, length_in, delta_in, length_out, delta_out, lines, line_delta_in, line_delta_out);
+  } else {
+    reference_resample_pass<uint64_t>(img_in, img_out, 30, offset_in, offset_out, length_in, delta_in, length_out, delta_out, lines, line_delta_in, line_delta_out);
+  }
+}
+
+Image reference_resample(const Image& img_in, int width, int height) {
+  Image img_temp(width, img_in.GetHeight(), false), img_out(width, height, false);
+  reference_resample_pass(img_in,   img_temp, 0, 0, img_in.GetWidth(),  1,     width,  1,     img_in.GetHeight(), img_in.GetWidth(), width);
+  reference_resample_pass(img_temp, img_out,  0, 0, img_in.GetHeight(), width, height, width, width,              1,                 1);
+  return img_out;
+}
+
+// ----------------------------------------------------------------------------- : Tests
+
+bool resample_test(int w, int h, int width, int height, bool alpha, unsigned seed) {
+  Image img(w, h, false);
+  fill_random(img.GetData(), 3 * w * h, seed);
+  if (alpha) {
+    img.InitAlpha();
+    fill_random(img.GetAlpha(), w * h, seed + 1);
+    // some fully transparent pixels
+    for (int i = 0 ; i < w * h ; i += 3) img.GetAlpha()[i] = 0;
+  }
+  Image img_out(width, height, false);
+  resample(img, img_out);
+  Image expected = reference_resample(img, width, height);
+  bool ok = memcmp(img_out.GetData(), expected.GetData(), 3 * width * height) == 0;
+  if (alpha) {
+    ok = ok && img_out.HasAlpha() && memcmp(img_out.GetAlpha(), expected.GetAlpha(), width * height) == 0;
+  }
+  if (!ok) {
+    printf("  %d x %d -> %d x %d%s: result differs from the reference\n", w, h, width, height, alpha ? " with alpha" : "");
+  }
+  return ok;
+}
+
+bool resample_tests() {
+  bool ok = true;
+  std::mt19937 gen(25);
+  auto random_size = [&](int max) { return 1 + (int)(gen() % max); };
+  for (int i = 0 ; i < 200 ; ++i) {
+    ok &= resample_test(random_size(600), random_size(600), random_size(700), random_size(700), i % 2 == 1, i);
+  }
+  // lines longer than 1024 pixels, these are also large enough to be split over threads
+  ok &= resample_test(1500, 1100, 1200, 2100, false, 1000);
+  ok &= resample_test(1500, 1100, 1200, 2100, true,  1001);
+  ok &= resample_test(3000, 200,  700,  1300, true,  1002);
+  ok &= resample_test(900,  1000, 1025, 1000, false, 1003);
+  ok &= resample_test(2000, 2000, 3,    2,    true,  1004);
+  return ok;
+}
@@ -16,5 +16,44 @@ add_test(
   COMMAND magicseteditor ${test_dir}/script/script-functions.mse-script
 )
 
+# Graphics tests, linked against the same objects as magicseteditor
+add_executable(gfx-tests
+  ${test_dir}/gfx/main.cpp
+  ${test_dir}/gfx/blur_benchmark.cpp
+  ${test_dir}/gfx/gaussian_blur_tests.cpp
+  ${test_dir}/gfx/pixel_loop_tests.cpp
+  ${test_dir}/gfx/resample_tests.cpp
+  $<TARGET_OBJECTS:mse-objects>
+)
+target_link_libraries(gfx-tests ${wxWidgets_LIBRARIES} ${Boost_LIBRARIES} ${HUNSPELL_LIBRARIES})
+target_link_libraries(gfx-tests ${PNG_LIBRARIES} ${JPEG_LIBRARIES} ${ZLIB_LIBRARIES} ${TIFF_LIBRARIES}) # only set for static builds
+
+add_test(
+  NAME gfx-pixel-loops
+  COMMAND gfx-tests pixel-loops
+)
+add_test(
+  NAME gfx-resample
+  COMMAND gfx-tests resample
+)
+add_test(
+  NAME gfx-gaussian-blur
+  COMMAND gfx-tests gaussian-blur
+)
+
+# Benchmarks, run them with ctest -L benchmark
+add_test(
+  NAME gfx-blur-benchmark
+  COMMAND gfx-tests blur-benchmark
+)
+set_tests_properties(gfx-blur-benchmark PROPERTIES LABELS benchmark)
+
+# To compare with atomic reference counts, build with -DUSE_THREAD_LOCAL_REF_COUNT=0
+add_test(
+  NAME script-benchmark
+  COMMAND magicseteditor ${test_dir}/script/script-benchmark.mse-script
+)
+set_tests_properties(script-benchmark PROPERTIES LABELS benchmark)
+
 # Rendering tests
 # TODO